@@ -0,0 +1,276 @@
+#ifndef ARENA
+#define ARENA
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+
+/*
+    An arena (bump allocator). Memory is handed out from large blocks by
+    moving a pointer forward, and is all given back at once when the arena
+    is freed, instead of malloc'ing and freeing every object one by one.
+
+    Containers can be built in an arena with new_list_in(), new_map_in(),
+    new_set_in() and new_string_in(). Everything they allocate (their arrays,
+    map elements and keys, set items, string buffers) then comes from the
+    arena, and freeing the arena frees all of it in one go without walking
+    the containers:
+    ```
+    Arena* arena = new_arena();
+    Map* map = new_map_in(arena);
+    List* list = new_list_in(arena);
+    for (int i = 0; i < 1000; ++i) {
+        m_int_put(map, i, "value", -1);
+        l_push(list, "value");
+    }
+    free_arena(arena); // no free_map() or free_list() needed
+    ```
+
+    Calling free_map(), free_list() etc. on a container in an arena is
+    allowed but doesn't give memory back, so arenas suit data that's built
+    up and thrown away together (a table, a query, a transaction).
+
+
+
+    # ERRORS
+
+    Arenas never exit the program. When an arena can't get more memory (the
+    system is out, or the arena's 'limit' would be passed) arena_alloc()
+    returns NULL, and containers built in the arena return 1 from the call
+    that needed the memory (l_push(), m_put(), s_add(), append() and so on)
+    leaving the container as it was. Containers on the heap keep exiting
+    when they run out of memory.
+
+    The limit makes arenas handy as a memory budget:
+    ```
+    Arena* arena = new_arena_s(ARENA_BLOCK_SIZE, 64 * 1024 * 1024);
+    String* out = new_string_in(arena);
+    if (append(out, big) != 0) {
+        // over budget
+    }
+    ```
+
+*/
+typedef struct ArenaBlock {
+    struct ArenaBlock* prev;
+    size_t size;
+    size_t used;
+    char* data;
+} ArenaBlock;
+
+typedef struct Arena {
+    ArenaBlock* block; // current block, linked back through the earlier ones
+    size_t block_size; // size of new blocks
+
+    size_t limit; // most bytes the arena can take from the system, 0 for no limit
+    size_t bytes; // bytes taken from the system so far
+
+    void* last; // most recent allocation, which arena_realloc() can grow in place
+} Arena;
+
+
+const size_t ARENA_BLOCK_SIZE = 65536;
+
+// every allocation is aligned to this
+#define ARENA_ALIGNMENT 16
+
+
+
+/*
+    Makes an arena with blocks of 'block_size' bytes that takes at most
+    'limit' bytes from the system (0 for no limit). Returns NULL if there
+    isn't memory for it.
+*/
+Arena* new_arena_s(size_t block_size, size_t limit) {
+    Arena* arena = malloc(sizeof(Arena));
+    if (arena == NULL) {
+        return NULL;
+    }
+    arena->block = NULL;
+    arena->block_size = block_size;
+    arena->limit = limit;
+    arena->bytes = 0;
+    arena->last = NULL;
+
+    return arena;
+}
+
+Arena* new_arena() {
+    return new_arena_s(ARENA_BLOCK_SIZE, 0);
+}
+
+static ArenaBlock* arena_new_block(Arena* arena, size_t size) {
+    size_t total = sizeof(ArenaBlock) + size + ARENA_ALIGNMENT;
+    if (arena->limit != 0 && arena->bytes + total > arena->limit) {
+        return NULL;
+    }
+
+    ArenaBlock* block = malloc(total);
+    if (block == NULL) {
+        return NULL;
+    }
+    block->size = size;
+    block->used = 0;
+    block->data = (char*) (((uintptr_t) (block + 1) + ARENA_ALIGNMENT - 1) & ~(uintptr_t) (ARENA_ALIGNMENT - 1));
+    arena->bytes += total;
+
+    return block;
+}
+
+/*
+    Gets 'size' bytes from the arena, aligned to ARENA_ALIGNMENT. Returns
+    NULL if the arena can't get more memory.
+*/
+void* arena_alloc(Arena* arena, size_t size) {
+    size_t aligned = (size + ARENA_ALIGNMENT - 1) & ~(size_t) (ARENA_ALIGNMENT - 1);
+    if (aligned == 0) {
+        aligned = ARENA_ALIGNMENT;
+    }
+
+    ArenaBlock* block = arena->block;
+    if (block == NULL || block->used + aligned > block->size) {
+
+        // big allocations get a block of their own behind the current one
+        // so they don't waste the rest of it
+        if (aligned > arena->block_size / 4 && block != NULL) {
+            ArenaBlock* big = arena_new_block(arena, aligned);
+            if (big == NULL) {
+                return NULL;
+            }
+            big->used = aligned;
+            big->prev = block->prev;
+            block->prev = big;
+            arena->last = NULL;
+            return big->data;
+        }
+
+        size_t size = aligned > arena->block_size ? aligned : arena->block_size;
+        block = arena_new_block(arena, size);
+        if (block == NULL) {
+            return NULL;
+        }
+        block->prev = arena->block;
+        arena->block = block;
+    }
+
+    void* ptr = block->data + block->used;
+    block->used += aligned;
+    arena->last = ptr;
+
+    return ptr;
+}
+
+/*
+    Resizes an allocation from the arena to 'new_size' bytes. The most
+    recent allocation is grown in place when there's room after it, anything
+    else is copied to a new allocation (the old one is only given back when
+    the arena is freed). Returns NULL, leaving 'ptr' as it was, if the arena
+    can't get more memory.
+*/
+void* arena_realloc(Arena* arena, void* ptr, size_t old_size, size_t new_size) {
+    if (ptr == NULL) {
+        return arena_alloc(arena, new_size);
+    }
+
+    if (ptr == arena->last) {
+        ArenaBlock* block = arena->block;
+        size_t offset = (char*) ptr - block->data;
+        size_t aligned = (new_size + ARENA_ALIGNMENT - 1) & ~(size_t) (ARENA_ALIGNMENT - 1);
+        if (offset + aligned <= block->size) {
+            block->used = offset + aligned;
+            return ptr;
+        }
+    }
+
+    if (new_size <= old_size) {
+        return ptr;
+    }
+
+    void* new_ptr = arena_alloc(arena, new_size);
+    if (new_ptr == NULL) {
+        return NULL;
+    }
+    memcpy(new_ptr, ptr, old_size);
+    return new_ptr;
+}
+
+/*
+    Copies 'len' characters starting at 'ptr' into the arena as a null
+    terminated string. Returns NULL if the arena can't get more memory.
+*/
+char* arena_strndup(Arena* arena, char* ptr, size_t len) {
+    char* copy = arena_alloc(arena, len + 1);
+    if (copy == NULL) {
+        return NULL;
+    }
+    memcpy(copy, ptr, len);
+    copy[len] = '\0';
+    return copy;
+}
+
+/*
+    Gives back everything allocated from the arena so it can be reused,
+    keeping one block so the next round of allocations doesn't start with
+    a malloc. Containers built in the arena must not be used afterwards.
+*/
+void arena_reset(Arena* arena) {
+    if (arena->block == NULL) {
+        return;
+    }
+
+    ArenaBlock* block = arena->block->prev;
+    while (block != NULL) {
+        ArenaBlock* prev = block->prev;
+        arena->bytes -= sizeof(ArenaBlock) + block->size + ARENA_ALIGNMENT;
+        free(block);
+        block = prev;
+    }
+    arena->block->prev = NULL;
+    arena->block->used = 0;
+    arena->last = NULL;
+}
+
+/*
+    Frees the arena and everything allocated from it.
+*/
+void free_arena(Arena* arena) {
+    ArenaBlock* block = arena->block;
+    while (block != NULL) {
+        ArenaBlock* prev = block->prev;
+        free(block);
+        block = prev;
+    }
+    free(arena);
+}
+
+
+
+/*
+    Allocation helpers for containers that can live either on the heap
+    (arena is NULL) or in an arena.
+*/
+static inline void* a_malloc(Arena* arena, size_t size) {
+    if (arena == NULL) {
+        return malloc(size);
+    }
+    return arena_alloc(arena, size);
+}
+
+static inline void* a_realloc(Arena* arena, void* ptr, size_t old_size, size_t new_size) {
+    if (arena == NULL) {
+        return realloc(ptr, new_size);
+    }
+    return arena_realloc(arena, ptr, old_size, new_size);
+}
+
+static inline void a_free(Arena* arena, void* ptr) {
+    if (arena == NULL) {
+        free(ptr);
+    }
+}
+
+
+
+#endif
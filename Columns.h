@@ -0,0 +1,1064 @@
+#ifndef COLUMNS
+#define COLUMNS
+
+#include "String.h"
+#include "Map.h"
+#include "Numeric.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+
+/*
+    Column oriented storage for tables of strings. Instead of each row being
+    its own allocation with a pointer per cell, every column keeps its values
+    back to back in one buffer with an offset per row, and rows are just ids
+    (0, 1, 2, ...) into the columns:
+    ```
+    ColumnStore* store = new_column_store(3);
+    cs_push_value(store, sv("user_123"));
+    cs_push_value(store, sv("bob@gmail.com"));
+    cs_push_value(store, sv("12"));
+    size_t id = cs_end_row(store);
+
+    cs_get(store, id, 1); // "bob@gmail.com"
+    free_column_store(store);
+    ```
+
+    A cell costs its characters, a null terminator and an 8 byte offset,
+    where a separately malloc'd string costs an allocation of at least 32
+    bytes plus the pointer to it. Scanning a column reads one buffer from
+    front to back.
+
+    Rows can only be added, not changed, so callers wanting to update a row
+    add a new one and delete the old one with cs_delete_row(). Deleted rows
+    keep their id and their values, they're just left out of filters.
+
+
+
+    # ENCODINGS
+
+    cs_compress() re-encodes each column in whichever of these takes the
+    least memory for the values it holds:
+    - COLUMN_DICTIONARY stores each distinct value once and a code per row,
+      bit packed into as few bits as the number of distinct values needs
+      (a column of 50 cities takes 6 bits a row).
+    - COLUMN_RUN_LENGTH stores a value once per run of equal values, with
+      the row the run ends at (good for sorted or grouped columns).
+    - COLUMN_FRAME_OF_REFERENCE stores integers as bit packed offsets from
+      the column's smallest (ids 1000000 to 1001000 take 10 bits a row).
+      Only integers that print back the same way ("12", not "012" or "+12")
+      are stored this way, so values always read back exactly as given.
+
+    Encoded columns can still be added to, growing their dictionaries or
+    widening their codes as needed. A number column given something that
+    isn't a number goes back to plain.
+
+    cs_filter_equals() and cs_filter_range() find matching rows without
+    decoding values: a dictionary column compares the value once and then
+    just codes, a run length column compares once per run and a number
+    column compares offsets. Matches are set in a bitmap of
+    cs_bitmap_words() words (bit 'row % 64' of word 'row / 64'), so filters
+    on several columns can be and-ed together.
+    ```
+    uint64_t* matches = malloc(cs_bitmap_words(store) * sizeof(uint64_t));
+    uint64_t* likes = malloc(cs_bitmap_words(store) * sizeof(uint64_t));
+    cs_filter_equals(store, 3, sv("paris"), matches);
+    cs_filter_range(store, 2, 10, 100, likes);
+    for (size_t w = 0; w < cs_bitmap_words(store); ++w) {
+        matches[w] &= likes[w];
+    }
+    ```
+
+
+
+    # SNAPSHOTS
+
+    cs_save() writes a store out as it is in memory, and cs_load() makes a
+    store straight from those bytes (typically a memory mapped file) without
+    copying or parsing the columns. Columns of a loaded store point into the
+    bytes until they're first added to, when they're copied to the heap.
+    Snapshots are in the machine's byte order.
+
+*/
+typedef enum ColumnEncoding {
+    COLUMN_PLAIN,
+    COLUMN_DICTIONARY,
+    COLUMN_RUN_LENGTH,
+    COLUMN_FRAME_OF_REFERENCE,
+} ColumnEncoding;
+
+typedef struct Column {
+    ColumnEncoding encoding;
+
+    // values back to back, each null terminated: every row's in a plain
+    // column, each distinct one in a dictionary column and each run's in a
+    // run length column
+    char* data;
+    size_t len;
+    size_t size;
+
+    size_t* offsets; // where each value starts in 'data'
+    size_t num_values;
+    size_t values_size; // room in 'offsets' (and 'run_ends')
+
+    // the row after each run ends, for run length columns
+    size_t* run_ends;
+
+    // values to their code + 1, for dictionary columns
+    Map* codes;
+
+    // a code (dictionary) or offset from 'min' (frame of reference) per
+    // row, 'width' bits each
+    uint64_t* packed;
+    size_t packed_size; // in words
+    unsigned int width;
+    long min;
+    long max;
+
+    // where cs_get() formats frame of reference values
+    char number[NUMERIC_BUFFER_SIZE];
+
+    // 1 if 'data', 'offsets', 'run_ends' and 'packed' point into a snapshot
+    // (see cs_load()) rather than being the column's own
+    int mapped;
+} Column;
+
+typedef struct ColumnStore {
+    Column* columns;
+    size_t num_columns;
+
+    size_t num_rows;
+
+    // a bit per row set by cs_delete_row()
+    uint64_t* deleted;
+    size_t rows_size; // room in 'deleted' (a multiple of 64)
+
+    size_t row_len; // values pushed so far to the row being built
+} ColumnStore;
+
+
+const size_t COLUMN_DATA_SIZE = 1024;
+const size_t COLUMN_VALUES_SIZE = 256;
+const size_t COLUMN_ROWS_SIZE = 256;
+
+// columns with more distinct values than this aren't dictionary encoded
+const size_t COLUMN_MAX_DICTIONARY = 65536;
+
+// roughly what a Map entry costs besides its key
+const size_t COLUMN_MAP_ENTRY_BYTES = 64;
+
+
+
+static void columns_mem_error_exit_failing() {
+    fprintf(stderr, "ColumnStore couldn't get more memory on the system! Exiting...");
+    exit(EXIT_FAILURE);
+}
+
+static void init_column(Column* column, ColumnEncoding encoding) {
+    column->encoding = encoding;
+    column->data = malloc(COLUMN_DATA_SIZE);
+    column->len = 0;
+    column->size = COLUMN_DATA_SIZE;
+    column->offsets = malloc(COLUMN_VALUES_SIZE * sizeof(size_t));
+    column->num_values = 0;
+    column->values_size = COLUMN_VALUES_SIZE;
+    column->run_ends = NULL;
+    column->codes = NULL;
+    column->packed = NULL;
+    column->packed_size = 0;
+    column->width = 0;
+    column->min = 0;
+    column->max = 0;
+    column->mapped = 0;
+    if (column->data == NULL || column->offsets == NULL) {
+        columns_mem_error_exit_failing();
+    }
+
+    if (encoding == COLUMN_RUN_LENGTH) {
+        column->run_ends = malloc(COLUMN_VALUES_SIZE * sizeof(size_t));
+        if (column->run_ends == NULL) {
+            columns_mem_error_exit_failing();
+        }
+    }
+    else if (encoding == COLUMN_DICTIONARY) {
+        column->codes = new_map();
+    }
+}
+
+static void free_column(Column* column) {
+    if (!column->mapped) {
+        free(column->data);
+        free(column->offsets);
+        free(column->run_ends);
+        free(column->packed);
+    }
+    if (column->codes != NULL) {
+        free_map(column->codes, 0);
+    }
+}
+
+ColumnStore* new_column_store(size_t num_columns) {
+    ColumnStore* store = malloc(sizeof(ColumnStore));
+    Column* columns = malloc((num_columns > 0 ? num_columns : 1) * sizeof(Column));
+    uint64_t* deleted = calloc(COLUMN_ROWS_SIZE / 64, sizeof(uint64_t));
+    if (store == NULL || columns == NULL || deleted == NULL) {
+        columns_mem_error_exit_failing();
+    }
+    store->columns = columns;
+    store->num_columns = num_columns;
+    store->num_rows = 0;
+    store->deleted = deleted;
+    store->rows_size = COLUMN_ROWS_SIZE;
+    store->row_len = 0;
+
+    for (size_t c = 0; c < num_columns; ++c) {
+        init_column(&store->columns[c], COLUMN_PLAIN);
+    }
+
+    return store;
+}
+
+void free_column_store(ColumnStore* store) {
+    for (size_t c = 0; c < store->num_columns; ++c) {
+        free_column(&store->columns[c]);
+    }
+    free(store->columns);
+    free(store->deleted);
+    free(store);
+}
+
+
+
+// VALUES AND BIT PACKING
+
+/*
+    copies a value onto the end of a column's values, returning its index
+*/
+static size_t column_add_value(Column* column, StringView value) {
+    if (column->len + value.len + 1 > column->size) {
+        size_t new_size = column->size * 2;
+        if (new_size < column->len + value.len + 1) {
+            new_size = column->len + value.len + 1;
+        }
+        char* new_data = realloc(column->data, new_size);
+        if (new_data == NULL) {
+            columns_mem_error_exit_failing();
+        }
+        column->data = new_data;
+        column->size = new_size;
+    }
+    if (column->num_values == column->values_size) {
+        column->values_size *= 2;
+        size_t* offsets = realloc(column->offsets, column->values_size * sizeof(size_t));
+        if (offsets == NULL) {
+            columns_mem_error_exit_failing();
+        }
+        column->offsets = offsets;
+
+        if (column->run_ends != NULL) {
+            size_t* run_ends = realloc(column->run_ends, column->values_size * sizeof(size_t));
+            if (run_ends == NULL) {
+                columns_mem_error_exit_failing();
+            }
+            column->run_ends = run_ends;
+        }
+    }
+
+    column->offsets[column->num_values] = column->len;
+    memcpy(column->data + column->len, value.ptr, value.len);
+    column->len += value.len;
+    column->data[column->len++] = '\0';
+    return column->num_values++;
+}
+
+static StringView column_value(Column* column, size_t index) {
+    size_t start = column->offsets[index];
+    size_t end = index + 1 < column->num_values ? column->offsets[index + 1] : column->len;
+    return sv_n(column->data + start, end - start - 1);
+}
+
+/*
+    the Map can't take an empty key, so the empty value is looked up as a
+    lone null character (values are read back as null terminated strings,
+    so one holding a null character isn't supported anyway)
+*/
+static StringView column_code_key(StringView value) {
+    return value.len > 0 ? value : sv_n("", 1);
+}
+
+/*
+    parses a value that is an integer written the way format_long() would
+    write it, so it can be stored as a number and read back the same
+*/
+static int column_integer(StringView value, long* out) {
+    char buffer[NUMERIC_BUFFER_SIZE];
+    return value.len < NUMERIC_BUFFER_SIZE
+        && sv_to_long(value, out) == 0
+        && format_long(*out, buffer) == value.len
+        && memcmp(buffer, value.ptr, value.len) == 0;
+}
+
+static unsigned int bits_needed(uint64_t value) {
+    return value == 0 ? 0 : 64 - __builtin_clzll(value);
+}
+
+static inline uint64_t packed_get(uint64_t* packed, unsigned int width, size_t index) {
+    if (width == 0) {
+        return 0;
+    }
+    size_t bit = index * width;
+    size_t word = bit >> 6;
+    unsigned int shift = bit & 63;
+    uint64_t value = packed[word] >> shift;
+    if (shift + width > 64) {
+        value |= packed[word + 1] << (64 - shift);
+    }
+    return width == 64 ? value : value & (((uint64_t) 1 << width) - 1);
+}
+
+/*
+    sets a packed slot that is still zero
+*/
+static inline void packed_put(uint64_t* packed, unsigned int width, size_t index, uint64_t value) {
+    if (width == 0) {
+        return;
+    }
+    size_t bit = index * width;
+    size_t word = bit >> 6;
+    unsigned int shift = bit & 63;
+    packed[word] |= value << shift;
+    if (shift + width > 64) {
+        packed[word + 1] |= value >> (64 - shift);
+    }
+}
+
+static void column_reserve_packed(Column* column, size_t num_rows) {
+    size_t needed = (num_rows * column->width + 63) / 64;
+    if (needed <= column->packed_size) {
+        return;
+    }
+
+    size_t new_size = column->packed_size * 2;
+    if (new_size < needed) {
+        new_size = needed < 16 ? 16 : needed;
+    }
+    uint64_t* packed = realloc(column->packed, new_size * sizeof(uint64_t));
+    if (packed == NULL) {
+        columns_mem_error_exit_failing();
+    }
+    memset(packed + column->packed_size, 0, (new_size - column->packed_size) * sizeof(uint64_t));
+    column->packed = packed;
+    column->packed_size = new_size;
+}
+
+/*
+    rewrites the first 'num_rows' packed slots with a new width, and for
+    frame of reference columns a new (smaller or equal) minimum
+*/
+static void column_repack(Column* column, size_t num_rows, unsigned int width, long min) {
+    size_t packed_size = (num_rows * width + 63) / 64 * 2;
+    if (packed_size < 16) {
+        packed_size = 16;
+    }
+    uint64_t* packed = calloc(packed_size, sizeof(uint64_t));
+    if (packed == NULL) {
+        columns_mem_error_exit_failing();
+    }
+
+    uint64_t shift = (uint64_t) column->min - (uint64_t) min;
+    for (size_t r = 0; r < num_rows; ++r) {
+        packed_put(packed, width, r, packed_get(column->packed, column->width, r) + shift);
+    }
+
+    free(column->packed);
+    column->packed = packed;
+    column->packed_size = packed_size;
+    column->width = width;
+    column->min = min;
+}
+
+/*
+    gets a column's value at a row, whatever its encoding
+*/
+static StringView column_view(Column* column, size_t row) {
+    switch (column->encoding) {
+        case COLUMN_DICTIONARY:
+            return column_value(column, packed_get(column->packed, column->width, row));
+
+        case COLUMN_RUN_LENGTH: {
+            size_t low = 0;
+            size_t high = column->num_values - 1;
+            while (low < high) {
+                size_t middle = low + (high - low) / 2;
+                if (column->run_ends[middle] > row) {
+                    high = middle;
+                }
+                else {
+                    low = middle + 1;
+                }
+            }
+            return column_value(column, low);
+        }
+
+        case COLUMN_FRAME_OF_REFERENCE: {
+            long value = (long) ((uint64_t) column->min + packed_get(column->packed, column->width, row));
+            size_t len = format_long(value, column->number);
+            return sv_n(column->number, len);
+        }
+
+        default:
+            return column_value(column, row);
+    }
+}
+
+/*
+    turns an encoded column back into a plain one
+*/
+static void column_decode(Column* column, size_t num_rows) {
+    Column plain;
+    init_column(&plain, COLUMN_PLAIN);
+    for (size_t r = 0; r < num_rows; ++r) {
+        column_add_value(&plain, column_view(column, r));
+    }
+    free_column(column);
+    *column = plain;
+}
+
+static void* column_copy(void* from, size_t bytes, size_t size) {
+    void* copy = malloc(size > 0 ? size : 1);
+    if (copy == NULL) {
+        columns_mem_error_exit_failing();
+    }
+    memcpy(copy, from, bytes);
+    return copy;
+}
+
+/*
+    copies a column that points into a snapshot to the heap, so it can be
+    changed
+*/
+static void column_own(Column* column) {
+    if (!column->mapped) {
+        return;
+    }
+
+    size_t values_size = column->num_values > COLUMN_VALUES_SIZE ? column->num_values : COLUMN_VALUES_SIZE;
+    size_t size = column->len > COLUMN_DATA_SIZE ? column->len : COLUMN_DATA_SIZE;
+    column->data = column_copy(column->data, column->len, size);
+    column->size = size;
+    column->offsets = column_copy(column->offsets, column->num_values * sizeof(size_t), values_size * sizeof(size_t));
+    if (column->run_ends != NULL) {
+        column->run_ends = column_copy(column->run_ends, column->num_values * sizeof(size_t), values_size * sizeof(size_t));
+    }
+    column->values_size = values_size;
+    if (column->packed != NULL) {
+        column->packed = column_copy(column->packed, column->packed_size * sizeof(uint64_t), column->packed_size * sizeof(uint64_t));
+    }
+    column->mapped = 0;
+}
+
+/*
+    adds the value of 'row', the row after the column's last
+*/
+static void column_append(Column* column, size_t row, StringView value) {
+    column_own(column);
+    switch (column->encoding) {
+        case COLUMN_DICTIONARY: {
+            StringView key = column_code_key(value);
+            void* found = m_any_get(column->codes, key.ptr, key.len);
+            size_t code;
+            if (found != NULL) {
+                code = (uintptr_t) found - 1;
+            }
+            else {
+                code = column_add_value(column, value);
+                m_any_put(column->codes, key.ptr, key.len, (void*) (uintptr_t) (code + 1), 0);
+                if (bits_needed(code) > column->width) {
+                    column_repack(column, row, bits_needed(code), 0);
+                }
+            }
+            column_reserve_packed(column, row + 1);
+            packed_put(column->packed, column->width, row, code);
+            break;
+        }
+
+        case COLUMN_RUN_LENGTH:
+            if (column->num_values > 0 && sv_equals(column_value(column, column->num_values - 1), value)) {
+                column->run_ends[column->num_values - 1] = row + 1;
+            }
+            else {
+                size_t run = column_add_value(column, value);
+                column->run_ends[run] = row + 1;
+            }
+            break;
+
+        case COLUMN_FRAME_OF_REFERENCE: {
+            long number;
+            if (!column_integer(value, &number)) {
+                column_decode(column, row);
+                column_add_value(column, value);
+                break;
+            }
+
+            if (row == 0) {
+                column->min = number;
+                column->max = number;
+            }
+            else if (number < column->min || number > column->max) {
+                long min = number < column->min ? number : column->min;
+                long max = number > column->max ? number : column->max;
+                column_repack(column, row, bits_needed((uint64_t) max - (uint64_t) min), min);
+                column->max = max;
+            }
+            column_reserve_packed(column, row + 1);
+            packed_put(column->packed, column->width, row, (uint64_t) number - (uint64_t) column->min);
+            break;
+        }
+
+        default:
+            column_add_value(column, value);
+    }
+}
+
+
+
+// ADDING AND GETTING ROWS
+
+/*
+    Adds the next value of the row being built (the one the next cs_end_row()
+    call finishes). Values past the last column are ignored.
+*/
+void cs_push_value(ColumnStore* store, StringView value) {
+    if (store->row_len >= store->num_columns) {
+        return;
+    }
+    column_append(&store->columns[store->row_len++], store->num_rows, value);
+}
+
+/*
+    Finishes the row being built, giving columns that weren't set an empty
+    value, and returns its id.
+*/
+size_t cs_end_row(ColumnStore* store) {
+    while (store->row_len < store->num_columns) {
+        cs_push_value(store, sv_n("", 0));
+    }
+
+    size_t row = store->num_rows++;
+    store->row_len = 0;
+    if (store->num_rows == store->rows_size) {
+        uint64_t* deleted = realloc(store->deleted, store->rows_size * 2 / 64 * sizeof(uint64_t));
+        if (deleted == NULL) {
+            columns_mem_error_exit_failing();
+        }
+        memset(deleted + store->rows_size / 64, 0, store->rows_size / 64 * sizeof(uint64_t));
+        store->deleted = deleted;
+        store->rows_size *= 2;
+    }
+
+    return row;
+}
+
+/*
+    Gets the value at a row and column as a null terminated string.
+
+    Values in number columns are formatted into a buffer in the column, so
+    they're only good until the next cs_get() on that column.
+*/
+char* cs_get(ColumnStore* store, size_t row, size_t column) {
+    return column_view(&store->columns[column], row).ptr;
+}
+
+/*
+    Gets the value at a row and column as a view (without a strlen), good
+    for as long as a cs_get() would be.
+*/
+StringView cs_get_view(ColumnStore* store, size_t row, size_t column) {
+    return column_view(&store->columns[column], row);
+}
+
+/*
+    Marks a row as deleted, leaving it out of filters.
+*/
+void cs_delete_row(ColumnStore* store, size_t row) {
+    store->deleted[row >> 6] |= (uint64_t) 1 << (row & 63);
+}
+
+int cs_is_deleted(ColumnStore* store, size_t row) {
+    return (store->deleted[row >> 6] >> (row & 63)) & 1;
+}
+
+/*
+    Returns the number of rows that aren't deleted.
+*/
+size_t cs_live_rows(ColumnStore* store) {
+    size_t deleted = 0;
+    for (size_t w = 0; w < (store->num_rows + 63) / 64; ++w) {
+        deleted += __builtin_popcountll(store->deleted[w]);
+    }
+    return store->num_rows - deleted;
+}
+
+
+
+// ENCODING
+
+/*
+    picks the encoding taking the least memory for a plain column's values
+*/
+static ColumnEncoding column_best_encoding(Column* column, size_t num_rows) {
+    size_t plain_bytes = column->len + num_rows * sizeof(size_t);
+
+    size_t num_runs = 0;
+    size_t run_bytes = 0;
+    Map* distinct = new_map();
+    size_t distinct_bytes = 0;
+    int is_dictionary = 1;
+    int is_integers = 1;
+    long min = 0;
+    long max = 0;
+
+    // equal values in a row only need checking once
+    StringView previous = sv_n("", 0);
+    for (size_t r = 0; r < num_rows; ++r) {
+        StringView value = column_value(column, r);
+        if (r > 0 && sv_equals(value, previous)) {
+            continue;
+        }
+        previous = value;
+
+        ++num_runs;
+        run_bytes += value.len + 1;
+
+        StringView key = column_code_key(value);
+        if (is_dictionary && !m_any_contains(distinct, key.ptr, key.len)) {
+            is_dictionary = distinct->len < COLUMN_MAX_DICTIONARY;
+            m_any_put(distinct, key.ptr, key.len, NULL, 0);
+            distinct_bytes += value.len + 1;
+        }
+
+        long number;
+        if (is_integers && column_integer(value, &number)) {
+            min = r == 0 || number < min ? number : min;
+            max = r == 0 || number > max ? number : max;
+        }
+        else {
+            is_integers = 0;
+        }
+    }
+
+    size_t num_distinct = distinct->len;
+    free_map(distinct, 0);
+
+    ColumnEncoding best = COLUMN_PLAIN;
+    size_t best_bytes = plain_bytes;
+
+    size_t encoded_bytes = (num_rows * bits_needed((uint64_t) max - (uint64_t) min) + 7) / 8;
+    if (is_integers && encoded_bytes < best_bytes) {
+        best = COLUMN_FRAME_OF_REFERENCE;
+        best_bytes = encoded_bytes;
+    }
+
+    encoded_bytes = distinct_bytes * 2 + num_distinct * (sizeof(size_t) + COLUMN_MAP_ENTRY_BYTES)
+        + (num_rows * bits_needed(num_distinct - 1) + 7) / 8;
+    if (is_dictionary && encoded_bytes < best_bytes) {
+        best = COLUMN_DICTIONARY;
+        best_bytes = encoded_bytes;
+    }
+
+    encoded_bytes = run_bytes + num_runs * 2 * sizeof(size_t);
+    if (encoded_bytes < best_bytes) {
+        best = COLUMN_RUN_LENGTH;
+        best_bytes = encoded_bytes;
+    }
+
+    return best;
+}
+
+/*
+    Re-encodes each plain column in whichever encoding takes the least
+    memory for the values it holds so far (see ENCODINGS above). Worth
+    calling once a store's rows have been loaded.
+*/
+void cs_compress(ColumnStore* store) {
+    if (store->num_rows == 0) {
+        return;
+    }
+
+    for (size_t c = 0; c < store->num_columns; ++c) {
+        Column* column = &store->columns[c];
+        if (column->encoding != COLUMN_PLAIN) {
+            continue;
+        }
+
+        ColumnEncoding encoding = column_best_encoding(column, store->num_rows);
+        if (encoding == COLUMN_PLAIN) {
+            continue;
+        }
+
+        Column encoded;
+        init_column(&encoded, encoding);
+        for (size_t r = 0; r < store->num_rows; ++r) {
+            column_append(&encoded, r, column_value(column, r));
+        }
+        free_column(column);
+        *column = encoded;
+    }
+}
+
+/*
+    Returns roughly the bytes the store takes up on the heap. Columns still
+    pointing into a snapshot (see cs_load()) are paged in and out by the OS,
+    so only their dictionaries count.
+*/
+size_t cs_memory(ColumnStore* store) {
+    size_t bytes = sizeof(ColumnStore) + store->num_columns * sizeof(Column) + store->rows_size / 8;
+    for (size_t c = 0; c < store->num_columns; ++c) {
+        Column* column = &store->columns[c];
+        if (!column->mapped) {
+            bytes += column->size + column->values_size * sizeof(size_t) + column->packed_size * sizeof(uint64_t);
+            if (column->run_ends != NULL) {
+                bytes += column->values_size * sizeof(size_t);
+            }
+        }
+        if (column->codes != NULL) {
+            bytes += column->codes->data_size * sizeof(Element*) + column->len + column->codes->len * COLUMN_MAP_ENTRY_BYTES;
+        }
+    }
+    return bytes;
+}
+
+
+
+// FILTERS
+
+/*
+    Returns how many words a bitmap with a bit per row needs.
+*/
+size_t cs_bitmap_words(ColumnStore* store) {
+    return (store->num_rows + 63) / 64;
+}
+
+static void bitmap_set_range(uint64_t* bitmap, size_t start, size_t end) {
+    while (start < end && (start & 63) != 0) {
+        bitmap[start >> 6] |= (uint64_t) 1 << (start & 63);
+        ++start;
+    }
+    for (; start + 64 <= end; start += 64) {
+        bitmap[start >> 6] = ~(uint64_t) 0;
+    }
+    for (; start < end; ++start) {
+        bitmap[start >> 6] |= (uint64_t) 1 << (start & 63);
+    }
+}
+
+/*
+    sets the rows whose packed value is from 'low' to 'high', 64 rows to a
+    bitmap word
+*/
+static void packed_match_range(Column* column, size_t num_rows, uint64_t low, uint64_t high, uint64_t* matches) {
+    for (size_t w = 0; w * 64 < num_rows; ++w) {
+        size_t num_bits = num_rows - w * 64 < 64 ? num_rows - w * 64 : 64;
+        uint64_t bits = 0;
+        for (size_t b = 0; b < num_bits; ++b) {
+            uint64_t value = packed_get(column->packed, column->width, w * 64 + b);
+            bits |= (uint64_t) (value - low <= high - low) << b;
+        }
+        matches[w] = bits;
+    }
+}
+
+/*
+    sets the rows whose value (by dictionary code, run or row for plain
+    columns) has its 'value_matches' entry set
+*/
+static void column_match_values(Column* column, size_t num_rows, char* value_matches, uint64_t* matches) {
+    if (column->encoding == COLUMN_DICTIONARY) {
+        for (size_t r = 0; r < num_rows; ++r) {
+            if (value_matches[packed_get(column->packed, column->width, r)]) {
+                matches[r >> 6] |= (uint64_t) 1 << (r & 63);
+            }
+        }
+    }
+    else if (column->encoding == COLUMN_RUN_LENGTH) {
+        size_t start = 0;
+        for (size_t i = 0; i < column->num_values; ++i) {
+            if (value_matches[i]) {
+                bitmap_set_range(matches, start, column->run_ends[i]);
+            }
+            start = column->run_ends[i];
+        }
+    }
+    else {
+        for (size_t r = 0; r < num_rows; ++r) {
+            if (value_matches[r]) {
+                matches[r >> 6] |= (uint64_t) 1 << (r & 63);
+            }
+        }
+    }
+}
+
+/*
+    leaves deleted rows out of a filter's matches and counts the rest
+*/
+static size_t finish_matches(ColumnStore* store, uint64_t* matches) {
+    size_t count = 0;
+    for (size_t w = 0; w < cs_bitmap_words(store); ++w) {
+        matches[w] &= ~store->deleted[w];
+        count += __builtin_popcountll(matches[w]);
+    }
+    return count;
+}
+
+/*
+    Sets the bits in 'matches' (cs_bitmap_words() words) of the rows whose
+    value in 'column' is 'value', clearing the rest. Returns the number of
+    rows matched.
+*/
+size_t cs_filter_equals(ColumnStore* store, size_t column_index, StringView value, uint64_t* matches) {
+    Column* column = &store->columns[column_index];
+    memset(matches, 0, cs_bitmap_words(store) * sizeof(uint64_t));
+
+    switch (column->encoding) {
+        case COLUMN_DICTIONARY: {
+            StringView key = column_code_key(value);
+            void* found = m_any_get(column->codes, key.ptr, key.len);
+            if (found != NULL) {
+                uint64_t code = (uintptr_t) found - 1;
+                packed_match_range(column, store->num_rows, code, code, matches);
+            }
+            break;
+        }
+
+        case COLUMN_RUN_LENGTH: {
+            size_t start = 0;
+            for (size_t i = 0; i < column->num_values; ++i) {
+                if (sv_equals(column_value(column, i), value)) {
+                    bitmap_set_range(matches, start, column->run_ends[i]);
+                }
+                start = column->run_ends[i];
+            }
+            break;
+        }
+
+        case COLUMN_FRAME_OF_REFERENCE: {
+            long number;
+            if (column_integer(value, &number) && number >= column->min && number <= column->max) {
+                uint64_t offset = (uint64_t) number - (uint64_t) column->min;
+                packed_match_range(column, store->num_rows, offset, offset, matches);
+            }
+            break;
+        }
+
+        default:
+            for (size_t r = 0; r < store->num_rows; ++r) {
+                if (sv_equals(column_value(column, r), value)) {
+                    matches[r >> 6] |= (uint64_t) 1 << (r & 63);
+                }
+            }
+    }
+
+    return finish_matches(store, matches);
+}
+
+/*
+    Sets the bits in 'matches' (cs_bitmap_words() words) of the rows whose
+    value in 'column' is an integer from 'min' to 'max', clearing the rest.
+    Returns the number of rows matched.
+*/
+size_t cs_filter_range(ColumnStore* store, size_t column_index, long min, long max, uint64_t* matches) {
+    Column* column = &store->columns[column_index];
+    memset(matches, 0, cs_bitmap_words(store) * sizeof(uint64_t));
+    if (min > max || store->num_rows == 0) {
+        return 0;
+    }
+
+    if (column->encoding == COLUMN_FRAME_OF_REFERENCE) {
+        if (max >= column->min && min <= column->max) {
+            uint64_t low = min > column->min ? (uint64_t) min - (uint64_t) column->min : 0;
+            uint64_t high = (uint64_t) (max < column->max ? max : column->max) - (uint64_t) column->min;
+            packed_match_range(column, store->num_rows, low, high, matches);
+        }
+        return finish_matches(store, matches);
+    }
+
+    // everything else parses each distinct value (or run, or row of a plain
+    // column) once
+    size_t num_values = column->encoding == COLUMN_PLAIN ? store->num_rows : column->num_values;
+    char* value_matches = malloc(num_values);
+    if (value_matches == NULL) {
+        columns_mem_error_exit_failing();
+    }
+    for (size_t i = 0; i < num_values; ++i) {
+        long number;
+        value_matches[i] = sv_to_long(column_value(column, i), &number) == 0 && number >= min && number <= max;
+    }
+    column_match_values(column, store->num_rows, value_matches, matches);
+    free(value_matches);
+
+    return finish_matches(store, matches);
+}
+
+
+
+// SNAPSHOTS
+
+/*
+    Writes 'bytes' bytes to a snapshot, padded to a multiple of 8 so what
+    follows stays aligned. Returns 0 if successful.
+*/
+int snapshot_write(FILE* file, void* data, size_t bytes) {
+    static const char padding[8] = {0};
+    size_t pad = (8 - bytes % 8) % 8;
+    return (bytes > 0 && fwrite(data, 1, bytes, file) != bytes) || fwrite(padding, 1, pad, file) != pad;
+}
+
+int snapshot_write_u64(FILE* file, uint64_t value) {
+    return snapshot_write(file, &value, sizeof(value));
+}
+
+/*
+    Takes the next 'bytes' bytes (and their padding) of a snapshot, or
+    returns NULL if it's too short.
+*/
+void* snapshot_read(char* data, size_t size, size_t* pos, size_t bytes) {
+    size_t padded = bytes + (8 - bytes % 8) % 8;
+    if (padded < bytes || *pos > size || padded > size - *pos) {
+        return NULL;
+    }
+    void* section = data + *pos;
+    *pos += padded;
+    return section;
+}
+
+int snapshot_read_u64(char* data, size_t size, size_t* pos, uint64_t* value) {
+    uint64_t* section = snapshot_read(data, size, pos, sizeof(uint64_t));
+    if (section == NULL) {
+        return 1;
+    }
+    *value = *section;
+    return 0;
+}
+
+/*
+    Writes the store to a snapshot file that cs_load() can read back.
+    Returns 0 if successful.
+*/
+int cs_save(ColumnStore* store, FILE* file) {
+    int error = snapshot_write_u64(file, store->num_columns)
+        || snapshot_write_u64(file, store->num_rows)
+        || snapshot_write(file, store->deleted, cs_bitmap_words(store) * sizeof(uint64_t));
+
+    for (size_t c = 0; c < store->num_columns && !error; ++c) {
+        Column* column = &store->columns[c];
+        size_t packed_words = (store->num_rows * column->width + 63) / 64;
+        error = snapshot_write_u64(file, column->encoding)
+            || snapshot_write_u64(file, column->width)
+            || snapshot_write_u64(file, column->min)
+            || snapshot_write_u64(file, column->max)
+            || snapshot_write_u64(file, column->len)
+            || snapshot_write_u64(file, column->num_values)
+            || snapshot_write_u64(file, packed_words)
+            || snapshot_write(file, column->data, column->len)
+            || snapshot_write(file, column->offsets, column->num_values * sizeof(size_t))
+            || (column->run_ends != NULL && snapshot_write(file, column->run_ends, column->num_values * sizeof(size_t)))
+            || snapshot_write(file, column->packed, packed_words * sizeof(uint64_t));
+    }
+
+    return error;
+}
+
+/*
+    Makes a store from a snapshot written by cs_save() at 'data' + '*pos',
+    moving '*pos' past it. The store's columns point into 'data', which has
+    to stay around (and be 8 byte aligned) for as long as the store does.
+    Returns NULL if the snapshot is cut short or isn't one.
+*/
+ColumnStore* cs_load(char* data, size_t size, size_t* pos) {
+    uint64_t num_columns;
+    uint64_t num_rows;
+    if (snapshot_read_u64(data, size, pos, &num_columns) || snapshot_read_u64(data, size, pos, &num_rows)
+        || num_columns > size || num_rows > size * 8) {
+        return NULL;
+    }
+    uint64_t* deleted = snapshot_read(data, size, pos, (num_rows + 63) / 64 * sizeof(uint64_t));
+    if (deleted == NULL) {
+        return NULL;
+    }
+
+    ColumnStore* store = new_column_store(0);
+    Column* columns = malloc((num_columns > 0 ? num_columns : 1) * sizeof(Column));
+    size_t rows_size = (num_rows / 64 + 1) * 64;
+    rows_size = rows_size > COLUMN_ROWS_SIZE ? rows_size : COLUMN_ROWS_SIZE;
+    uint64_t* store_deleted = calloc(rows_size / 64, sizeof(uint64_t));
+    if (columns == NULL || store_deleted == NULL) {
+        columns_mem_error_exit_failing();
+    }
+    memcpy(store_deleted, deleted, (num_rows + 63) / 64 * sizeof(uint64_t));
+    free(store->columns);
+    free(store->deleted);
+    store->columns = columns;
+    store->deleted = store_deleted;
+    store->rows_size = rows_size;
+    store->num_rows = num_rows;
+
+    for (size_t c = 0; c < num_columns; ++c) {
+        Column* column = &store->columns[c];
+        uint64_t encoding, width, min, max, len, num_values, packed_words;
+        int error = snapshot_read_u64(data, size, pos, &encoding)
+            || snapshot_read_u64(data, size, pos, &width)
+            || snapshot_read_u64(data, size, pos, &min)
+            || snapshot_read_u64(data, size, pos, &max)
+            || snapshot_read_u64(data, size, pos, &len)
+            || snapshot_read_u64(data, size, pos, &num_values)
+            || snapshot_read_u64(data, size, pos, &packed_words)
+            || encoding > COLUMN_FRAME_OF_REFERENCE || width > 64
+            || num_values > size || packed_words > size;
+
+        column->data = error ? NULL : snapshot_read(data, size, pos, len);
+        column->offsets = column->data == NULL ? NULL : snapshot_read(data, size, pos, num_values * sizeof(size_t));
+        column->run_ends = NULL;
+        if (column->offsets != NULL && encoding == COLUMN_RUN_LENGTH) {
+            column->run_ends = snapshot_read(data, size, pos, num_values * sizeof(size_t));
+        }
+        column->packed = column->offsets == NULL ? NULL : snapshot_read(data, size, pos, packed_words * sizeof(uint64_t));
+        column->codes = NULL;
+        column->mapped = 1;
+        store->num_columns = c + 1;
+        if (column->packed == NULL || (encoding == COLUMN_RUN_LENGTH && column->run_ends == NULL)
+            || (num_values > 0 && column->offsets[num_values - 1] >= len)
+            || (store->num_rows * width + 63) / 64 > packed_words) {
+            free_column_store(store);
+            return NULL;
+        }
+
+        column->encoding = encoding;
+        column->len = len;
+        column->size = len;
+        column->num_values = num_values;
+        column->values_size = num_values;
+        column->packed_size = packed_words;
+        column->width = width;
+        column->min = min;
+        column->max = max;
+
+        // dictionaries are looked up through a Map, so that's made again
+        if (encoding == COLUMN_DICTIONARY) {
+            column->codes = new_map();
+            m_reserve(column->codes, num_values);
+            for (size_t i = 0; i < num_values; ++i) {
+                StringView key = column_code_key(column_value(column, i));
+                m_any_put(column->codes, key.ptr, key.len, (void*) (uintptr_t) (i + 1), 0);
+            }
+        }
+    }
+
+    return store;
+}
+
+
+
+#endif
@@ -0,0 +1,556 @@
+#ifndef CSV
+#define CSV
+
+#include "String.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+
+/*
+    A csv tokenizer following RFC 4180: fields are separated by commas and
+    records by newlines ("\r\n" works too), and fields can be quoted to hold
+    commas, newlines and quotes (escaped by doubling them):
+    ```
+    user_123,"Smith, Bob","says ""hi""
+    over two lines"
+    ```
+
+    Fields and records are views into the data, nothing is copied while
+    scanning:
+    ```
+    CsvScanner scanner = csv_scan(sv_n(data, len));
+    StringView field;
+    int last;
+    while (csv_next_field(&scanner, &field, &last)) {
+        StringView value = csv_field_value(field, &scratch);
+        ...
+        if (last) {
+            // end of the record
+        }
+    }
+    ```
+    csv_field_value() takes the quotes off quoted fields, using 'scratch'
+    (a String) only when escaped quotes need collapsing. csv_next_record()
+    gets whole records instead of fields.
+
+    append_csv_field() and append_csv_row() go the other way, quoting
+    values that need it.
+
+    For files too big to map or read in at once, CsvReader reads them a row
+    at a time through a fixed size buffer (see new_csv_reader()).
+
+
+
+    # DESIGN
+
+    Like simdjson, the scanner doesn't look at the data a byte at a time.
+    For each 64 byte block it builds bitmasks of where the quotes, commas and
+    newlines are (with AVX2 or SSE2 compares when the compiler targets them).
+    Which bytes are inside quotes is the prefix xor of the quote mask (each
+    quote flips in and out, so escaped "" quotes flip out and straight back
+    in), carried over from block to block. Commas and newlines outside of
+    quotes are the field and record boundaries, found by counting trailing
+    zeros in what's left of the mask.
+
+*/
+typedef struct CsvScanner {
+
+    char* data;
+    size_t len;
+
+    size_t pos; // start of the next field
+    int at_record_start;
+
+    // field and record boundaries left in the current 64 byte block
+    size_t block;
+    size_t next_block;
+    uint64_t structurals;
+
+    // all ones if the data scanned so far ends inside quotes (can be set
+    // before scanning to start inside a quoted field)
+    uint64_t in_quotes;
+
+} CsvScanner;
+
+
+#define CSV_BLOCK_SIZE 64
+
+
+
+/*
+    bit i set if byte i of the 64 byte block at 'p' is 'c'
+*/
+static inline uint64_t csv_match(char* p, char c) {
+#if defined(__AVX2__)
+    __m256i target = _mm256_set1_epi8(c);
+    uint64_t low = (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((__m256i*) p), target));
+    uint64_t high = (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((__m256i*) (p + 32)), target));
+    return low | (high << 32);
+#elif defined(__SSE2__)
+    __m128i target = _mm_set1_epi8(c);
+    uint64_t mask = 0;
+    for (int i = 0; i < 4; ++i) {
+        __m128i block = _mm_loadu_si128((__m128i*) (p + 16 * i));
+        mask |= (uint64_t) (uint16_t) _mm_movemask_epi8(_mm_cmpeq_epi8(block, target)) << (16 * i);
+    }
+    return mask;
+#else
+    uint64_t mask = 0;
+    for (int i = 0; i < CSV_BLOCK_SIZE; ++i) {
+        mask |= (uint64_t) (p[i] == c) << i;
+    }
+    return mask;
+#endif
+}
+
+/*
+    bit i set if an odd number of bits up to and including bit i are set
+*/
+static inline uint64_t csv_prefix_xor(uint64_t bits) {
+    bits ^= bits << 1;
+    bits ^= bits << 2;
+    bits ^= bits << 4;
+    bits ^= bits << 8;
+    bits ^= bits << 16;
+    bits ^= bits << 32;
+    return bits;
+}
+
+/*
+    finds the field and record boundaries in the block at 'p' ('len' bytes
+    left in the data), updating whether the scan is inside quotes
+*/
+static uint64_t csv_block_structurals(CsvScanner* scanner, char* p, size_t len) {
+    char padded[CSV_BLOCK_SIZE];
+    if (len < CSV_BLOCK_SIZE) {
+        memset(padded, 0, CSV_BLOCK_SIZE);
+        memcpy(padded, p, len);
+        p = padded;
+    }
+
+    uint64_t quotes = csv_match(p, '"');
+    uint64_t separators = csv_match(p, ',') | csv_match(p, '\n');
+
+    uint64_t in_quotes = csv_prefix_xor(quotes) ^ scanner->in_quotes;
+    scanner->in_quotes = (uint64_t) ((int64_t) in_quotes >> 63);
+
+    return separators & ~in_quotes;
+}
+
+/*
+    returns the position of the next comma or newline outside of quotes,
+    or -1 if there aren't any more
+*/
+static long csv_next_structural(CsvScanner* scanner) {
+    while (scanner->structurals == 0) {
+        if (scanner->next_block >= scanner->len) {
+            return -1;
+        }
+        scanner->block = scanner->next_block;
+        scanner->structurals = csv_block_structurals(scanner, scanner->data + scanner->block, scanner->len - scanner->block);
+        scanner->next_block += CSV_BLOCK_SIZE;
+    }
+
+    long pos = scanner->block + __builtin_ctzll(scanner->structurals);
+    scanner->structurals &= scanner->structurals - 1;
+    return pos;
+}
+
+
+
+/*
+    Starts scanning csv data.
+*/
+CsvScanner csv_scan(StringView data) {
+    CsvScanner scanner = {data.ptr, data.len, 0, 1, 0, 0, 0, 0};
+    return scanner;
+}
+
+/*
+    Gets the next field (with any quotes still on, see csv_field_value()),
+    setting 'last' to 1 if it's the last field in its record. Returns 0 once
+    the data has been scanned.
+*/
+int csv_next_field(CsvScanner* scanner, StringView* field, int* last) {
+    if (scanner->pos > scanner->len || (scanner->pos == scanner->len && scanner->at_record_start)) {
+        return 0;
+    }
+
+    long end = csv_next_structural(scanner);
+    if (end < 0) {
+        end = scanner->len;
+        *last = 1;
+    }
+    else {
+        *last = scanner->data[end] == '\n';
+    }
+
+    field->ptr = scanner->data + scanner->pos;
+    field->len = end - scanner->pos;
+    if (*last && field->len > 0 && field->ptr[field->len - 1] == '\r') {
+        --field->len;
+    }
+
+    scanner->pos = end + 1;
+    scanner->at_record_start = *last;
+
+    return 1;
+}
+
+/*
+    Gets the next whole record (without its line ending), which can span
+    lines if it has quoted fields. Blank lines are empty records. Returns 0
+    once the data has been scanned.
+*/
+int csv_next_record(CsvScanner* scanner, StringView* record) {
+    if (scanner->pos > scanner->len || (scanner->pos == scanner->len && scanner->at_record_start)) {
+        return 0;
+    }
+
+    long end;
+    while ((end = csv_next_structural(scanner)) >= 0 && scanner->data[end] != '\n') {}
+    if (end < 0) {
+        end = scanner->len;
+    }
+
+    record->ptr = scanner->data + scanner->pos;
+    record->len = end - scanner->pos;
+    if (record->len > 0 && record->ptr[record->len - 1] == '\r') {
+        --record->len;
+    }
+
+    scanner->pos = end + 1;
+    scanner->at_record_start = 1;
+
+    return 1;
+}
+
+/*
+    Returns the number of quotes in the view, to work out whether a point
+    in csv data is inside quotes (an odd number of quotes before it).
+*/
+size_t csv_count_quotes(StringView view) {
+    size_t count = 0;
+    size_t i = 0;
+    for (; i + CSV_BLOCK_SIZE <= view.len; i += CSV_BLOCK_SIZE) {
+        count += __builtin_popcountll(csv_match(view.ptr + i, '"'));
+    }
+    for (; i < view.len; ++i) {
+        count += view.ptr[i] == '"';
+    }
+    return count;
+}
+
+/*
+    appends a quoted field's insides with escaped quotes collapsed, 'quote'
+    being the position of the first quote
+*/
+static void csv_collapse_quotes(StringView inner, long quote, String* out) {
+    while (quote >= 0) {
+        append_n(out, inner.ptr, quote + 1);
+        size_t skip = quote + 1;
+        if (skip < inner.len && inner.ptr[skip] == '"') {
+            ++skip;
+        }
+        inner = sv_slice(inner, skip, inner.len);
+        quote = sv_find_c(inner, '"');
+    }
+    append_n(out, inner.ptr, inner.len);
+}
+
+/*
+    Gets a field's value. Unquoted fields are returned as they are, quoted
+    ones without their quotes, pointing into the field unless escaped quotes
+    ("") need collapsing, in which case the value is put in 'scratch'
+    (overwriting what was there).
+*/
+StringView csv_field_value(StringView field, String* scratch) {
+    if (field.len == 0 || field.ptr[0] != '"') {
+        return field;
+    }
+
+    StringView inner = sv_n(field.ptr + 1, field.len - 1);
+    if (inner.len > 0 && inner.ptr[inner.len - 1] == '"') {
+        --inner.len;
+    }
+    long quote = sv_find_c(inner, '"');
+    if (quote < 0) {
+        return inner;
+    }
+
+    clear_string(scratch);
+    csv_collapse_quotes(inner, quote, scratch);
+
+    return string_view(scratch, 0, scratch->len);
+}
+
+
+
+/*
+    returns 1 if a value has to be quoted to be written as a csv field
+*/
+static int csv_needs_quotes(char* value, size_t len) {
+    for (size_t i = 0; i < len; ++i) {
+        char c = value[i];
+        if (c == ',' || c == '"' || c == '\n' || c == '\r') {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+    Appends a value as a csv field, quoting it if it has commas, quotes or
+    line breaks in it.
+
+    returns 0 if successful
+*/
+int append_csv_field(String* stream, char* value) {
+    size_t len = strlen(value);
+    if (!csv_needs_quotes(value, len)) {
+        return append_n(stream, value, len);
+    }
+
+    int failed = append_c(stream, '"');
+    StringView rest = sv_n(value, len);
+    long quote;
+    while (!failed && (quote = sv_find_c(rest, '"')) >= 0) {
+        failed = append_n(stream, rest.ptr, quote + 1) || append_c(stream, '"');
+        rest = sv_slice(rest, quote + 1, rest.len);
+    }
+    return failed || append_n(stream, rest.ptr, rest.len) || append_c(stream, '"');
+}
+
+/*
+    Appends values as a csv record (without a line ending), quoting the
+    ones that need it.
+
+    returns 0 if successful
+*/
+int append_csv_row(String* stream, char** cells, size_t num_cells) {
+    int plain = 1;
+    for (size_t i = 0; i < num_cells && plain; ++i) {
+        plain = !csv_needs_quotes(cells[i], strlen(cells[i]));
+    }
+    if (plain) {
+        return append_join(stream, cells, num_cells, ",");
+    }
+
+    for (size_t i = 0; i < num_cells; ++i) {
+        if ((i > 0 && append_c(stream, ',')) || append_csv_field(stream, cells[i])) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+
+
+/*
+    Reads a csv file a row at a time through a fixed size buffer, so files
+    of any size can be gone through with constant memory:
+    ```
+    CsvReader* reader = new_csv_reader("users.csv");
+    while (csv_read_row(reader)) {
+        StringView key = reader->fields[0];
+        ...
+    }
+    free_csv_reader(reader);
+    ```
+
+    The fields are views of the values (quotes taken off) and 'record' is
+    the whole row as it is in the file, both valid until the next call to
+    csv_read_row(). Blank lines are skipped.
+
+    The buffer only grows if a single record doesn't fit in it.
+*/
+typedef struct CsvReader {
+
+    int fd;
+    char* buffer;
+    size_t buffer_size;
+    size_t len; // bytes in the buffer
+    int eof;
+    int error; // 1 if reading the file failed
+
+    CsvScanner scanner; // over the bytes in the buffer
+
+    // the current row
+    StringView record;
+    StringView* fields;
+    size_t num_fields;
+    size_t fields_size;
+
+    String values; // values that had escaped quotes collapsed
+
+} CsvReader;
+
+
+const size_t CSV_READER_BUFFER_SIZE = 65536;
+
+
+
+static void reader_mem_error_exit_failing() {
+    fprintf(stderr, "CsvReader couldn't get more memory on the system! Exiting...");
+    exit(EXIT_FAILURE);
+}
+
+/*
+    Opens a csv file for reading through a buffer of 'buffer_size' bytes.
+    Returns NULL if the file can't be opened.
+*/
+CsvReader* new_csv_reader_s(char* path, size_t buffer_size) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    CsvReader* reader = malloc(sizeof(CsvReader));
+    if (reader == NULL) {
+        reader_mem_error_exit_failing();
+    }
+    reader->fd = fd;
+    reader->buffer_size = buffer_size > CSV_BLOCK_SIZE ? buffer_size : CSV_BLOCK_SIZE;
+    reader->buffer = malloc(reader->buffer_size);
+    reader->fields_size = 16;
+    reader->fields = malloc(reader->fields_size * sizeof(StringView));
+    if (reader->buffer == NULL || reader->fields == NULL) {
+        reader_mem_error_exit_failing();
+    }
+    reader->len = 0;
+    reader->eof = 0;
+    reader->error = 0;
+    reader->scanner = csv_scan(sv_n(reader->buffer, 0));
+    reader->record = sv_n(reader->buffer, 0);
+    reader->num_fields = 0;
+    init_string(&reader->values);
+
+    return reader;
+}
+
+CsvReader* new_csv_reader(char* path) {
+    return new_csv_reader_s(path, CSV_READER_BUFFER_SIZE);
+}
+
+void free_csv_reader(CsvReader* reader) {
+    close(reader->fd);
+    free(reader->buffer);
+    free(reader->fields);
+    free_string_buffer(&reader->values);
+    free(reader);
+}
+
+/*
+    moves the unread bytes from 'keep_from' on to the front of the buffer
+    (growing it if they fill it) and reads in more after them
+*/
+static void csv_reader_refill(CsvReader* reader, size_t keep_from) {
+    size_t keep = reader->len - keep_from;
+    if (keep == reader->buffer_size) {
+        size_t new_size = reader->buffer_size * 2;
+        char* new_buffer = realloc(reader->buffer, new_size);
+        if (new_buffer == NULL) {
+            reader_mem_error_exit_failing();
+        }
+        reader->buffer = new_buffer;
+        reader->buffer_size = new_size;
+    }
+    else {
+        memmove(reader->buffer, reader->buffer + keep_from, keep);
+    }
+    reader->len = keep;
+
+    while (!reader->eof && reader->len < reader->buffer_size) {
+        ssize_t bytes_read = read(reader->fd, reader->buffer + reader->len, reader->buffer_size - reader->len);
+        if (bytes_read <= 0) {
+            reader->eof = 1;
+            reader->error = bytes_read < 0;
+        }
+        else {
+            reader->len += bytes_read;
+        }
+    }
+
+    reader->scanner = csv_scan(sv_n(reader->buffer, reader->len));
+}
+
+/*
+    Reads the next row into 'fields' and 'record'. Returns 0 once the whole
+    file has been read (or reading it failed, see 'error').
+*/
+int csv_read_row(CsvReader* reader) {
+    while (1) {
+        CsvScanner* scanner = &reader->scanner;
+        size_t start = scanner->pos < scanner->len ? scanner->pos : scanner->len;
+        reader->num_fields = 0;
+
+        // collect the record's raw fields, starting over with more of the
+        // file if it runs past what's in the buffer
+        StringView field;
+        int last = 0;
+        int found = 0;
+        while (csv_next_field(scanner, &field, &last)) {
+            found = 1;
+            if (reader->num_fields == reader->fields_size) {
+                reader->fields_size *= 2;
+                reader->fields = realloc(reader->fields, reader->fields_size * sizeof(StringView));
+                if (reader->fields == NULL) {
+                    reader_mem_error_exit_failing();
+                }
+            }
+            reader->fields[reader->num_fields++] = field;
+            if (last) {
+                break;
+            }
+        }
+        int cut_off = !found || scanner->pos > scanner->len;
+        if (cut_off && !reader->eof) {
+            csv_reader_refill(reader, start);
+            continue;
+        }
+        if (!found) {
+            return 0;
+        }
+        if (reader->num_fields == 1 && reader->fields[0].len == 0) {
+            continue; // blank line
+        }
+
+        StringView last_field = reader->fields[reader->num_fields - 1];
+        reader->record = sv_n(reader->buffer + start, last_field.ptr + last_field.len - (reader->buffer + start));
+
+        // take the quotes off, collapsing escaped quotes into 'values'
+        // (reserved up front so the views into it stay put)
+        clear_string(&reader->values);
+        if (reserve_string(&reader->values, reader->record.len) != 0) {
+            reader_mem_error_exit_failing();
+        }
+        for (size_t f = 0; f < reader->num_fields; ++f) {
+            StringView raw = reader->fields[f];
+            if (raw.len == 0 || raw.ptr[0] != '"') {
+                continue;
+            }
+            StringView inner = sv_n(raw.ptr + 1, raw.len - 1);
+            if (inner.len > 0 && inner.ptr[inner.len - 1] == '"') {
+                --inner.len;
+            }
+            long quote = sv_find_c(inner, '"');
+            if (quote >= 0) {
+                size_t value_start = reader->values.len;
+                csv_collapse_quotes(inner, quote, &reader->values);
+                inner = sv_n(str(&reader->values) + value_start, reader->values.len - value_start);
+            }
+            reader->fields[f] = inner;
+        }
+
+        return 1;
+    }
+}
+
+
+
+#endif
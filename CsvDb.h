@@ -5,6 +5,10 @@
 #include "Set.h"
 #include "List.h"
 #include "String.h"
+#include "StringPool.h"
+#include "Rope.h"
+#include "Csv.h"
+#include "Columns.h"
 
 #include <sys/time.h>
 #include <stdio.h>
@@ -12,6 +16,10 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <stdint.h>
 
 
 
@@ -19,32 +27,139 @@ const size_t BYTES_IN_GIGABYTE = 1073741824;
 const char* TMP_DIRECTORY = "CSV_DB_TEMP_FILES";
 const size_t WRITE_FREQUENCY_MS = 500;
 
+// how much of a mapped csv is parsed before its pages are let go
+const size_t CSV_RELEASE_BYTES = 8388608;
+
+// load_csv_parallel() gives each thread at least this much of the file
+const size_t CSV_PARALLEL_MIN_BYTES = 1048576;
+
+// roughly what a Map entry costs besides its key (the Element and its slot)
+const size_t MAP_ENTRY_BYTES = 48;
+
+// how many selects an evicted index answers by scanning before it's rebuilt
+// (see table_select_keys()), so a column selected once doesn't push out
+// indexes in steady use
+const size_t INDEX_REBUILD_SCANS = 4;
+
+const char* SNAPSHOT_MAGIC = "CSVDBSN2";
+
+// how much of the start and end of a csv a snapshot checksums
+const size_t SNAPSHOT_CHECK_BYTES = 65536;
+
+// the bits of a snapshot's key slots holding the row id + 1
+const uint64_t SNAPSHOT_ROW_MASK = ((uint64_t) 1 << 40) - 1;
+
+const char* ROW_OFFSETS_MAGIC = "CSVDBOF1";
+
+// the bits of a row offsets slot holding the record's offset + 1 (so csvs
+// up to a terabyte)
+const uint64_t ROW_OFFSET_MASK = ((uint64_t) 1 << 40) - 1;
+
 typedef struct Row {
     
     char* key;
     List* cells;
 
+    // the table's column pools if some cells are interned strings owned by
+    // them (see Table.column_pools), or NULL if the row owns every cell
+    List* column_pools;
+
+    // the arena holding the row and its cells, or NULL if they're on the heap
+    Arena* arena;
+
 } Row;
 
 
+/*
+    A secondary index on one column of a table (see index_column())
+*/
 typedef struct Index {
     
-    char* key;
+    // the column's position in the table
+    size_t column;
+
+    // the column's values to Lists of the primary keys (new strings) of
+    // the rows with that value. Lists rather than Maps, as most values
+    // have only a few rows and a Map costs a kilobyte however small
+    Map* values_to_keys;
+
+    // primary keys to their position in their value's List, so a row is
+    // removed without searching the List
+    Map* keys_to_positions;
+
+    // both maps are NULL while the index is evicted (see
+    // enforce_memory_threshold()), until enough selects rebuild it
+    size_t bytes;
+    size_t scans;
+
     size_t last_accessed_ms;
 
 } Index;
 
+/*
+    A whole file's contents, memory mapped if possible (see map_file())
+*/
+typedef struct MappedFile {
+
+    char* data;
+    size_t size;
+
+    // 1 if 'data' is mapped, 0 if it was read into a malloc'd buffer
+    int mapped;
+
+} MappedFile;
+
 typedef struct Table {
     
-    // primary keys to rows
+    // primary keys to rows (or to row ids in 'column_store' for columnar
+    // tables, see table_row_id())
     Map* keys_to_rows;
 
-    // basically indicies
+    // indexed column names to their Index
     Map* column_values_to_indices;
 
     List* columns;
     Map* columns_to_is_indexed;
 
+    // one StringPool per column (NULL for the primary key column) that cell
+    // values are interned in, so repeated values are stored once
+    List* column_pools;
+
+    // the table's cells stored by column rather than by row, or NULL if the
+    // table holds Rows (see load_csv_columnar())
+    ColumnStore* column_store;
+
+    // the snapshot a columnar table was loaded from (see load_snapshot()),
+    // which 'column_store' points into, and its hash table of primary keys
+    // to row ids. 'keys_to_rows' then only holds keys changed since.
+    MappedFile snapshot;
+    uint64_t* snapshot_keys;
+    size_t snapshot_keys_size;
+
+    // 1 while what's on disk (the csv, and the snapshot of a columnar
+    // table) holds everything in memory, so the table's cells can be let
+    // go of and read from disk instead
+    int saved;
+
+    // a row table whose Rows were let go of (see unload_rows()) looks rows
+    // up in the sidecar of its csv's record offsets, and reads them from
+    // the csv, which is kept open. 'cold_row' is the last row read, which
+    // cells from table_get() point into. Rows changed since are kept in
+    // 'keys_to_rows' over the csv's, and deleted keys in
+    // 'cold_deleted_keys', until the csv is written.
+    MappedFile row_offsets;
+    uint64_t* row_offset_slots;
+    size_t row_offset_slots_size;
+    size_t cold_len;
+    int csv_fd;
+    Row* cold_row;
+    Map* cold_deleted_keys;
+
+    // roughly what each Row of a row table costs, measured when it's loaded
+    size_t row_bytes;
+
+    size_t last_accessed_ms;
+
     char* csv_path;
 
 } Table;
@@ -54,6 +169,11 @@ typedef struct CsvDb {
     Map* table_name_to_table;
     size_t last_write_ms;
 
+    // roughly how many bytes the tables and their indexes can take up
+    // before the least recently used are let go (see
+    // enforce_memory_threshold()). Unlimited by default.
+    size_t memory_threshold;
+
     Map* transaction_file_locks;
 
 } CsvDb;
@@ -75,6 +195,21 @@ Table* new_table(char* path) {
     table->column_values_to_indices = new_map();
     table->columns = new_list();
     table->columns_to_is_indexed = new_map();
+    table->column_pools = new_list();
+    table->column_store = NULL;
+    table->snapshot = (MappedFile) {NULL, 0, 0};
+    table->snapshot_keys = NULL;
+    table->snapshot_keys_size = 0;
+    table->saved = 0;
+    table->row_offsets = (MappedFile) {NULL, 0, 0};
+    table->row_offset_slots = NULL;
+    table->row_offset_slots_size = 0;
+    table->cold_len = 0;
+    table->csv_fd = -1;
+    table->cold_row = NULL;
+    table->cold_deleted_keys = new_map();
+    table->row_bytes = 0;
+    table->last_accessed_ms = current_time_ms();
     table->csv_path = strdup(path);
 
     return table;
@@ -115,7 +250,7 @@ String** read_lines(char* path, size_t* num_lines) {
             return NULL;
         }
 
-        append(ss, buffer);
+        append_n(ss, buffer, bytesRead);
     }
     free(buffer);
 
@@ -129,25 +264,124 @@ String** read_lines(char* path, size_t* num_lines) {
     return lines;
 }
 
+/*
+    Reads the next line of a file (without its '\n'), returning NULL at the
+    end of the file or on an empty line. Lines are read a buffer at a time
+    with getline(), not character by character. For csv data use a
+    CsvReader instead, which handles quoted line breaks.
+*/
 String* read_line(FILE* file) {
 
-    String* ss = new_string();
-    char ch;
-    while ((ch = fgetc(file)) != EOF) {
-        if (ch == '\n') {
-            break;
-        }
-        append_c(ss, ch);
+    char* buffer = NULL;
+    size_t buffer_size = 0;
+    ssize_t len = getline(&buffer, &buffer_size, file);
+    if (len > 0 && buffer[len - 1] == '\n') {
+        --len;
     }
-
-    if (ss->len == 0) {
-        free_string(ss);
+    if (len <= 0) {
+        free(buffer);
         return NULL;
     }
 
+    String* ss = new_string_s(len + 1);
+    append_n(ss, buffer, len);
+    free(buffer);
+
     return ss;
 }
 
+/*
+    Maps the file at 'path' into memory read only so it can be scanned in
+    place, without copying it into a buffer first. Files that can't be
+    mapped (pipes, some special files) are read into a malloc'd buffer
+    instead. Empty files give NULL data with a size of 0.
+
+    Clean up with unmap_file().
+
+    returns 0 if successful
+*/
+int map_file(char* path, MappedFile* file) {
+    file->data = NULL;
+    file->size = 0;
+    file->mapped = 0;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return 1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        if (st.st_size == 0) {
+            close(fd);
+            return 0;
+        }
+        void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            madvise(data, st.st_size, MADV_SEQUENTIAL);
+            close(fd);
+            file->data = data;
+            file->size = st.st_size;
+            file->mapped = 1;
+            return 0;
+        }
+    }
+
+    // fall back to reading the whole thing
+    size_t buffer_size = 65536;
+    char* buffer = malloc(buffer_size);
+    size_t size = 0;
+    ssize_t bytes_read;
+    while (buffer != NULL && (bytes_read = read(fd, buffer + size, buffer_size - size)) > 0) {
+        size += bytes_read;
+        if (size == buffer_size) {
+            buffer_size *= 2;
+            char* bigger = realloc(buffer, buffer_size);
+            if (bigger == NULL) {
+                free(buffer);
+            }
+            buffer = bigger;
+        }
+    }
+    close(fd);
+    if (buffer == NULL || bytes_read < 0) {
+        free(buffer);
+        return 1;
+    }
+
+    file->data = buffer;
+    file->size = size;
+    return 0;
+}
+
+/*
+    Lets the system drop the pages of a mapped file before 'offset' from
+    memory, for files scanned once from front to back. They're read back
+    in from the file if used again. Does nothing for files that were read
+    into a buffer.
+*/
+void release_mapped_file(MappedFile* file, size_t offset) {
+    if (!file->mapped) {
+        return;
+    }
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    size_t len = offset - offset % page_size;
+    if (len > 0) {
+        madvise(file->data, len, MADV_DONTNEED);
+    }
+}
+
+void unmap_file(MappedFile* file) {
+    if (file->mapped) {
+        munmap(file->data, file->size);
+    }
+    else {
+        free(file->data);
+    }
+    file->data = NULL;
+    file->size = 0;
+}
+
 int write_lines(char* path, List* lines_or_char_stars) {
 
     FILE *file = fopen(path, "w");  // Open in append mode
@@ -192,258 +426,1849 @@ int write_to_file(char* path, char* str) {
 
     fclose(file);
 
-    return 0;
+    return 0;
+}
+
+String* convert_rows_to_csv_text(List* rows) {
+    String* ss = new_string();
+    for (int i = 0; i < rows->len; ++i) {
+
+        List* row = (List*) l_get(rows, i);
+        l_linearize(row);
+        append_csv_row(ss, (char**) row->data, row->len);
+        append_c(ss, '\n');
+    }
+
+    return ss;
+}
+
+/*
+    Returns the pool owning the given column's interned values, or NULL
+    if the column's values aren't interned.
+*/
+static StringPool* column_pool(List* column_pools, size_t column) {
+    if (column_pools == NULL || column >= column_pools->len) {
+        return NULL;
+    }
+    return (StringPool*) l_get_unchecked(column_pools, column);
+}
+
+/*
+    Copies a cell value for a row, interning it if the column has a pool
+    or copying it into 'arena' if one is given
+*/
+static char* copy_cell(List* column_pools, size_t column, StringView value, Arena* arena) {
+    StringPool* pool = column_pool(column_pools, column);
+    if (pool != NULL) {
+        return sp_intern_view(pool, value);
+    }
+    if (arena != NULL) {
+        return arena_strndup(arena, value.ptr, value.len);
+    }
+    return sv_to_str(value);
+}
+
+/*
+    makes an empty row in 'arena' (or on the heap if it's NULL), returning
+    NULL if the arena runs out of memory
+*/
+static Row* new_row_in(Arena* arena, List* column_pools) {
+    Row* row = a_pool_alloc(arena, sizeof(Row));
+    List* cells = arena != NULL ? new_list_in(arena) : new_list();
+    if (row == NULL || cells == NULL) {
+        return NULL;
+    }
+    row->key = NULL;
+    row->cells = cells;
+    row->column_pools = column_pools;
+    row->arena = arena;
+
+    return row;
+}
+
+/*
+    adds a csv field to the end of a row, taking off any quotes
+    returns 0 if successful
+*/
+static int add_cell(Row* row, StringView field, String* scratch) {
+    StringView value = csv_field_value(field, scratch);
+    char* cell_cpy = copy_cell(row->column_pools, row->cells->len, value, row->arena);
+    if (cell_cpy == NULL || l_push(row->cells, cell_cpy) != 0) {
+        return 1;
+    }
+    if (row->cells->len == 1) {
+        row->key = cell_cpy;
+    }
+    return 0;
+}
+
+/*
+    Makes a row from a csv record with the row and its cells allocated in
+    'arena' (or on the heap if it's NULL). If 'column_pools' is given,
+    values in columns with a pool are interned instead of copied. Quoted
+    fields are handled as in Csv.h.
+
+    Returns NULL if the arena runs out of memory.
+*/
+Row* parse_row_in(Arena* arena, StringView line, List* column_pools) {
+
+    Row* row = new_row_in(arena, column_pools);
+    if (row == NULL) {
+        return NULL;
+    }
+
+    String scratch;
+    init_string(&scratch);
+    CsvScanner scanner = csv_scan(line);
+    StringView field;
+    int last;
+    int failed = 0;
+    while (!failed && csv_next_field(&scanner, &field, &last)) {
+        failed = add_cell(row, field, &scratch);
+    }
+    if (line.len == 0) {
+        failed = add_cell(row, line, &scratch); // one empty cell
+    }
+    free_string_buffer(&scratch);
+
+    return failed ? NULL : row;
+}
+
+/*
+    Makes a row from a csv line. If 'column_pools' is given, values in
+    columns with a pool are interned instead of copied.
+*/
+Row* parse_row_view(StringView line, List* column_pools) {
+    return parse_row_in(NULL, line, column_pools);
+}
+
+Row* parse_row(String* str) {
+    return parse_row_view(string_view(str, 0, str->len), NULL);
+}
+
+String* row_to_str(Row* row) {
+    String* str = new_string();
+    l_linearize(row->cells);
+    append_csv_row(str, (char**) row->cells->data, row->cells->len);
+
+    return str;
+}
+
+void free_row(Row* row) {
+    if (row->arena != NULL) {
+        return; // freed with the arena
+    }
+    while (row->cells->len > 0) {
+        char* cell = l_pop(row->cells);
+        if (column_pool(row->column_pools, row->cells->len) == NULL) {
+            free(cell);
+        }
+    }
+    // free(row->key); row->key is also a cell and is freed in the loop 
+    free_list(row->cells, 0);
+    pool_free(row, sizeof(Row));
+}
+
+int compare_file_names(const void* a, const void* b) {
+    const char* a_str = *(const char**)a;
+    const char* b_str = *(const char**)b;
+    return strcmp(a_str, b_str);
+}
+
+
+
+// USER FUNCTIONS
+
+/*
+    empties a row table's column pools once no Rows are left using them
+*/
+static void reset_column_pools(Table* table) {
+    for (int c = 0; c < table->column_pools->len; ++c) {
+        StringPool* pool = l_get(table->column_pools, c);
+        if (pool != NULL) {
+            free_string_pool(pool);
+            l_set(table->column_pools, c, new_string_pool());
+        }
+    }
+}
+
+/*
+    stops reading a row table's rows from its csv (see unload_rows()),
+    dropping the changes kept over it, which the csv has by then or which
+    are read back in with it
+*/
+static void close_row_offsets(Table* table) {
+    if (table->row_offset_slots != NULL) {
+        Element** rows = map_elements(table->keys_to_rows);
+        for (int r = 0; r < table->keys_to_rows->len; ++r) {
+            free_row((Row*) rows[r]->data);
+        }
+        free(rows);
+        free_map(table->keys_to_rows, 0);
+        table->keys_to_rows = new_map();
+        free_map(table->cold_deleted_keys, 0);
+        table->cold_deleted_keys = new_map();
+        reset_column_pools(table);
+    }
+    unmap_file(&table->row_offsets);
+    if (table->csv_fd >= 0) {
+        close(table->csv_fd);
+    }
+    if (table->cold_row != NULL) {
+        free_row(table->cold_row);
+    }
+    table->row_offset_slots = NULL;
+    table->row_offset_slots_size = 0;
+    table->cold_len = 0;
+    table->csv_fd = -1;
+    table->cold_row = NULL;
+}
+
+/*
+    frees an index's maps, leaving it to be rebuilt (see build_index())
+*/
+static void evict_index(Index* index) {
+    if (index->values_to_keys != NULL) {
+        Element** values = map_elements(index->values_to_keys);
+        for (int v = 0; v < index->values_to_keys->len; ++v) {
+            free_list((List*) values[v]->data, 1);
+        }
+        free(values);
+        free_map(index->values_to_keys, 0);
+        free_map(index->keys_to_positions, 0);
+    }
+    index->values_to_keys = NULL;
+    index->keys_to_positions = NULL;
+    index->bytes = 0;
+    index->scans = 0;
+}
+
+void free_table(Table* table) {
+
+    // free rows
+    if (table->column_store != NULL) {
+        free_column_store(table->column_store);
+        unmap_file(&table->snapshot);
+    }
+    else {
+        close_row_offsets(table);
+        Element** rows = map_elements(table->keys_to_rows);
+        for (int r = 0; r < table->keys_to_rows->len; ++r) {
+            Element* row_ele = rows[r];
+            Row* row = (Row*) m_get(table->keys_to_rows, row_ele->key);
+            free_row(row);
+        }
+        free(rows);
+    }
+    free_map(table->keys_to_rows, 0);
+    free_map(table->cold_deleted_keys, 0);
+
+
+    // free indices
+    Element** indices = map_elements(table->column_values_to_indices);
+    for (int i = 0; i < table->column_values_to_indices->len; ++i) {
+        Element* index_ele = indices[i];
+        Index* index = m_get(table->column_values_to_indices, index_ele->key);
+        evict_index(index);
+        free(index);
+    }
+    free(indices);
+    free_map(table->column_values_to_indices, 0);
+
+
+    // free columns
+    while (table->columns->len > 0) {
+        char* column = l_pop(table->columns);
+        free(column);
+    }
+    free_list(table->columns, 0);
+
+
+    // free columns_to_is_indexed
+    Element** columns = map_elements(table->columns_to_is_indexed);
+    for (int i = 0; i < table->columns_to_is_indexed->len; ++i) {
+        Element* ele = columns[i];
+        int* indexed = m_get(table->columns_to_is_indexed, ele->key);
+        free(indexed);
+    }
+    free(columns);
+    free_map(table->columns_to_is_indexed, 0);
+
+
+    // free column pools (after the rows using them)
+    while (table->column_pools->len > 0) {
+        StringPool* pool = l_pop(table->column_pools);
+        if (pool != NULL) {
+            free_string_pool(pool);
+        }
+    }
+    free_list(table->column_pools, 0);
+
+
+    // free table path
+    free(table->csv_path);
+
+
+    // free the table itself
+    free(table);
+}
+
+void free_database(CsvDb* db) {
+
+    Element** tables = map_elements(db->table_name_to_table);
+    for(int t = 0; t < db->table_name_to_table->len; ++t) {
+        Element* ele = tables[t];
+        Table* table = (Table*) m_erase(db->table_name_to_table, ele->key);
+        free_table(table);
+    }
+    free(tables);
+    free_map(db->table_name_to_table, 0);
+
+
+    Element** locks = map_elements(db->transaction_file_locks);
+    for(int l = 0; l < db->transaction_file_locks->len; ++l) {
+        free(locks[l]->data);
+    }
+    free(locks);
+    free_map(db->transaction_file_locks, 0);
+
+
+    free(db);
+}
+
+CsvDb* new_database() {
+    CsvDb* db = malloc(sizeof(CsvDb));
+    db->table_name_to_table = new_map();
+    db->transaction_file_locks = new_map();
+    db->memory_threshold = SIZE_MAX;
+
+    return db;
+}
+
+static void csv_mem_error_exit_failing() {
+    fprintf(stderr, "CsvDb couldn't get more memory on the system! Exiting...");
+    exit(EXIT_FAILURE);
+}
+
+/*
+    sets up a table's columns from the csv's header record (the first one
+    that isn't blank), with a StringPool for each column's values if
+    'intern' is set
+*/
+static void read_header(Table* table, CsvScanner* scanner, String* scratch, int intern) {
+    StringView field;
+    int last;
+    while (csv_next_field(scanner, &field, &last)) {
+        if (last && field.len == 0 && table->columns->len == 0) {
+            continue; // blank line
+        }
+
+        char* cell_str = sv_to_str(csv_field_value(field, scratch));
+        int* indexed = malloc(sizeof(int));
+        *indexed = 0;
+        l_push(table->columns, cell_str);
+        m_put(table->columns_to_is_indexed, cell_str, indexed, sizeof(int));
+
+        // intern values of every column but the primary key
+        l_push(table->column_pools, table->columns->len == 1 || !intern ? NULL : new_string_pool());
+
+        if (last) {
+            break;
+        }
+    }
+}
+
+/*
+    a cell waiting to be interned into its column's pool, hashed ahead of
+    time on a worker thread
+*/
+typedef struct PendingCell {
+    StringView value;
+    size_t hash;
+    int copied; // 1 if 'value' was malloc'd (had escaped quotes collapsed)
+} PendingCell;
+
+/*
+    one thread's share of a csv being loaded by load_csv_parallel()
+*/
+typedef struct CsvLoadWorker {
+
+    StringView records;
+    List* column_pools; // only read by the worker
+
+    // rows parsed from 'records' in order, with NULL for cells still to be
+    // interned (in 'pending', in order)
+    List* rows;
+    PendingCell* pending;
+    size_t pending_len;
+    size_t pending_size;
+
+} CsvLoadWorker;
+
+/*
+    Parses a worker's records into rows. Everything that can happen in
+    parallel does: finding records and cells, copying unpooled cells
+    (the keys) and hashing pooled ones. Pools aren't thread safe so
+    interning is left for merge_csv_worker().
+*/
+static void* csv_load_worker(void* arg) {
+    CsvLoadWorker* worker = arg;
+
+    String scratch;
+    init_string(&scratch);
+    CsvScanner scanner = csv_scan(worker->records);
+    StringView field;
+    int last;
+    while (csv_next_field(&scanner, &field, &last)) {
+        if (last && field.len == 0) {
+            continue; // blank line
+        }
+
+        Row* row = new_row_in(NULL, worker->column_pools);
+        if (row == NULL) {
+            csv_mem_error_exit_failing();
+        }
+
+        int more = 1;
+        while (more) {
+            StringView value = csv_field_value(field, &scratch);
+            if (column_pool(worker->column_pools, row->cells->len) == NULL) {
+                l_push(row->cells, sv_to_str(value));
+            }
+            else {
+                if (worker->pending_len == worker->pending_size) {
+                    worker->pending_size = worker->pending_size == 0 ? 4096 : worker->pending_size * 2;
+                    PendingCell* pending = realloc(worker->pending, worker->pending_size * sizeof(PendingCell));
+                    if (pending == NULL) {
+                        csv_mem_error_exit_failing();
+                    }
+                    worker->pending = pending;
+                }
+
+                // values collapsed into the scratch string need a copy
+                // that lasts until they're interned
+                int copied = value.ptr == scratch.buffer;
+                PendingCell pending_cell = {copied ? sv_n(sv_to_str(value), value.len) : value, sv_hash(value), copied};
+                worker->pending[worker->pending_len++] = pending_cell;
+                l_push(row->cells, NULL);
+            }
+            more = !last && csv_next_field(&scanner, &field, &last);
+        }
+        row->key = (char*) l_get(row->cells, 0);
+
+        l_push(worker->rows, row);
+    }
+    free_string_buffer(&scratch);
+
+    // the rows outlive the thread, the rest of its slabs goes to the others
+    pool_thread_release();
+
+    return NULL;
+}
+
+/*
+    adds a loaded row to the table, a later record of the same key replacing
+    the earlier one
+*/
+static void put_row(Table* table, Row* row) {
+    Row* old = m_erase(table->keys_to_rows, row->key); // m_put() would copy over the old Row
+    if (old != NULL) {
+        free_row(old);
+    }
+    m_put(table->keys_to_rows, row->key, row, sizeof(Row));
+}
+
+/*
+    interns a worker's pending cells and adds its rows to the table
+*/
+static void merge_csv_worker(Table* table, CsvLoadWorker* worker) {
+    size_t p = 0;
+    for (size_t r = 0; r < worker->rows->len; ++r) {
+        Row* row = l_get_unchecked(worker->rows, r);
+        for (size_t c = 1; c < row->cells->len; ++c) {
+            StringPool* pool = column_pool(table->column_pools, c);
+            if (pool != NULL) {
+                PendingCell cell = worker->pending[p++];
+                l_set(row->cells, c, sp_get(pool, sp_intern_hashed(pool, cell.value, cell.hash)));
+                if (cell.copied) {
+                    free(cell.value.ptr);
+                }
+            }
+        }
+        put_row(table, row);
+    }
+
+    free(worker->pending);
+    free_list(worker->rows, 0);
+}
+
+/*
+    roughly what a Row costs: the Row, its list of cells, the cells it owns
+    and its entry in a table's 'keys_to_rows'
+*/
+static size_t row_memory(Row* row) {
+    size_t bytes = sizeof(Row) + sizeof(List) + row->cells->data_size * sizeof(void*) + strlen(row->key) + 1 + MAP_ENTRY_BYTES;
+    for (int c = 0; c < row->cells->len; ++c) {
+        if (column_pool(row->column_pools, c) == NULL) {
+            bytes += strlen(l_get(row->cells, c)) + 1;
+        }
+    }
+    return bytes;
+}
+
+/*
+    puts a loaded table in the database under its csv's file name (without
+    the directory or extension)
+*/
+static void add_table(CsvDb* db, char* path, Table* table) {
+
+    // get table name
+    String* table_name_ss = new_string();
+    long end = strlen(path);
+    long dot = end - 1;
+    while (dot >= 0 && path[dot] != '.' && path[dot] != '/') {
+        --dot;
+    }
+    if (dot >= 0 && path[dot] == '.') {
+        end = dot;
+    }
+    for (long i = end - 1; i >= 0; --i) {
+        char c = path[i];
+        if (c != '/') {
+            append_front_c(table_name_ss, c);
+        }
+        else {
+            break;
+        }
+    }
+    
+    // set in db map
+    m_put(db->table_name_to_table, str(table_name_ss), table, sizeof(table));
+    free_string(table_name_ss);
+
+    // row tables are measured once, as adding up every Row each time memory
+    // is checked would be too slow (see table_memory())
+    if (table->column_store == NULL && table->keys_to_rows->len > 0) {
+        size_t bytes = 0;
+        Element** rows = map_elements(table->keys_to_rows);
+        for (int r = 0; r < table->keys_to_rows->len; ++r) {
+            bytes += row_memory((Row*) rows[r]->data);
+        }
+        free(rows);
+        table->row_bytes = bytes / table->keys_to_rows->len;
+    }
+}
+
+/*
+    sv_hash() with its bits mixed (the finalizer of MurmurHash3), for the
+    hash tables of primary keys saved next to a csv (see save_snapshot()
+    and save_row_offsets()). Short keys hash to values alike in their top
+    bits and in a run in their low bits, which would cluster the slots and
+    make their top bits useless for telling keys apart without reading
+    them.
+*/
+static uint64_t key_hash(StringView key) {
+    uint64_t hash = sv_hash(key);
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+/*
+    looks a key up in the hash table of a snapshot (see save_snapshot()),
+    returning its row id or -1 if it isn't there or the row has since been
+    deleted
+*/
+static long snapshot_row_id(Table* table, StringView key) {
+    size_t hash = key_hash(key);
+    size_t mask = table->snapshot_keys_size - 1;
+    for (size_t i = hash & mask; table->snapshot_keys[i] != 0; i = (i + 1) & mask) {
+        uint64_t slot = table->snapshot_keys[i];
+        if ((slot & ~SNAPSHOT_ROW_MASK) == (hash & ~SNAPSHOT_ROW_MASK)) {
+            size_t id = (slot & SNAPSHOT_ROW_MASK) - 1;
+            if (!cs_is_deleted(table->column_store, id) && sv_equals(cs_get_view(table->column_store, id, 0), key)) {
+                return id;
+            }
+        }
+    }
+    return -1;
+}
+
+/*
+    Gets the id of a columnar table's row by its primary key, or -1 if there
+    isn't one.
+*/
+long table_row_id(Table* table, char* key) {
+    void* id = m_get(table->keys_to_rows, key);
+    if (id != NULL) {
+        return (uintptr_t) id - 1;
+    }
+    if (table->snapshot_keys != NULL) {
+        return snapshot_row_id(table, sv(key));
+    }
+    return -1;
+}
+
+/*
+    columnar tables map keys to row ids rather than to Rows, stored as the
+    id + 1 so that row 0 isn't a NULL pointer. A row the key had before is
+    deleted.
+*/
+static void set_row_id(Table* table, char* key, size_t id) {
+    void* old_id = m_erase(table->keys_to_rows, key); // m_put() would copy over the old value
+    if (old_id != NULL) {
+        cs_delete_row(table->column_store, (uintptr_t) old_id - 1);
+    }
+    else if (table->snapshot_keys != NULL) {
+        long snapshot_id = snapshot_row_id(table, sv(key));
+        if (snapshot_id >= 0) {
+            cs_delete_row(table->column_store, snapshot_id);
+        }
+    }
+    m_put(table->keys_to_rows, key, (void*) (uintptr_t) (id + 1), 0);
+}
+
+/*
+    adds a Row to the table for each record left in a mapped csv, on the
+    calling thread
+*/
+static void read_rows(Table* table, CsvScanner* scanner, MappedFile* file, String* scratch) {
+    size_t released = 0;
+    StringView field;
+    int last;
+    while (csv_next_field(scanner, &field, &last)) {
+        if (last && field.len == 0) {
+            continue; // blank line
+        }
+
+        // parsed records have been copied out, so the pages behind
+        // them don't need to stay in memory alongside the table
+        size_t offset = field.ptr - file->data;
+        if (offset - released >= CSV_RELEASE_BYTES) {
+            release_mapped_file(file, offset);
+            released = offset;
+        }
+
+        Row* row = new_row_in(NULL, table->column_pools);
+        if (row == NULL) {
+            csv_mem_error_exit_failing();
+        }
+        add_cell(row, field, scratch);
+        while (!last && csv_next_field(scanner, &field, &last)) {
+            add_cell(row, field, scratch);
+        }
+        put_row(table, row);
+    }
+}
+
+/*
+    Same as load_csv() but parsing the csv on 'num_threads' threads, for
+    big tables where loading is limited by the cpu:
+    ```
+    load_csv_parallel(db, "users.csv", sysconf(_SC_NPROCESSORS_ONLN));
+    ```
+
+    The file is split into one range of records per thread. Each thread
+    parses its range into a batch of rows, then the batches are merged
+    into the table in file order (interning cells into the column pools
+    and adding rows to 'keys_to_rows', which aren't thread safe). Small
+    files are loaded on fewer threads, or just the calling one.
+*/
+void load_csv_parallel(CsvDb* db, char* path, size_t num_threads) {
+
+
+    // PROCESS RECORDS
+    Table* table = new_table(path);
+
+    // rows are built straight from the mapped file in one pass, the only
+    // copies made are of the cells themselves
+    MappedFile file;
+    if (map_file(path, &file) != 0) {
+        perror("Failed to open file");
+        fprintf(stderr, "CsvDb couldn't open file! Exiting...");
+        exit(EXIT_FAILURE);
+    }
+    String scratch;
+    init_string(&scratch);
+    CsvScanner scanner = csv_scan(sv_n(file.data, file.size));
+    read_header(table, &scanner, &scratch, 1);
+    size_t body_start = scanner.pos < file.size ? scanner.pos : file.size;
+    StringView body = sv_n(file.data + body_start, file.size - body_start);
+
+    if (num_threads > body.len / CSV_PARALLEL_MIN_BYTES) {
+        num_threads = body.len / CSV_PARALLEL_MIN_BYTES;
+    }
+    if (num_threads <= 1) {
+        read_rows(table, &scanner, &file, &scratch);
+    }
+    else {
+
+        // split the rest of the file into ranges of whole records
+        CsvLoadWorker* workers = calloc(num_threads, sizeof(CsvLoadWorker));
+        pthread_t* threads = malloc(num_threads * sizeof(pthread_t));
+        int* started = calloc(num_threads, sizeof(int));
+        if (workers == NULL || threads == NULL || started == NULL) {
+            csv_mem_error_exit_failing();
+        }
+        char* end = body.ptr + body.len;
+        char* range_start = body.ptr;
+        for (size_t t = 0; t < num_threads; ++t) {
+            char* range_end = end;
+            if (t + 1 < num_threads) {
+                char* split = body.ptr + body.len / num_threads * (t + 1);
+                if (split < range_start) {
+                    split = range_start;
+                }
+
+                // finish the record the split lands in, which is inside
+                // quotes if there's an odd number of quotes before it
+                CsvScanner tail = csv_scan(sv_n(split, end - split));
+                if (csv_count_quotes(sv_n(range_start, split - range_start)) % 2 == 1) {
+                    tail.in_quotes = ~(uint64_t) 0;
+                }
+                StringView record;
+                csv_next_record(&tail, &record);
+                range_end = tail.pos < tail.len ? split + tail.pos : end;
+            }
+            workers[t].records = sv_n(range_start, range_end - range_start);
+            workers[t].column_pools = table->column_pools;
+            workers[t].rows = new_list();
+            range_start = range_end;
+
+            started[t] = pthread_create(&threads[t], NULL, csv_load_worker, &workers[t]) == 0;
+            if (!started[t]) {
+                csv_load_worker(&workers[t]);
+            }
+        }
+
+        size_t num_rows = 0;
+        for (size_t t = 0; t < num_threads; ++t) {
+            if (started[t]) {
+                pthread_join(threads[t], NULL);
+            }
+            num_rows += workers[t].rows->len;
+        }
+        m_reserve(table->keys_to_rows, num_rows);
+        for (size_t t = 0; t < num_threads; ++t) {
+            merge_csv_worker(table, &workers[t]);
+            release_mapped_file(&file, workers[t].records.ptr + workers[t].records.len - file.data);
+        }
+
+        free(workers);
+        free(threads);
+        free(started);
+    }
+    free_string_buffer(&scratch);
+    unmap_file(&file);
+
+    table->saved = 1;
+    add_table(db, path, table);
+}
+
+/*
+    Loads a csv into the database with these assumptions: 
+    - The first column in the csv is assumed to be the primary key.
+    - The top row is assumed to be column names.
+
+    ## memory_threshold
+    'memory_threshold' (set on the CsvDb) is the approximate amount of bytes tables and their
+    indexes can take up, see enforce_memory_threshold(). If set to 0 no caches will be
+    maintained: indexes are let go of and columnar tables are read from their snapshots.
+    It's unlimited by default, as if memory is not a constraint for you this allows select
+    operations to be lightning fast.
+
+    ## write_frequency_ms
+    'write_frequency_ms' is the frequency in milliseconds that data will be written to the csv
+    files. If set to 0 then the table will write to the csv files for every write operation
+    immediately. If you need data to be accurate immediatly this is the best choice, otherwise
+    data can be lost in the event of a crash.
+
+    If you increase 'write_frequency_ms' then writes can be batched together improving efficiency
+    for write operations. 
+
+    Another option for increasing efficiency is doing write operations in batches or transactions.
+    This is a safer and more recommended option.
+*/
+void load_csv(CsvDb* db, char* path) {
+    load_csv_parallel(db, path, 1);
+}
+
+// SNAPSHOTS
+
+/*
+    What a snapshot remembers about its csv: the size and modification time,
+    and a checksum of the first and last SNAPSHOT_CHECK_BYTES, which catches
+    a csv rewritten to the same size within the same clock tick.
+*/
+typedef struct CsvStamp {
+    uint64_t size;
+    uint64_t mtime_sec;
+    uint64_t mtime_nsec;
+    uint64_t checksum;
+} CsvStamp;
+
+static int csv_stamp(char* path, CsvStamp* stamp) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return 1;
+    }
+    struct stat st;
+    char* buffer = malloc(SNAPSHOT_CHECK_BYTES);
+    if (fstat(fd, &st) != 0 || buffer == NULL) {
+        free(buffer);
+        close(fd);
+        return 1;
+    }
+    stamp->size = st.st_size;
+#ifdef __APPLE__
+    stamp->mtime_sec = st.st_mtimespec.tv_sec;
+    stamp->mtime_nsec = st.st_mtimespec.tv_nsec;
+#else
+    stamp->mtime_sec = st.st_mtim.tv_sec;
+    stamp->mtime_nsec = st.st_mtim.tv_nsec;
+#endif
+
+    size_t tail = st.st_size > SNAPSHOT_CHECK_BYTES ? st.st_size - SNAPSHOT_CHECK_BYTES : 0;
+    ssize_t head_len = pread(fd, buffer, SNAPSHOT_CHECK_BYTES, 0);
+    stamp->checksum = head_len < 0 ? 0 : sv_hash(sv_n(buffer, head_len));
+    ssize_t tail_len = pread(fd, buffer, SNAPSHOT_CHECK_BYTES, tail);
+    stamp->checksum = stamp->checksum * 33 ^ (tail_len < 0 ? 0 : sv_hash(sv_n(buffer, tail_len)));
+
+    free(buffer);
+    close(fd);
+    return head_len < 0 || tail_len < 0;
+}
+
+static char* snapshot_path(char* csv_path) {
+    String* path = new_string();
+    append_f(path, "%s.snapshot", csv_path);
+    return free_string_str(path);
+}
+
+/*
+    Writes a columnar table to a snapshot next to its csv ('path.snapshot'),
+    which load_csv_columnar() loads instead of the csv while the csv stays
+    as it was. table_write() keeps snapshots up to date as it rewrites the
+    csvs.
+
+    A snapshot holds:
+    - "CSVDBSN2", and the CsvStamp of the csv
+    - the column names
+    - a hash table of primary keys to row ids, each slot the row id + 1 in
+      the low bits and the top bits of the key's hash (see key_hash())
+      above them, so lookups rarely need to look at the key itself
+    - the ColumnStore (see cs_save())
+
+    returns 0 if successful
+*/
+int save_snapshot(Table* table) {
+    ColumnStore* store = table->column_store;
+    CsvStamp stamp;
+    if (store == NULL || store->num_rows >= SNAPSHOT_ROW_MASK || csv_stamp(table->csv_path, &stamp) != 0) {
+        return 1;
+    }
+
+    size_t num_slots = 16;
+    while (num_slots < cs_live_rows(store) * 2) {
+        num_slots *= 2;
+    }
+    uint64_t* slots = calloc(num_slots, sizeof(uint64_t));
+    if (slots == NULL) {
+        csv_mem_error_exit_failing();
+    }
+    for (size_t r = 0; r < store->num_rows; ++r) {
+        if (!cs_is_deleted(store, r)) {
+            size_t hash = key_hash(cs_get_view(store, r, 0));
+            size_t i = hash & (num_slots - 1);
+            while (slots[i] != 0) {
+                i = (i + 1) & (num_slots - 1);
+            }
+            slots[i] = (hash & ~SNAPSHOT_ROW_MASK) | (r + 1);
+        }
+    }
+
+    // written to the side and renamed over the old one, so a crash never
+    // leaves half a snapshot
+    char* path = snapshot_path(table->csv_path);
+    String* tmp_path = new_string();
+    append_f(tmp_path, "%s.tmp", path);
+    FILE* file = fopen(str(tmp_path), "wb");
+    int error = file == NULL;
+    if (!error) {
+        error = snapshot_write(file, (void*) SNAPSHOT_MAGIC, 8)
+            || snapshot_write(file, &stamp, sizeof(stamp))
+            || snapshot_write_u64(file, table->columns->len);
+        for (int c = 0; c < table->columns->len && !error; ++c) {
+            char* column = l_get(table->columns, c);
+            error = snapshot_write_u64(file, strlen(column)) || snapshot_write(file, column, strlen(column));
+        }
+        error = error
+            || snapshot_write_u64(file, num_slots)
+            || snapshot_write(file, slots, num_slots * sizeof(uint64_t))
+            || cs_save(store, file);
+        error = fclose(file) != 0 || error;
+        error = error || rename(str(tmp_path), path) != 0;
+        if (error) {
+            remove(str(tmp_path));
+        }
+    }
+
+    free(slots);
+    free(path);
+    free_string(tmp_path);
+    table->saved = !error;
+    return error;
+}
+
+/*
+    maps the snapshot of the csv at 'path' into a new table if it's still up
+    to date with the csv, returning NULL if not
+*/
+static Table* read_snapshot(char* path) {
+    CsvStamp stamp;
+    if (csv_stamp(path, &stamp) != 0) {
+        return NULL;
+    }
+    char* file_path = snapshot_path(path);
+    MappedFile file;
+    int error = map_file(file_path, &file);
+    free(file_path);
+    if (error) {
+        return NULL;
+    }
+    if (file.mapped) {
+        madvise(file.data, file.size, MADV_NORMAL);
+    }
+
+    size_t pos = 0;
+    char* magic = snapshot_read(file.data, file.size, &pos, 8);
+    CsvStamp* saved_stamp = snapshot_read(file.data, file.size, &pos, sizeof(CsvStamp));
+    uint64_t num_columns;
+    if (magic == NULL || memcmp(magic, SNAPSHOT_MAGIC, 8) != 0 || saved_stamp == NULL
+        || memcmp(saved_stamp, &stamp, sizeof(CsvStamp)) != 0
+        || snapshot_read_u64(file.data, file.size, &pos, &num_columns) != 0) {
+        unmap_file(&file);
+        return NULL;
+    }
+
+    Table* table = new_table(path);
+    for (uint64_t c = 0; c < num_columns && !error; ++c) {
+        uint64_t len;
+        char* name = NULL;
+        if (snapshot_read_u64(file.data, file.size, &pos, &len) == 0) {
+            name = snapshot_read(file.data, file.size, &pos, len);
+        }
+        if (name == NULL) {
+            error = 1;
+            break;
+        }
+        char* column = strndup(name, len);
+        int* indexed = malloc(sizeof(int));
+        *indexed = 0;
+        l_push(table->columns, column);
+        m_put(table->columns_to_is_indexed, column, indexed, sizeof(int));
+        l_push(table->column_pools, NULL);
+    }
+
+    uint64_t num_slots = 0;
+    error = error || snapshot_read_u64(file.data, file.size, &pos, &num_slots) != 0
+        || num_slots == 0 || (num_slots & (num_slots - 1)) != 0 || num_slots > file.size / sizeof(uint64_t);
+    if (!error) {
+        table->snapshot_keys = snapshot_read(file.data, file.size, &pos, num_slots * sizeof(uint64_t));
+        table->snapshot_keys_size = num_slots;
+        table->column_store = table->snapshot_keys == NULL ? NULL : cs_load(file.data, file.size, &pos);
+    }
+    table->snapshot = file;
+    if (table->column_store == NULL || table->column_store->num_columns != num_columns || num_columns == 0) {
+        if (table->column_store == NULL) {
+            unmap_file(&table->snapshot);
+        }
+        free_table(table);
+        return NULL;
+    }
+    table->saved = 1;
+    return table;
+}
+
+/*
+    Loads a columnar table from the snapshot of the csv at 'path' if there's
+    one that's still up to date with the csv. The snapshot is mapped into
+    memory and used as it is, so nothing is parsed or copied.
+
+    returns 0 if the table was loaded
+*/
+int load_snapshot(CsvDb* db, char* path) {
+    Table* table = read_snapshot(path);
+    if (table == NULL) {
+        return 1;
+    }
+    add_table(db, path, table);
+    return 0;
+}
+
+// ROW OFFSETS
+
+/*
+    where each record of a csv is, by primary key, collected as the csv is
+    read or written and then saved with save_row_offsets()
+*/
+typedef struct RowOffsets {
+    uint64_t* entries; // the key's hash, offset and length of each record
+    size_t len;
+    size_t size;
+} RowOffsets;
+
+static void row_offsets_add(RowOffsets* offsets, StringView key, size_t offset, size_t len) {
+    if (offsets->len == offsets->size) {
+        offsets->size = offsets->size == 0 ? 1024 : offsets->size * 2;
+        offsets->entries = realloc(offsets->entries, offsets->size * 3 * sizeof(uint64_t));
+        if (offsets->entries == NULL) {
+            csv_mem_error_exit_failing();
+        }
+    }
+    uint64_t* entry = offsets->entries + offsets->len * 3;
+    entry[0] = key_hash(key);
+    entry[1] = offset;
+    entry[2] = len;
+    ++offsets->len;
+}
+
+static char* row_offsets_path(char* csv_path) {
+    String* path = new_string();
+    append_f(path, "%s.offsets", csv_path);
+    return free_string_str(path);
+}
+
+/*
+    Writes the record offsets of a csv to a sidecar next to it
+    ('path.offsets'), so a row table's rows can be read straight from the
+    csv once they're no longer in memory (see unload_rows()). table_write()
+    writes it as it rewrites a row table's csv.
+
+    The sidecar holds:
+    - "CSVDBOF1", and the CsvStamp of the csv
+    - the number of rows (records with the same key count once)
+    - a hash table of primary keys to records, each slot two words: the
+      record's offset + 1 in the low bits of the first and the top bits of
+      the key's hash above them, and the record's length
+
+    returns 0 if successful
+*/
+static int save_row_offsets(char* csv_path, RowOffsets* offsets) {
+    CsvStamp stamp;
+    if (csv_stamp(csv_path, &stamp) != 0) {
+        return 1;
+    }
+
+    size_t num_slots = 16;
+    while (num_slots < offsets->len * 2) {
+        num_slots *= 2;
+    }
+    uint64_t* slots = calloc(num_slots * 2, sizeof(uint64_t));
+    uint64_t* hashes = malloc(num_slots * sizeof(uint64_t));
+    if (slots == NULL || hashes == NULL) {
+        csv_mem_error_exit_failing();
+    }
+
+    // added last to first, so of records with the same key the last (the
+    // one a loaded table keeps) is probed first. Records are counted once
+    // per key (by whole hash, as the keys themselves aren't at hand) to
+    // match the table's length.
+    int error = 0;
+    size_t num_rows = 0;
+    for (size_t e = offsets->len; e > 0 && !error; --e) {
+        uint64_t* entry = offsets->entries + (e - 1) * 3;
+        error = entry[1] >= ROW_OFFSET_MASK;
+        int repeated = 0;
+        size_t i = entry[0] & (num_slots - 1);
+        while (slots[i * 2] != 0) {
+            repeated |= hashes[i] == entry[0];
+            i = (i + 1) & (num_slots - 1);
+        }
+        slots[i * 2] = (entry[0] & ~ROW_OFFSET_MASK) | (entry[1] + 1);
+        slots[i * 2 + 1] = entry[2];
+        hashes[i] = entry[0];
+        num_rows += !repeated;
+    }
+    free(hashes);
+
+    char* path = row_offsets_path(csv_path);
+    String* tmp_path = new_string();
+    append_f(tmp_path, "%s.tmp", path);
+    FILE* file = error ? NULL : fopen(str(tmp_path), "wb");
+    if (file != NULL) {
+        error = snapshot_write(file, (void*) ROW_OFFSETS_MAGIC, 8)
+            || snapshot_write(file, &stamp, sizeof(stamp))
+            || snapshot_write_u64(file, num_rows)
+            || snapshot_write_u64(file, num_slots)
+            || snapshot_write(file, slots, num_slots * 2 * sizeof(uint64_t));
+        error = fclose(file) != 0 || error;
+        error = error || rename(str(tmp_path), path) != 0;
+        if (error) {
+            remove(str(tmp_path));
+        }
+    }
+    else {
+        error = 1;
+    }
+
+    free(slots);
+    free(path);
+    free_string(tmp_path);
+    return error;
+}
+
+/*
+    reads a csv through once to write its row offsets (see
+    save_row_offsets())
+*/
+static int scan_row_offsets(char* csv_path) {
+    MappedFile file;
+    if (map_file(csv_path, &file) != 0) {
+        return 1;
+    }
+    RowOffsets offsets = {NULL, 0, 0};
+    String scratch;
+    init_string(&scratch);
+    CsvScanner scanner = csv_scan(sv_n(file.data, file.size));
+    StringView record;
+    int header = 1;
+    while (csv_next_record(&scanner, &record)) {
+        if (record.len == 0) {
+            continue; // blank line
+        }
+        if (header) {
+            header = 0;
+            continue;
+        }
+        CsvScanner fields = csv_scan(record);
+        StringView key;
+        int last;
+        csv_next_field(&fields, &key, &last);
+        row_offsets_add(&offsets, csv_field_value(key, &scratch), record.ptr - file.data, record.len);
+    }
+    free_string_buffer(&scratch);
+    unmap_file(&file);
+
+    int error = save_row_offsets(csv_path, &offsets);
+    free(offsets.entries);
+    return error;
+}
+
+/*
+    maps a row table's row offsets and opens its csv to read rows from,
+    if the sidecar is up to date with the csv
+
+    returns 0 if successful
+*/
+static int open_row_offsets(Table* table) {
+    CsvStamp stamp;
+    char* path = row_offsets_path(table->csv_path);
+    MappedFile file;
+    int error = csv_stamp(table->csv_path, &stamp) != 0 || map_file(path, &file) != 0;
+    free(path);
+    if (error) {
+        return 1;
+    }
+
+    size_t pos = 0;
+    char* magic = snapshot_read(file.data, file.size, &pos, 8);
+    CsvStamp* saved_stamp = snapshot_read(file.data, file.size, &pos, sizeof(CsvStamp));
+    uint64_t num_rows = 0;
+    uint64_t num_slots = 0;
+    uint64_t* slots = NULL;
+    error = magic == NULL || memcmp(magic, ROW_OFFSETS_MAGIC, 8) != 0 || saved_stamp == NULL
+        || memcmp(saved_stamp, &stamp, sizeof(CsvStamp)) != 0
+        || snapshot_read_u64(file.data, file.size, &pos, &num_rows) != 0
+        || snapshot_read_u64(file.data, file.size, &pos, &num_slots) != 0
+        || num_slots == 0 || (num_slots & (num_slots - 1)) != 0 || num_slots > file.size;
+    if (!error) {
+        slots = snapshot_read(file.data, file.size, &pos, num_slots * 2 * sizeof(uint64_t));
+    }
+    int fd = slots == NULL ? -1 : open(table->csv_path, O_RDONLY);
+    if (fd < 0) {
+        unmap_file(&file);
+        return 1;
+    }
+    if (file.mapped) {
+        madvise(file.data, file.size, MADV_RANDOM);
+    }
+
+    close_row_offsets(table);
+    table->row_offsets = file;
+    table->row_offset_slots = slots;
+    table->row_offset_slots_size = num_slots;
+    table->cold_len = num_rows;
+    table->csv_fd = fd;
+    return 0;
+}
+
+/*
+    reads the row with primary key 'key' from the csv of a row table whose
+    rows were let go of, probing its row offsets and reading just the
+    record, or returns NULL if there's no such row. The row is kept as the
+    table's 'cold_row' until the next one is read.
+*/
+static Row* read_cold_row(Table* table, char* key) {
+    size_t hash = key_hash(sv(key));
+    size_t mask = table->row_offset_slots_size - 1;
+    char* record = NULL;
+    Row* found = NULL;
+    for (size_t i = hash & mask; found == NULL && table->row_offset_slots[i * 2] != 0; i = (i + 1) & mask) {
+        uint64_t slot = table->row_offset_slots[i * 2];
+        if ((slot & ~ROW_OFFSET_MASK) != (hash & ~ROW_OFFSET_MASK)) {
+            continue;
+        }
+        size_t len = table->row_offset_slots[i * 2 + 1];
+        record = realloc(record, len + 1);
+        if (record == NULL) {
+            csv_mem_error_exit_failing();
+        }
+        ssize_t bytes_read = pread(table->csv_fd, record, len, (slot & ROW_OFFSET_MASK) - 1);
+        if (bytes_read != (ssize_t) len) {
+            break;
+        }
+        Row* row = parse_row_view(sv_n(record, len), NULL);
+        if (strcmp(row->key, key) == 0) {
+            found = row;
+        }
+        else {
+            free_row(row);
+        }
+    }
+    free(record);
+
+    if (found != NULL) {
+        if (table->cold_row != NULL) {
+            free_row(table->cold_row);
+        }
+        table->cold_row = found;
+    }
+    return found;
+}
+
+/*
+    lets go of a saved row table's Rows, reading them from its csv by their
+    row offsets from then on (see save_row_offsets()), which are written
+    first if the sidecar is missing or out of date. Changes made to the
+    table after are kept in memory over the csv's rows until it's
+    rewritten (see 'cold_deleted_keys'), and scans read the csv record by
+    record (see scan_rows()), so the table isn't read back in whole.
+
+    returns 0 if successful
+*/
+static int unload_rows(Table* table) {
+    if (open_row_offsets(table) != 0 && (scan_row_offsets(table->csv_path) != 0 || open_row_offsets(table) != 0)) {
+        table->saved = 0;
+        return 1;
+    }
+
+    Element** rows = map_elements(table->keys_to_rows);
+    for (int r = 0; r < table->keys_to_rows->len; ++r) {
+        free_row((Row*) rows[r]->data);
+    }
+    free(rows);
+    free_map(table->keys_to_rows, 0);
+    table->keys_to_rows = new_map();
+    reset_column_pools(table);
+    return 0;
+}
+
+/*
+    reads the Rows of a row table whose rows were let go of back into
+    memory, for when its rewritten csv can't be read by row offsets (see
+    table_write())
+*/
+static void load_rows(Table* table) {
+    if (table->row_offset_slots == NULL) {
+        return;
+    }
+    close_row_offsets(table);
+
+    MappedFile file;
+    if (map_file(table->csv_path, &file) != 0) {
+        perror("Failed to open file");
+        fprintf(stderr, "CsvDb couldn't open file! Exiting...");
+        exit(EXIT_FAILURE);
+    }
+    String scratch;
+    init_string(&scratch);
+    CsvScanner scanner = csv_scan(sv_n(file.data, file.size));
+    StringView record;
+    while (csv_next_record(&scanner, &record) && record.len == 0) {} // skip the header
+    read_rows(table, &scanner, &file, &scratch);
+    free_string_buffer(&scratch);
+    unmap_file(&file);
+}
+
+/*
+    1 if the record at 'offset' in a row table's mapped csv is the one its
+    key 'key' is read from, rather than an earlier record of the same key
+*/
+static int cold_record_current(Table* table, MappedFile* file, char* key, size_t offset, String* scratch) {
+    size_t hash = key_hash(sv(key));
+    size_t mask = table->row_offset_slots_size - 1;
+    for (size_t i = hash & mask; table->row_offset_slots[i * 2] != 0; i = (i + 1) & mask) {
+        uint64_t slot = table->row_offset_slots[i * 2];
+        if ((slot & ~ROW_OFFSET_MASK) != (hash & ~ROW_OFFSET_MASK)) {
+            continue;
+        }
+        size_t slot_offset = (slot & ROW_OFFSET_MASK) - 1;
+        if (slot_offset == offset) {
+            return 1;
+        }
+
+        // the first slot of the key is its last record
+        CsvScanner fields = csv_scan(sv_n(file->data + slot_offset, table->row_offset_slots[i * 2 + 1]));
+        StringView slot_key;
+        int last;
+        csv_next_field(&fields, &slot_key, &last);
+        if (sv_equals(csv_field_value(slot_key, scratch), sv(key))) {
+            return 0;
+        }
+    }
+    return 0;
+}
+
+/*
+    calls 'visit' with each row of a row table. The rows of a table whose
+    rows were let go of are parsed from its csv one at a time and freed
+    after their visit, so a scan doesn't read the table back into memory,
+    and its changed rows are visited from memory instead.
+*/
+static void scan_rows(Table* table, void (*visit)(Row* row, void* context), void* context) {
+    if (table->row_offset_slots == NULL) {
+        Element** rows = map_elements(table->keys_to_rows);
+        for (int r = 0; r < table->keys_to_rows->len; ++r) {
+            visit((Row*) rows[r]->data, context);
+        }
+        free(rows);
+        return;
+    }
+
+    MappedFile file;
+    if (map_file(table->csv_path, &file) != 0) {
+        perror("Failed to open file");
+        fprintf(stderr, "CsvDb couldn't open file! Exiting...");
+        exit(EXIT_FAILURE);
+    }
+    String scratch;
+    init_string(&scratch);
+    CsvScanner scanner = csv_scan(sv_n(file.data, file.size));
+    StringView record;
+    int header = 1;
+    size_t released = 0;
+    while (csv_next_record(&scanner, &record)) {
+        if (record.len == 0) {
+            continue; // blank line
+        }
+        if (header) {
+            header = 0;
+            continue;
+        }
+
+        size_t offset = record.ptr - file.data;
+        if (offset - released >= CSV_RELEASE_BYTES) {
+            release_mapped_file(&file, offset);
+            released = offset;
+        }
+        Row* row = parse_row_view(record, NULL);
+        if (!m_contains(table->keys_to_rows, row->key) && !m_contains(table->cold_deleted_keys, row->key)
+                && cold_record_current(table, &file, row->key, offset, &scratch)) {
+            visit(row, context);
+        }
+        free_row(row);
+    }
+    free_string_buffer(&scratch);
+    unmap_file(&file);
+
+    // then the rows changed since the csv was written
+    Element** rows = map_elements(table->keys_to_rows);
+    for (int r = 0; r < table->keys_to_rows->len; ++r) {
+        visit((Row*) rows[r]->data, context);
+    }
+    free(rows);
 }
 
-String* convert_rows_to_csv_text(List* rows) {
-    String* ss = new_string();
-    for (int i = 0; i < rows->len; ++i) {
+/*
+    Returns the number of rows in a table of either kind.
+*/
+size_t table_len(Table* table) {
+    if (table->column_store != NULL) {
+        return cs_live_rows(table->column_store);
+    }
+    return table->row_offset_slots != NULL ? table->cold_len : table->keys_to_rows->len;
+}
 
-        List* row = (Row*) l_get(rows, i);
-        for (int j = 0; j < row->len; ++j) {
-            char* cell = (char*) l_get(row, j);
-            append(ss, cell);
-            if (j < row->len-1) 
-                append(ss, ",");
+/*
+    Gets a cell of the row with primary key 'key', or NULL if there's no such
+    row or it doesn't have that many cells. Works for both row and columnar
+    tables. Cells of rows read from disk are only good until the next
+    table_get() on the table.
+*/
+char* table_get(Table* table, char* key, size_t column) {
+    table->last_accessed_ms = current_time_ms();
+    if (table->column_store != NULL) {
+        long id = table_row_id(table, key);
+        if (id < 0 || column >= table->column_store->num_columns) {
+            return NULL;
         }
-        append(ss, "\n");
+        return cs_get(table->column_store, id, column);
     }
 
-    return ss;
+    Row* row = m_get(table->keys_to_rows, key);
+    if (row == NULL && table->row_offset_slots != NULL && !m_contains(table->cold_deleted_keys, key)) {
+        row = read_cold_row(table, key);
+    }
+    if (row == NULL || column >= row->cells->len) {
+        return NULL;
+    }
+    return l_get(row->cells, column);
 }
 
-Row* parse_row(String* str) {
 
-    Row* row = malloc(sizeof(Row));
-    row->cells = new_list();
+// MEMORY
 
-    size_t num_splits;
-    String** cells = split(str, ",", &num_splits);
-    for (int c = 0; c < num_splits; ++c) {
-        char* cell_str = free_string_str(cells[c]);
-        l_push(row->cells, cell_str);
+/*
+    Returns roughly the bytes a table and its indexes take up in memory.
+    Columns still in a mapped snapshot don't count, as the OS pages them in
+    and out of its page cache as they're used.
+*/
+size_t table_memory(Table* table) {
+    size_t bytes = sizeof(Table) + table->keys_to_rows->data_size * sizeof(Element*);
+    if (table->column_store != NULL) {
+        bytes += cs_memory(table->column_store) + table->keys_to_rows->len * MAP_ENTRY_BYTES;
+    }
+    else {
+        bytes += table->keys_to_rows->len * table->row_bytes;
+        bytes += table->cold_deleted_keys->len * MAP_ENTRY_BYTES + table->cold_deleted_keys->data_size * sizeof(Element*);
     }
-    row->key = (char*) l_get(row->cells, 0);
-    free(cells);
-
-    return row;
-}
 
-String* row_to_str(Row* row) {
-    String* str = new_string();
-    for (int i = 0; i < row->cells->len; ++i) {
-        char* cell = l_get(row->cells, i);
-        append(str, cell);
-        if (i < row->cells->len-1)
-            append(str, ",");
+    for (int c = 0; c < table->column_pools->len; ++c) {
+        StringPool* pool = l_get(table->column_pools, c);
+        if (pool != NULL) {
+            bytes += pool->bytes + pool->strings_size * (sizeof(char*) + 2 * sizeof(size_t)) + pool->slots_size * sizeof(unsigned int);
+        }
     }
 
-    return str;
+    Element** indices = map_elements(table->column_values_to_indices);
+    for (int i = 0; i < table->column_values_to_indices->len; ++i) {
+        Index* index = (Index*) indices[i]->data;
+        bytes += sizeof(Index) + index->bytes;
+        if (index->values_to_keys != NULL) {
+            bytes += (index->values_to_keys->data_size + index->keys_to_positions->data_size) * sizeof(Element*);
+        }
+    }
+    free(indices);
+    return bytes;
 }
 
-void free_row(Row* row) {
-    while (row->cells->len > 0) {
-        char* cell = l_pop(row->cells);
-        free(cell);
+/*
+    Returns roughly the bytes every table in the database takes up (see
+    table_memory()).
+*/
+size_t db_memory(CsvDb* db) {
+    size_t bytes = 0;
+    Element** tables = map_elements(db->table_name_to_table);
+    for (int t = 0; t < db->table_name_to_table->len; ++t) {
+        bytes += table_memory((Table*) tables[t]->data);
     }
-    // free(row->key); row->key is also a cell and is freed in the loop 
-    free_list(row->cells, 0);
-    free(row);
+    free(tables);
+    return bytes;
 }
 
-int compare_file_names(const void* a, const void* b) {
-    const char* a_str = *(const char**)a;
-    const char* b_str = *(const char**)b;
-    return strcmp(a_str, b_str);
+/*
+    1 if a table has cells in memory it could let go of, reading them from
+    disk instead
+*/
+static int table_can_unload(Table* table) {
+    if (!table->saved) {
+        return 0;
+    }
+    if (table->column_store == NULL) {
+        return table->row_offset_slots == NULL && table->keys_to_rows->len > 0;
+    }
+    if (table->snapshot.data == NULL || table->keys_to_rows->len > 0) {
+        return 1;
+    }
+    for (size_t c = 0; c < table->column_store->num_columns; ++c) {
+        if (!table->column_store->columns[c].mapped) {
+            return 1;
+        }
+    }
+    return 0;
 }
 
+/*
+    swaps a columnar table's cells for its snapshot (which holds the same
+    rows, see 'saved'), so they're read from disk as needed
+    rather than kept on the heap. Indexes are untouched, as the table's
+    keys and values are the same.
 
+    returns 0 if successful
+*/
+static int unload_columns(Table* table) {
+    Table* mapped = read_snapshot(table->csv_path);
+    if (mapped == NULL) {
+        table->saved = 0;
+        return 1;
+    }
 
-// USER FUNCTIONS
-
-void free_database(CsvDb* db) {
+    ColumnStore* store = table->column_store;
+    MappedFile snapshot = table->snapshot;
+    Map* keys_to_rows = table->keys_to_rows;
+    table->column_store = mapped->column_store;
+    table->snapshot = mapped->snapshot;
+    table->snapshot_keys = mapped->snapshot_keys;
+    table->snapshot_keys_size = mapped->snapshot_keys_size;
+    table->keys_to_rows = mapped->keys_to_rows;
+
+    // the old cells are freed with the table they're swapped into
+    mapped->column_store = store;
+    mapped->snapshot = snapshot;
+    mapped->keys_to_rows = keys_to_rows;
+    free_table(mapped);
+    return 0;
+}
 
-    Element** tables = map_elements(db->table_name_to_table);
-    for(int t = 0; t < db->table_name_to_table->len; ++t) {
-        Element* ele = tables[t];
-        Table* table = (Table*) m_erase(db->table_name_to_table, ele->key);
+/*
+    Lets go of the least recently used caches until the database takes up no
+    more than its 'memory_threshold' (see db_memory()), or there's nothing
+    left to let go of. Two kinds of cache are let go, oldest first:
+    - indexes, which are rebuilt once their column is selected again
+      INDEX_REBUILD_SCANS times (see table_select_keys())
+    - the cells of tables whose changes have been written. Columnar tables
+      map their snapshot in their place (see load_snapshot()), row tables
+      read rows from their csv by their row offsets (see unload_rows()),
+      and are scanned straight from the csv (see scan_rows()). Rows
+      changed since are kept in memory until the csv is written.
+
+    This is called after load_csv_columnar(), index_column(), transaction()
+    and table_write().
+*/
+void enforce_memory_threshold(CsvDb* db) {
+    while (db_memory(db) > db->memory_threshold) {
+        Table* oldest_table = NULL;
+        Index* oldest_index = NULL;
+        size_t oldest_ms = SIZE_MAX;
+
+        Element** tables = map_elements(db->table_name_to_table);
+        for (int t = 0; t < db->table_name_to_table->len; ++t) {
+            Table* table = (Table*) tables[t]->data;
+            if (table->last_accessed_ms < oldest_ms && table_can_unload(table)) {
+                oldest_table = table;
+                oldest_index = NULL;
+                oldest_ms = table->last_accessed_ms;
+            }
 
-        // free rows
-        Element** rows = map_elements(table->keys_to_rows);
-        for (int r = 0; r < table->keys_to_rows->len; ++r) {
-            Element* row_ele = rows[r];
-            Row* row = (Row*) m_get(table->keys_to_rows, row_ele->key);
-            free_row(row);
+            Element** indices = map_elements(table->column_values_to_indices);
+            for (int i = 0; i < table->column_values_to_indices->len; ++i) {
+                Index* index = (Index*) indices[i]->data;
+                if (index->values_to_keys != NULL && index->last_accessed_ms < oldest_ms) {
+                    oldest_table = table;
+                    oldest_index = index;
+                    oldest_ms = index->last_accessed_ms;
+                }
+            }
+            free(indices);
         }
-        free(rows);
-        free_map(table->keys_to_rows, 0);
+        free(tables);
 
-
-        // free indices
-        Element** indices = map_elements(table->column_values_to_indices);
-        for (int i = 0; i < table->column_values_to_indices->len; ++i) {
-            Element* index_ele = indices[i];
-            Index* index = m_get(table->column_values_to_indices, index_ele->key);
-            free(index->key);
-            free(index);
+        if (oldest_table == NULL) {
+            return;
         }
-        free(indices);
-        free_map(table->column_values_to_indices, 0);
-
-
-        // free columns
-        while (table->columns->len > 0) {
-            char* column = l_pop(table->columns);
-            free(column);
+        if (oldest_index != NULL) {
+            evict_index(oldest_index);
         }
-        free_list(table->columns, 0);
-
-
-        // free columns_to_is_indexed
-        Element** columns = map_elements(table->columns_to_is_indexed);
-        for (int i = 0; i < table->columns_to_is_indexed->len; ++i) {
-            Element* ele = columns[i];
-            int* indexed = m_get(table->columns_to_is_indexed, ele->key);
-            free(indexed);
+        else if (oldest_table->column_store != NULL) {
+            unload_columns(oldest_table);
+        }
+        else {
+            unload_rows(oldest_table);
         }
-        free(columns);
-        free_map(table->columns_to_is_indexed, 0);
+    }
+}
 
+/*
+    Loads a csv like load_csv(), but keeps the table's cells column by column
+    in a ColumnStore instead of as a Row per record. Each value is copied
+    into its column's buffer, so a table costs little more than the csv text
+    itself plus an offset per cell, rather than an allocation per cell and
+    a list per row. Once loaded, columns with few distinct values, long runs
+    of the same value or integers in a small range are compressed further
+    (see Columns.h), and can be filtered with cs_filter_equals() and
+    cs_filter_range() on 'column_store' without decoding them.
+
+    The table is saved to a snapshot next to the csv (see save_snapshot())
+    and loaded from it next time, for as long as the csv doesn't change.
+
+    Use table_get() to read cells from either kind of table.
+*/
+void load_csv_columnar(CsvDb* db, char* path) {
+    if (load_snapshot(db, path) == 0) {
+        enforce_memory_threshold(db);
+        return;
+    }
+    Table* table = new_table(path);
 
-        // free table path
-        free(table->csv_path);
+    MappedFile file;
+    if (map_file(path, &file) != 0) {
+        perror("Failed to open file");
+        fprintf(stderr, "CsvDb couldn't open file! Exiting...");
+        exit(EXIT_FAILURE);
+    }
+    String scratch;
+    init_string(&scratch);
+    CsvScanner scanner = csv_scan(sv_n(file.data, file.size));
+    read_header(table, &scanner, &scratch, 0);
+    table->column_store = new_column_store(table->columns->len);
+
+    size_t released = 0;
+    StringView field;
+    int last;
+    while (csv_next_field(&scanner, &field, &last)) {
+        if (last && field.len == 0) {
+            continue; // blank line
+        }
 
+        size_t offset = field.ptr - file.data;
+        if (offset - released >= CSV_RELEASE_BYTES) {
+            release_mapped_file(&file, offset);
+            released = offset;
+        }
 
-        // free the table itself
-        free(table);
+        cs_push_value(table->column_store, csv_field_value(field, &scratch));
+        while (!last && csv_next_field(&scanner, &field, &last)) {
+            cs_push_value(table->column_store, csv_field_value(field, &scratch));
+        }
+        size_t id = cs_end_row(table->column_store);
+        set_row_id(table, cs_get(table->column_store, id, 0), id);
     }
-    free(tables);
-    free_map(db->table_name_to_table, 0);
+    free_string_buffer(&scratch);
+    unmap_file(&file);
 
+    cs_compress(table->column_store);
+    add_table(db, path, table);
+    save_snapshot(table);
+    enforce_memory_threshold(db);
+}
 
-    Element** locks = map_elements(db->transaction_file_locks);
-    for(int l = 0; l < db->transaction_file_locks->len; ++l) {
-        free(locks[l]);
+static long column_position(Table* table, char* column_name) {
+    for (int c = 0; c < table->columns->len; ++c) {
+        if (strcmp(l_get(table->columns, c), column_name) == 0) {
+            return c;
+        }
     }
-    free(locks);
-    free_map(db->transaction_file_locks, 0);
+    return -1;
+}
 
+static void index_add(Index* index, char* value, char* key) {
+    if (m_contains(index->keys_to_positions, key)) {
+        return;
+    }
+    List* keys = m_get(index->values_to_keys, value);
+    if (keys == NULL) {
+        keys = new_list_s(2);
+        m_put(index->values_to_keys, value, keys, sizeof(List));
+        index->bytes += sizeof(List) + 2 * sizeof(void*) + strlen(value) + 1 + MAP_ENTRY_BYTES;
+    }
+    m_put(index->keys_to_positions, key, (void*) (uintptr_t) keys->len, 0);
+    l_push(keys, strdup(key));
+    index->bytes += 2 * (strlen(key) + 1) + sizeof(void*) + MAP_ENTRY_BYTES;
+}
 
-    free(db);
+static void index_remove(Index* index, char* value, char* key) {
+    List* keys = m_get(index->values_to_keys, value);
+    if (keys == NULL || !m_contains(index->keys_to_positions, key)) {
+        return;
+    }
+    size_t position = (uintptr_t) m_erase(index->keys_to_positions, key);
+    free(l_get(keys, position));
+    index->bytes -= 2 * (strlen(key) + 1) + sizeof(void*) + MAP_ENTRY_BYTES;
+
+    // the last key takes the removed key's place
+    char* last = l_pop(keys);
+    if (position < keys->len) {
+        l_set(keys, position, last);
+        m_erase(index->keys_to_positions, last);
+        m_put(index->keys_to_positions, last, (void*) (uintptr_t) position, 0);
+    }
+    if (keys->len == 0) {
+        m_erase(index->values_to_keys, value);
+        free_list(keys, 0);
+        index->bytes -= sizeof(List) + 2 * sizeof(void*) + strlen(value) + 1 + MAP_ENTRY_BYTES;
+    }
 }
 
-CsvDb* new_database() {
-    CsvDb* db = malloc(sizeof(CsvDb));
-    db->table_name_to_table = new_map();
-    db->transaction_file_locks = new_map();
+/*
+    adds a row to (or removes it from) every index on its table, under its
+    values as they are now
+*/
+static void update_indices(Table* table, char* key, int adding) {
+    if (table->column_values_to_indices->len == 0) {
+        return;
+    }
+    for (int c = 0; c < table->columns->len; ++c) {
+        Index* index = m_get(table->column_values_to_indices, l_get(table->columns, c));
+        char* value = index == NULL || index->values_to_keys == NULL ? NULL : table_get(table, key, c);
+        if (value == NULL) {
+            continue;
+        }
+        if (adding) {
+            index_add(index, value, key);
+        }
+        else {
+            index_remove(index, value, key);
+        }
+    }
+}
 
-    return db;
+static void index_row(Row* row, void* index) {
+    size_t column = ((Index*) index)->column;
+    if (column < row->cells->len) {
+        index_add(index, l_get(row->cells, column), row->key);
+    }
 }
 
 /*
-    Loads a csv into the database with these assumptions: 
-    - The first column in the csv is assumed to be the primary key.
-    - The top row is assumed to be column names.
+    fills an index from every row of its table
+*/
+static void build_index(Table* table, Index* index) {
+    size_t column = index->column;
+    index->values_to_keys = new_map();
+    index->keys_to_positions = new_map();
+    index->bytes = 0;
+    index->scans = 0;
+
+    if (table->column_store != NULL) {
+        ColumnStore* store = table->column_store;
+        String* key = new_string();
+        for (size_t r = 0; r < store->num_rows; ++r) {
+            if (!cs_is_deleted(store, r)) {
+                // the key is copied out, as number columns share a buffer
+                // between values
+                clear_string(key);
+                StringView key_v = cs_get_view(store, r, 0);
+                append_n(key, key_v.ptr, key_v.len);
+                index_add(index, cs_get(store, r, column), str(key));
+            }
+        }
+        free_string(key);
+    }
+    else {
+        scan_rows(table, index_row, index);
+    }
+}
 
-    ## memory_threshold
-    'memory_threshold' is the approximate amount of bytes caches for the table can take up.
-    If set to 0 no caches will be maintained. If memory is not a constraint for you, you 
-    might consider setting this value very high as this will allow select operations to 
-    become lightning fast.
+/*
+    Builds an index on a table's column, mapping each value in the column to
+    the primary keys of the rows with it, so table_select_keys() on that
+    column is a hash lookup instead of a scan. The index is kept up to date
+    by transaction(), and may be let go of to stay under the database's
+    memory_threshold (see enforce_memory_threshold()).
 
-    ## write_frequency_ms
-    'write_frequency_ms' is the frequency in milliseconds that data will be written to the csv
-    files. If set to 0 then the table will write to the csv files for every write operation
-    immediately. If you need data to be accurate immediatly this is the best choice, otherwise
-    data can be lost in the event of a crash.
+    returns 0 if successful, or 1 if there's no such table or column
+*/
+int index_column(CsvDb* db, char* table_name, char* column_name) {
+    Table* table = m_get(db->table_name_to_table, table_name);
+    long column = table == NULL ? -1 : column_position(table, column_name);
+    if (column < 0) {
+        return 1;
+    }
+    if (m_contains(table->column_values_to_indices, column_name)) {
+        return 0;
+    }
 
-    If you increase 'write_frequency_ms' then writes can be batched together improving efficiency
-    for write operations. 
+    Index* index = malloc(sizeof(Index));
+    if (index == NULL) {
+        csv_mem_error_exit_failing();
+    }
+    index->column = column;
+    index->last_accessed_ms = current_time_ms();
+    build_index(table, index);
+
+    m_put(table->column_values_to_indices, column_name, index, sizeof(Index));
+    int* indexed = m_get(table->columns_to_is_indexed, column_name);
+    *indexed = 1;
+    enforce_memory_threshold(db);
+    return 0;
+}
 
-    Another option for increasing efficiency is doing write operations in batches or transactions.
-    This is a safer and more recommended option.
+/*
+    the keys of the rows with 'value' in 'column', collected by select_row()
 */
-void load_csv(CsvDb* db, char* path) {
-    
-
-    // PROCESS LINES
-    Table* table = new_table(path);
-    
-    size_t num_lines;
-    String** lines = read_lines(path, &num_lines);
-    if (lines == NULL) {
-        perror("Failed to open file");
-        fprintf(stderr, "CsvDb couldn't open file! Exiting...");
-        exit(EXIT_FAILURE);
+typedef struct RowSelect {
+    size_t column;
+    char* value;
+    List* keys;
+} RowSelect;
+
+static void select_row(Row* row, void* context) {
+    RowSelect* select = context;
+    if (select->column < row->cells->len && strcmp(l_get(row->cells, select->column), select->value) == 0) {
+        l_push(select->keys, strdup(row->key));
     }
-    for(size_t y = 0; y < num_lines; ++y) {
-        String* line = lines[y];
-
-        if (line->len > 0) {
-            size_t columns;
-            String** cells = split(line, "," , &columns);
-            if (y == 0) {
-                for (size_t x = 0; x < columns; ++x) {
-                    String* cell = cells[x];
-                    char* cell_str = free_string_str(cell);
-                    int* indexed = malloc(sizeof(int));
-                    *indexed = 0;
-                    l_push(table->columns, cell_str);
-                    m_put(table->columns_to_is_indexed, cell_str, indexed, sizeof(int));
-                }
-            }
-            else {
-                Row* row = malloc(sizeof(Row));
-                row->cells = new_list();
-                for (size_t x = 0; x < columns; ++x) {
-                    String* cell = cells[x];
-                    char* cell_str = free_string_str(cell);
-                    l_push(row->cells, cell_str);
-                    if (x == 0) {
-                        row->key = cell_str;
-                    }
-                }
-                m_put(table->keys_to_rows, row->key, row, sizeof(Row));
-            }
+}
 
-            free(cells);
+/*
+    Gets the primary keys of the rows whose 'column_name' is 'value', like
+    "WHERE email = 'bob@gmail.com'". Indexed columns (see index_column())
+    are looked up directly, other columns are scanned. An index that was let
+    go of is rebuilt once its column has been scanned INDEX_REBUILD_SCANS
+    times.
+
+    Returns a new list of new strings (free with free_list(keys, 1)), or
+    NULL if there's no such column.
+*/
+List* table_select_keys(Table* table, char* column_name, char* value) {
+    long column = column_position(table, column_name);
+    if (column < 0) {
+        return NULL;
+    }
+    List* keys = new_list();
+    table->last_accessed_ms = current_time_ms();
+
+    Index* index = m_get(table->column_values_to_indices, column_name);
+    if (index != NULL) {
+        index->last_accessed_ms = table->last_accessed_ms;
+        if (index->values_to_keys == NULL && ++index->scans >= INDEX_REBUILD_SCANS) {
+            build_index(table, index);
         }
-        free_string(line);
     }
-    free(lines);
-
-
-
-    // SET IN DB
-    
-    // get table name
-    String* table_name_ss = new_string();
-    size_t start = strlen(path) - 1;
-    while(start >= 0 && path[start] != '.') {
-        --start;
+    if (index != NULL && index->values_to_keys != NULL) {
+        List* matching = m_get(index->values_to_keys, value);
+        if (matching != NULL) {
+            for (int i = 0; i < matching->len; ++i) {
+                l_push(keys, strdup(l_get(matching, i)));
+            }
+        }
     }
-    --start;
-    for(int i = start; i >= 0; --i) {
-        char c = path[i];
-        if (c != '/') {
-            append_front_c(table_name_ss, c);
+    else if (table->column_store != NULL) {
+        ColumnStore* store = table->column_store;
+        size_t words = cs_bitmap_words(store);
+        uint64_t* matches = malloc((words > 0 ? words : 1) * sizeof(uint64_t)); // malloc(0) may give NULL
+        if (matches == NULL) {
+            csv_mem_error_exit_failing();
         }
-        else {
-            break;
+        cs_filter_equals(store, column, sv(value), matches);
+        for (size_t w = 0; w < words; ++w) {
+            for (uint64_t bits = matches[w]; bits != 0; bits &= bits - 1) {
+                size_t r = w * 64 + __builtin_ctzll(bits);
+                l_push(keys, sv_to_str(cs_get_view(store, r, 0)));
+            }
         }
+        free(matches);
+    }
+    else {
+        RowSelect select = {column, value, keys};
+        scan_rows(table, select_row, &select);
     }
-    
-    // set in db map
-    m_put(db->table_name_to_table, str(table_name_ss), table, sizeof(table));
-    free_string(table_name_ss);
-    
-}
 
-/*
-    Marks a column to be indexed by in-memory caches. This index will not be complete if it requires
-    more memory then is alloted to the table with it's memory_threshold.
-*/
-void index_column(CsvDb* db, char* column_name) {}
+    return keys;
+}
 
 /**
  * Method for writing the in memory tables to the actual csv
@@ -463,46 +2288,56 @@ void table_write(CsvDb* db) {
         if (strcmp(file, ".") == 0 || strcmp(file, "..") == 0)
             continue;
         String* transaction_file_path = new_string();
-        append(transaction_file_path, TMP_DIRECTORY);
-        append(transaction_file_path, "/");
-        append(transaction_file_path, file);
+        append_f(transaction_file_path, "%s/%s", TMP_DIRECTORY, file);
         char* trans_file_path_str = free_string_str(transaction_file_path);
         l_push(transaction_files, trans_file_path_str);
     }
     closedir(dir);
-    l_sort(transaction_files, compare_file_names);
+    l_sort_str(transaction_files);
+
 
+    // everything read from the transaction files lives in this arena and
+    // is freed in one go once the tables are written
+    Arena* arena = new_arena();
+    if (arena == NULL) {
+        fprintf(stderr, "CsvDb couldn't get more memory on the system! Exiting...");
+        exit(EXIT_FAILURE);
+    }
 
-    Map* transaction_tables_to_rows = new_map();
-    Map* transaction_tables_to_delete_keys = new_map();
+    Map* transaction_tables_to_rows = new_map_in(arena);
+    Map* transaction_tables_to_delete_keys = new_map_in(arena);
     for (int i = 0; i < transaction_files->len; ++i) {
 
         char* file = l_get(transaction_files, i);
 
-        // collect rows from transaction files
-        size_t num_lines;
-        String** lines = read_lines(file, &num_lines);
+        // collect rows from transaction files (records rather than lines,
+        // as quoted cells can hold line breaks)
+        MappedFile mapped;
+        if (map_file(file, &mapped) != 0) {
+            perror("Failed to open transaction file");
+            exit(EXIT_FAILURE);
+        }
+        CsvScanner scanner = csv_scan(sv_n(mapped.data, mapped.size));
+        StringView line_v;
         Map* keys_to_rows;
-        Set* delete_keys = new_set();
+        Set* delete_keys = NULL;
         char* table_name = NULL;
-        for (int i = 0; i < num_lines; ++i) {
-            String* line = lines[i];
-            if (line->len > 0) {
+        for (int i = 0; csv_next_record(&scanner, &line_v); ++i) {
+            if (line_v.len > 0) {
                 if(i == 0) {
-                    if (!starts_with(line, "END")) {
+                    if (!sv_starts_with(line_v, "END")) {
                         break; // if the transaction was incomplete skip it
                     }
                 }
-                else if (starts_with(line, "<TABLE>")) {
-                    String* table_name_ss = substr(line, 8, line->len);
+                else if (sv_starts_with(line_v, "<TABLE>")) {
                     if (table_name != NULL) free(table_name);
-                    table_name = free_string_str(table_name_ss);
+                    table_name = sv_to_str(sv_slice(line_v, 8, line_v.len));
 
                     if (m_contains(transaction_tables_to_rows, table_name)) {
                         keys_to_rows = m_get(transaction_tables_to_rows, table_name);
                     }
                     else {
-                        keys_to_rows = new_map();
+                        keys_to_rows = new_map_in(arena);
                         m_put(transaction_tables_to_rows, table_name, keys_to_rows, sizeof(Map));
                     }
 
@@ -510,34 +2345,32 @@ void table_write(CsvDb* db) {
                         delete_keys = m_get(transaction_tables_to_delete_keys, table_name);
                     }
                     else {
-                        delete_keys = new_set();
+                        delete_keys = new_set_in(arena);
                         m_put(transaction_tables_to_delete_keys, table_name, delete_keys, sizeof(List));
                     }
                 }
-                else if (starts_with(line, "DELETE")) {
-                    int num_splits;
-                    String** splits = split(line, " ", &num_splits);
-                    String* key_s = splits[1];
-                    char* key = str_c(key_s); 
+                else if (sv_starts_with(line_v, "DELETE ")) {
+                    StringView key_v = sv_slice(line_v, 7, line_v.len);
+                    char* key = arena_strndup(arena, key_v.ptr, key_v.len);
 
                     s_add(delete_keys, key);
                     m_erase(keys_to_rows, key);
-                    free_strings(splits, num_splits);
                 }
                 else {
-                    Row* row = parse_row(line);
+                    Row* row = parse_row_in(arena, line_v, NULL);
                     m_put(keys_to_rows, row->key, row, sizeof(row));
                 }
             }
-            free_string(line);
         }
         free(table_name);
-        free(lines);
+        unmap_file(&mapped);
     }
 
 
     // step through lines in real csvs writing to copy csvs and apply changes
+    // (noting where each record of a row table goes, for its row offsets)
     Map* table_name_to_temp_tables = new_map();
+    Map* table_name_to_row_offsets = new_map();
     Element** tables_in_db = map_elements(db->table_name_to_table);
     for(int i = 0; i < db->table_name_to_table->len; ++i) {
         Element* table_ele = tables_in_db[i];
@@ -545,68 +2378,88 @@ void table_write(CsvDb* db) {
         Table* table = (Table*) table_ele->data;
 
         if (m_contains(transaction_tables_to_rows, table_name)) {
-            FILE *file = fopen(table->csv_path, "r");
-            if (file == NULL) {
+
+            // the table's csv is streamed through a fixed size buffer, so
+            // rewriting it doesn't need the whole file in memory
+            CsvReader* reader = new_csv_reader(table->csv_path);
+            if (reader == NULL) {
                 perror("Failed to open file");
                 exit(EXIT_FAILURE);
             }
 
             String* new_table_path = new_string();
-            append(new_table_path, TMP_DIRECTORY);
-            append(new_table_path, "/");
-            append(new_table_path, table_name);
-            append(new_table_path, ".csv");
+            append_f(new_table_path, "%s/%s.csv", TMP_DIRECTORY, table_name);
             m_put(table_name_to_temp_tables, table_name, str_c(new_table_path), sizeof(char*));
 
             FILE* tmp_file = fopen(str(new_table_path), "a");
             if (tmp_file == NULL) {
-                fclose(file);
+                free_csv_reader(reader);
                 perror("Failed to make temp file writing to db");
                 exit(EXIT_FAILURE);
             }
 
-            String* line = read_line(file);
             Map* transaction_keys_to_rows = m_get(transaction_tables_to_rows, table_name);
             Set* keys_in_to_delete = m_get(transaction_tables_to_delete_keys, table_name);
-            while(line != NULL) {
-
-                Row* row = parse_row(line);
-                if (m_contains(transaction_keys_to_rows, row->key)) {
-                    Row* trans_row = m_get(transaction_keys_to_rows, row->key);
+            RowOffsets* offsets = calloc(1, sizeof(RowOffsets));
+            if (offsets == NULL) {
+                csv_mem_error_exit_failing();
+            }
+            m_put(table_name_to_row_offsets, table_name, offsets, sizeof(RowOffsets));
+            int collect_offsets = table->column_store == NULL;
+            size_t offset = 0;
+            String* key = new_string();
+            for (int header = 1; csv_read_row(reader); header = 0) {
+
+                clear_string(key);
+                append_n(key, reader->fields[0].ptr, reader->fields[0].len);
+                if (m_contains(transaction_keys_to_rows, str(key))) {
+                    Row* trans_row = m_get(transaction_keys_to_rows, str(key));
                     String* row_str = row_to_str(trans_row);
-                    fprintf(tmp_file, str(row_str));
+                    if (collect_offsets && !header) {
+                        row_offsets_add(offsets, sv(trans_row->key), offset, row_str->len);
+                    }
+                    append_c(row_str, '\n');
+                    fwrite(str(row_str), 1, row_str->len, tmp_file);
+                    offset += row_str->len;
                     free_string(row_str);
                     m_erase(transaction_keys_to_rows, trans_row->key);
-                    free_row(trans_row);
-                    fprintf(tmp_file, "\n");
                 }
-                else if (s_contains(keys_in_to_delete, row->key)) {
+                else if (s_contains(keys_in_to_delete, str(key))) {
                     // nothing (don't write)
                 }
                 else {
-                    fprintf(tmp_file, str(line));
-                    fprintf(tmp_file, "\n");
+                    if (collect_offsets && !header) {
+                        // (the reader has taken the quotes off already)
+                        row_offsets_add(offsets, reader->fields[0], offset, reader->record.len);
+                    }
+                    fwrite(reader->record.ptr, 1, reader->record.len, tmp_file);
+                    fputc('\n', tmp_file);
+                    offset += reader->record.len + 1;
                 }
-                fflush(tmp_file);
-
-                free_string(line);
-                free_row(row);
-
-                line = read_line(file);
             }
+            if (reader->error) {
+                perror("Failed reading csv writing to db");
+                exit(EXIT_FAILURE);
+            }
+            free_string(key);
             
             Element** left_over = map_elements(transaction_keys_to_rows);
             for(int e = 0; e < transaction_keys_to_rows->len; ++e) {
                 Element* ele = left_over[e];
                 Row* trans_row = (Row*) ele->data;
                 String* row_str = row_to_str(trans_row);
-                fprintf(tmp_file, str(row_str));
-                fprintf(tmp_file, "\n");
+                if (collect_offsets) {
+                    row_offsets_add(offsets, sv(trans_row->key), offset, row_str->len);
+                }
+                append_c(row_str, '\n');
+                fwrite(str(row_str), 1, row_str->len, tmp_file);
+                offset += row_str->len;
+                free_string(row_str);
             }
             free(left_over);
 
             fclose(tmp_file);
-            fclose(file);
+            free_csv_reader(reader);
 
             free_string(new_table_path);
         }
@@ -629,11 +2482,27 @@ void table_write(CsvDb* db) {
             perror("Error csv file with tmp file");
             exit(EXIT_FAILURE);
         }
+        RowOffsets* offsets = m_get(table_name_to_row_offsets, table_name);
+        if (table->column_store != NULL) {
+            save_snapshot(table);
+        }
+        else {
+            // a table reading rows from its csv moves to the new one,
+            // which has the changes it kept over the old one
+            int error = save_row_offsets(table->csv_path, offsets);
+            if (table->row_offset_slots != NULL && (error || open_row_offsets(table) != 0)) {
+                load_rows(table);
+            }
+            table->saved = 1;
+        }
+        free(offsets->entries);
+        free(offsets);
 
         free(tmp_path);
     }
     free(table_name_tmps);
     free_map(table_name_to_temp_tables, 0);
+    free_map(table_name_to_row_offsets, 0);
 
 
     // delete transaction files
@@ -648,40 +2517,11 @@ void table_write(CsvDb* db) {
     free_list(transaction_files, 0);
 
 
-    // clean up transaction varaibles
-    Element** transaction_tables = map_elements(transaction_tables_to_rows);
-    for(int i = 0; i < transaction_tables_to_rows->len; ++i) {
-        Element* transaction_table = transaction_tables[i];
-        Map* key_to_rows = (Map*) transaction_table->data;
-
-        Element** key_to_rows_elements = map_elements(key_to_rows);
-        for(int j = 0; j < key_to_rows->len; ++j) {
-            Element* ele = key_to_rows_elements[j];
-            Row* row = (Row*) ele->data;
-            free_row(row);
-        }
-        free(key_to_rows_elements);
-        free_map(key_to_rows, 0);
-    }
-    free(transaction_tables);
-
-    Element** delete_tables = map_elements(transaction_tables_to_delete_keys);
-    for(int i = 0; i < transaction_tables_to_delete_keys->len; ++i) {
-        Element* transaction_table = delete_tables[i];
-        Set* delete_keys = (Set*) transaction_table->data;
-
-        char** items = set_items(delete_keys);
-        for (int s = 0; s < delete_keys->len; ++s) {
-            char* key = (char*) items[s];
-            free(key);
-        }
-        free_set(delete_keys);
-    }
-    free(delete_tables);
+    // clean up transaction varaibles (rows, keys, maps and sets)
+    free_arena(arena);
 
-    
-    free_map(transaction_tables_to_rows, 0);
-    free_map(transaction_tables_to_delete_keys, 0);
+    // tables just saved to snapshots can be let go of now
+    enforce_memory_threshold(db);
 }
 
 /*
@@ -745,29 +2585,32 @@ void transaction(CsvDb* db, Map* table_name_to_rows, Map* table_name_to_keys_to_
 
     // get timestamp for transaction file name
     size_t milliseconds = current_time_ms();
-    char buffer[32];
-    sprintf(buffer, "%zu", milliseconds);
     String* ss = new_string();
-    append(ss, TMP_DIRECTORY);
-    append(ss, "/");
-    append(ss, buffer);
-    append(ss, ".trans");
+    append_f(ss, "%s/%zu.trans", TMP_DIRECTORY, milliseconds);
 
     // WRITE TO TRANSACTION FILE
-    String* transaction_str = new_string();
+    // (built as a rope so "END" can be put in front without copying the
+    // whole transaction, and written out chunk by chunk)
+    Rope* transaction_rope = new_rope();
+    String* line = new_string();
     Element** tables = map_elements(table_name_to_rows);
     for (size_t i = 0; i < table_name_to_rows->len; ++i) {
         Element* ele = tables[i];
         char* table_name = ele->key;
         List* rows = (List*) ele->data;
 
-        append(transaction_str, "<TABLE> ");
-        append(transaction_str, table_name);
-        append(transaction_str, "\n");
-
-        String* row_str = convert_rows_to_csv_text(rows);
-        append(transaction_str, str(row_str));
-        free_string(row_str);
+        clear_string(line);
+        append_f(line, "<TABLE> %s\n", table_name);
+        rope_append_n(transaction_rope, str(line), line->len);
+
+        for (int r = 0; r < rows->len; ++r) {
+            List* row = (List*) l_get(rows, r);
+            l_linearize(row);
+            clear_string(line);
+            append_csv_row(line, (char**) row->data, row->len);
+            append_c(line, '\n');
+            rope_append_n(transaction_rope, str(line), line->len);
+        }
     }
     free(tables);
 
@@ -777,23 +2620,20 @@ void transaction(CsvDb* db, Map* table_name_to_rows, Map* table_name_to_keys_to_
         char* table_name = ele->key;
         char* key = (char*) ele->data;
 
-        append(transaction_str, "<TABLE> ");
-        append(transaction_str, table_name);
-        append(transaction_str, "\n");
-
-        append(transaction_str, "DELETE ");
-        append(transaction_str, key);
-        append(transaction_str, "\n");
+        clear_string(line);
+        append_f(line, "<TABLE> %s\nDELETE %s\n", table_name, key);
+        rope_append_n(transaction_rope, str(line), line->len);
     }
     free(delete_tables);
+    free_string(line);
 
-    append_front(transaction_str, "END\n");
-    if( write_to_file(str(ss), str(transaction_str)) ) {
+    rope_prepend(transaction_rope, "END\n");
+    if( rope_write_file(transaction_rope, str(ss)) ) {
         perror("Failed to write transaction to file");
         exit(EXIT_FAILURE);
     }
     free_string(ss);
-    free_string(transaction_str);
+    free_rope(transaction_rope);
 
 
     // SET IN IN-MEMORY TABLES 
@@ -807,48 +2647,67 @@ void transaction(CsvDb* db, Map* table_name_to_rows, Map* table_name_to_keys_to_
         Table* table = m_get(db->table_name_to_table, table_name);
         if (table == NULL) {
             String* path = new_string();
-            append(path, table_name);
-            append(path, ".csv");
+            append_f(path, "%s.csv", table_name);
             table = new_table(str(path));
             free_string(path);
 
             m_put(db->table_name_to_table, strdup(table_name), table, sizeof(Table));
         }
-
-        // insert rows
-        for (int j = 0; j < rows->len; ++j) {
-            List* row = (List*) l_get(rows, j);
-
-            // copy row
-            Row* row_cpy = malloc(sizeof(Row));
-            char* row_key = (char*) l_get(row, 0);
-            row_cpy->cells = new_list();
-            for (int c = 0; c < row->len; ++c) {
-                char* cell_cpy = strdup(l_get(row, c));
-                l_push(row_cpy->cells, cell_cpy);
-            }
-            row_cpy->key = (char*) l_get(row_cpy->cells, 0);
-            if (m_contains(table->keys_to_rows, row_key)) {
-                Row* row = (Row*) m_erase(table->keys_to_rows, row_key);
-                free_row(row);
+        table->last_accessed_ms = current_time_ms();
+        table->saved = 0;
+
+        // insert rows (a changed row in a columnar table is added as a new
+        // row, leaving the old one unreferenced)
+        if (table->column_store != NULL) {
+            for (int j = 0; j < rows->len; ++j) {
+                List* row = (List*) l_get(rows, j);
+                update_indices(table, l_get(row, 0), 0);
+                for (int c = 0; c < row->len; ++c) {
+                    cs_push_value(table->column_store, sv(l_get(row, c)));
+                }
+                size_t id = cs_end_row(table->column_store);
+                set_row_id(table, l_get(row, 0), id);
+                update_indices(table, l_get(row, 0), 1);
             }
-            m_put(table->keys_to_rows, row_key, row_cpy, sizeof(Row));
         }
+        else {
+            for (int j = 0; j < rows->len; ++j) {
+                List* row = (List*) l_get(rows, j);
+
+                // copy row
+                Row* row_cpy = pool_alloc(sizeof(Row));
+                char* row_key = (char*) l_get(row, 0);
+                row_cpy->cells = new_list();
+                row_cpy->column_pools = table->column_pools;
+                row_cpy->arena = NULL;
+                for (int c = 0; c < row->len; ++c) {
+                    char* cell_cpy = copy_cell(table->column_pools, c, sv(l_get(row, c)), NULL);
+                    l_push(row_cpy->cells, cell_cpy);
+                }
+                row_cpy->key = (char*) l_get(row_cpy->cells, 0);
 
-        // UPDATE INDICES
-        for (int c = 0; c < table->columns->len; ++c) {
-            char* column = l_get(table->columns, c);
-            int* indexed = (int*) m_get(table->columns_to_is_indexed, column);
-            if (*indexed) {
-                for (int j = 0; j < rows->len; ++j) {
-                    Row* row = (Row*) l_get(rows, j);
-                    Set* indices = (Set*) m_get(table->column_values_to_indices, column);
-                    if (indices == NULL) {
-                        indices = new_set();
-                        m_put(table->column_values_to_indices, column, indices, sizeof(Set));
-                    }
-                    s_add(indices, row->key);
+                // a table that had no rows to measure when it was added is
+                // measured by its first (see add_table())
+                if (table->row_bytes == 0) {
+                    table->row_bytes = row_memory(row_cpy);
+                }
+
+                // a table reading rows from its csv keeps the changed row
+                // over the csv's (see 'cold_deleted_keys')
+                int existed = table_get(table, row_key, 0) != NULL;
+                if (existed) {
+                    update_indices(table, row_key, 0);
+                }
+                Row* old_row = (Row*) m_erase(table->keys_to_rows, row_key);
+                if (old_row != NULL) {
+                    free_row(old_row);
                 }
+                if (table->row_offset_slots != NULL) {
+                    m_erase(table->cold_deleted_keys, row_key);
+                    table->cold_len += !existed;
+                }
+                m_put(table->keys_to_rows, row_key, row_cpy, sizeof(Row));
+                update_indices(table, row_key, 1);
             }
         }
     }
@@ -861,7 +2720,27 @@ void transaction(CsvDb* db, Map* table_name_to_rows, Map* table_name_to_keys_to_
         char* key = (char*) ele->data;
 
         Table* table = m_get(db->table_name_to_table, table_name);
-        m_erase(table->keys_to_rows, key);
+        if (table == NULL) {
+            continue;
+        }
+        table->last_accessed_ms = current_time_ms();
+        table->saved = 0;
+        int cold_delete = table->row_offset_slots != NULL && table_get(table, key, 0) != NULL;
+        update_indices(table, key, 0);
+        if (table->column_store != NULL) {
+            long id = table_row_id(table, key);
+            if (id >= 0) {
+                cs_delete_row(table->column_store, id);
+            }
+        }
+        Row* row = m_erase(table->keys_to_rows, key);
+        if (row != NULL && table->column_store == NULL) {
+            free_row(row);
+        }
+        if (cold_delete) {
+            m_put(table->cold_deleted_keys, key, NULL, 0);
+            --table->cold_len;
+        }
     }
     free(delete_elements);
 
@@ -872,6 +2751,9 @@ void transaction(CsvDb* db, Map* table_name_to_rows, Map* table_name_to_keys_to_
         db->last_write_ms = time;
         table_write(db);
     }
+    else {
+        enforce_memory_threshold(db);
+    }
 
 
 
@@ -0,0 +1,327 @@
+#ifndef DEQUE
+#define DEQUE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+
+/*
+    A double ended queue of elements of any type, meant for very large lists.
+    It has the following operation complexities
+    - d_push(...) -> O(1)
+    - d_push_front(...) -> O(1)
+    - d_pop(...) -> O(1)
+    - d_pop_front(...) -> O(1)
+    - d_get(...) -> O(1)
+    - d_set(...) -> O(1)
+    - d_get_ref(...) -> O(1)
+    - d_clear() -> O(n)
+    - free_deque() -> O(n)
+
+
+    Like List.h, the deque stores pointers to objects inserted by the user and
+    doesn't free them unless asked to in d_clear() or free_deque().
+
+    ```
+    Deque* deque = new_deque();
+    for (int i = 0; i < 10; i++) {
+        int* d = malloc(sizeof(int));
+        *d = i;
+        d_push(deque, d);
+    }
+    int first = *(int*) d_get(deque, 0);
+    int last = *(int*) d_get(deque, -1);
+    free_deque(deque, 1);
+    ```
+
+
+    # DESIGN
+
+    Elements are kept in fixed size chunks of DEQUE_CHUNK_SIZE pointers. A small
+    directory (a ring buffer of chunk pointers) keeps the chunks in order. When
+    the deque grows a new chunk is added at either end, and only the directory
+    is ever copied (one pointer per chunk), never the elements.
+
+    Compared to a List this means:
+    - growing never needs the old and new arrays in memory at the same time,
+      and never copies existing elements, so latency stays flat at tens of
+      millions of elements
+    - the slot holding an element never moves while the element is in the
+      deque, so pointers from d_get_ref() stay valid
+
+    One emptied chunk is kept around as a spare so pushing and popping back and
+    forth across a chunk boundary doesn't malloc and free every time.
+
+*/
+typedef struct Deque {
+    void*** chunks; // directory, a ring buffer of chunk pointers
+    size_t chunks_size; // size of the directory (always a power of two)
+    size_t first_chunk; // directory index of the first chunk in use
+    size_t num_chunks; // number of chunks in use
+
+    size_t start; // index of the first element in the first chunk
+    size_t len;
+
+    void** spare; // an emptied chunk kept for reuse (or NULL)
+} Deque;
+
+
+// elements per chunk, must be a power of two
+#define DEQUE_CHUNK_SHIFT 9
+const size_t DEQUE_CHUNK_SIZE = (size_t) 1 << DEQUE_CHUNK_SHIFT;
+
+
+
+static void deque_mem_error_exit_failing() {
+    fprintf(stderr, "Deque couldn't get more memory on the system! Exiting...");
+    exit(EXIT_FAILURE);
+}
+
+
+Deque* new_deque() {
+    Deque* deque = malloc(sizeof(Deque));
+    if (deque == NULL) {
+        deque_mem_error_exit_failing();
+    }
+    deque->chunks_size = 8;
+    deque->chunks = malloc(deque->chunks_size * sizeof(void**));
+    if (deque->chunks == NULL) {
+        free(deque);
+        deque_mem_error_exit_failing();
+    }
+    deque->first_chunk = 0;
+    deque->num_chunks = 0;
+    deque->start = 0;
+    deque->len = 0;
+    deque->spare = NULL;
+
+    return deque;
+}
+
+
+static inline void** d_chunk(Deque* deque, size_t chunk) {
+    return deque->chunks[(deque->first_chunk + chunk) & (deque->chunks_size - 1)];
+}
+
+/*
+    doubles the directory, copying only chunk pointers
+*/
+static void d_grow_directory(Deque* deque) {
+    size_t new_size = deque->chunks_size * 2;
+    void*** new_chunks = malloc(new_size * sizeof(void**));
+    if (new_chunks == NULL) {
+        deque_mem_error_exit_failing();
+    }
+    for (size_t c = 0; c < deque->num_chunks; ++c) {
+        new_chunks[c] = d_chunk(deque, c);
+    }
+
+    free(deque->chunks);
+    deque->chunks = new_chunks;
+    deque->chunks_size = new_size;
+    deque->first_chunk = 0;
+}
+
+static void** d_new_chunk(Deque* deque) {
+    if (deque->spare != NULL) {
+        void** chunk = deque->spare;
+        deque->spare = NULL;
+        return chunk;
+    }
+
+    void** chunk = malloc(DEQUE_CHUNK_SIZE * sizeof(void*));
+    if (chunk == NULL) {
+        deque_mem_error_exit_failing();
+    }
+    return chunk;
+}
+
+static void d_release_chunk(Deque* deque, void** chunk) {
+    if (deque->spare == NULL) {
+        deque->spare = chunk;
+    }
+    else {
+        free(chunk);
+    }
+}
+
+/*
+    frees chunks once the deque is empty so it starts over at the
+    beginning of a chunk
+*/
+static void d_release_if_empty(Deque* deque) {
+    if (deque->len == 0) {
+        for (size_t c = 0; c < deque->num_chunks; ++c) {
+            d_release_chunk(deque, d_chunk(deque, c));
+        }
+        deque->num_chunks = 0;
+        deque->first_chunk = 0;
+        deque->start = 0;
+    }
+}
+
+
+
+/*
+    Adds an element to the end of the deque. O(1)
+*/
+void d_push(Deque* deque, void* data) {
+
+    size_t pos = deque->start + deque->len;
+    if ((pos >> DEQUE_CHUNK_SHIFT) >= deque->num_chunks) {
+        if (deque->num_chunks == deque->chunks_size) {
+            d_grow_directory(deque);
+        }
+        size_t back = (deque->first_chunk + deque->num_chunks) & (deque->chunks_size - 1);
+        deque->chunks[back] = d_new_chunk(deque);
+        ++deque->num_chunks;
+    }
+
+    d_chunk(deque, pos >> DEQUE_CHUNK_SHIFT)[pos & (DEQUE_CHUNK_SIZE - 1)] = data;
+    ++deque->len;
+}
+
+/*
+    Adds an element to the front of the deque. O(1)
+*/
+void d_push_front(Deque* deque, void* data) {
+
+    if (deque->start == 0) {
+        if (deque->num_chunks == deque->chunks_size) {
+            d_grow_directory(deque);
+        }
+        deque->first_chunk = (deque->first_chunk - 1) & (deque->chunks_size - 1);
+        deque->chunks[deque->first_chunk] = d_new_chunk(deque);
+        ++deque->num_chunks;
+        deque->start = DEQUE_CHUNK_SIZE;
+    }
+
+    --deque->start;
+    d_chunk(deque, 0)[deque->start] = data;
+    ++deque->len;
+}
+
+/*
+    Removes and retrieves the last element of the deque, or NULL
+    if the deque is empty. O(1)
+*/
+void* d_pop(Deque* deque) {
+
+    if (deque->len == 0) {
+        return NULL;
+    }
+
+    --deque->len;
+    size_t pos = deque->start + deque->len;
+    void* data = d_chunk(deque, pos >> DEQUE_CHUNK_SHIFT)[pos & (DEQUE_CHUNK_SIZE - 1)];
+
+    // give back the last chunk once it's empty
+    if (deque->len > 0 && (pos & (DEQUE_CHUNK_SIZE - 1)) == 0) {
+        d_release_chunk(deque, d_chunk(deque, deque->num_chunks - 1));
+        --deque->num_chunks;
+    }
+    d_release_if_empty(deque);
+
+    return data;
+}
+
+/*
+    Removes and retrieves the first element of the deque, or NULL
+    if the deque is empty. O(1)
+*/
+void* d_pop_front(Deque* deque) {
+
+    if (deque->len == 0) {
+        return NULL;
+    }
+
+    void* data = d_chunk(deque, 0)[deque->start];
+    ++deque->start;
+    --deque->len;
+
+    // give back the first chunk once it's empty
+    if (deque->len > 0 && deque->start == DEQUE_CHUNK_SIZE) {
+        d_release_chunk(deque, d_chunk(deque, 0));
+        deque->first_chunk = (deque->first_chunk + 1) & (deque->chunks_size - 1);
+        --deque->num_chunks;
+        deque->start = 0;
+    }
+    d_release_if_empty(deque);
+
+    return data;
+}
+
+
+
+static size_t convert_index_deque(Deque* deque, int index) {
+
+    if (index < 0) {
+        index += deque->len;
+    }
+
+    int in_bounds = index >= 0 && index < deque->len;
+    if (!in_bounds) {
+        fprintf(stderr, "Index ");
+        fprintf(stderr, "%d", index);
+        fprintf(stderr, " out of bounds for len ");
+        fprintf(stderr, "%zu", deque->len);
+        exit(EXIT_FAILURE);
+    }
+
+    return deque->start + index;
+}
+
+/*
+    Gets a pointer to the slot holding the element at 'index'. The slot
+    doesn't move until the element is popped, so the returned pointer can
+    be kept around while the deque grows.
+*/
+void** d_get_ref(Deque* deque, int index) {
+    size_t pos = convert_index_deque(deque, index);
+    return &d_chunk(deque, pos >> DEQUE_CHUNK_SHIFT)[pos & (DEQUE_CHUNK_SIZE - 1)];
+}
+
+/*
+    Gets the element at 'index'. Negative indices count back from the end.
+*/
+void* d_get(Deque* deque, int index) {
+    return *d_get_ref(deque, index);
+}
+
+/*
+    Replaces the pointer stored at 'index' with 'data'.
+*/
+void d_set(Deque* deque, int index, void* data) {
+    *d_get_ref(deque, index) = data;
+}
+
+
+
+/*
+    Clears the deque, and frees all objects on the heap if specified.
+*/
+void d_clear(Deque* deque, int is_freeing_objects) {
+    if (is_freeing_objects) {
+        for (size_t i = 0; i < deque->len; ++i) {
+            size_t pos = deque->start + i;
+            free(d_chunk(deque, pos >> DEQUE_CHUNK_SHIFT)[pos & (DEQUE_CHUNK_SIZE - 1)]);
+        }
+    }
+    deque->len = 0;
+    d_release_if_empty(deque);
+}
+
+/*
+    frees the deque and stored objects if specified.
+*/
+void free_deque(Deque* deque, int is_freeing_objects) {
+    d_clear(deque, is_freeing_objects);
+    free(deque->spare);
+    free(deque->chunks);
+    free(deque);
+}
+
+
+
+#endif
@@ -1,9 +1,13 @@
 #ifndef LIST
 #define LIST
 
+#include "Arena.h"
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <pthread.h>
+#include <unistd.h>
 
 
 /*
@@ -18,6 +22,9 @@
     - l_clear() -> O(n)
     - free_list() -> O(n)
     - l_slice() -> O(n)
+    - l_get_unchecked(...) -> O(1)
+    - l_set_unchecked(...) -> O(1)
+    - l_shrink_to_fit() -> O(n)
 
 
     This list implementation stores pointers to objects inserted by the user. These
@@ -77,14 +84,44 @@
     free_list(list);
     ```
 
+
+    # CAPACITY
+
+    When the internal array size is a power of two (the default for new_list() and
+    new_list_p2()) wrapping around the ring buffer is done with a bit mask instead
+    of a modulo, which avoids a division on every push, pop and get. Lists made with
+    new_list_s() and a size that isn't a power of two still work, they just use the
+    slower modulo path.
+
+    For hot loops where you already know your indices are valid, l_get_unchecked()
+    and l_set_unchecked() skip the negative index handling and bounds check:
+    ```
+    for (size_t i = 0; i < list->len; ++i) {
+        int ele = *(int*) l_get_unchecked(list, i);
+    }
+    ```
+
+    The internal array grows by 'growth_factor' (2 by default) when full. You can
+    set a smaller factor on a list to trade more frequent resizes for less
+    unused memory, though a growth factor other than 2 will usually leave the
+    list on the modulo path. Call l_shrink_to_fit() to give back unused memory.
+
+    Lists made with new_list_in() get their memory from an arena (see Arena.h),
+    and l_push() and l_push_front() return 1 instead of exiting if the arena
+    runs out.
+
 */
 typedef struct List {
     void** data; // pointer to array of pointers
     size_t data_size;
+    size_t mask; // data_size - 1 if data_size is a power of two, otherwise 0
+    double growth_factor; // how much the internal array grows by when full (2 by default)
 
     size_t start;
     size_t end;
     size_t len;
+
+    Arena* arena; // where the list's memory comes from, or NULL for the heap
 } List;
 
 
@@ -95,17 +132,57 @@ static void list_mem_error_exit_failing() {
 }
 
 
-List* new_list_s(size_t size) {
-    List *p_list = malloc(sizeof(List));
+/*
+    Lists in an arena report running out of memory, lists on the heap exit.
+    returns 1 (an error)
+*/
+static int list_mem_error(List* list) {
+    if (list->arena == NULL) {
+        list_mem_error_exit_failing();
+    }
+    return 1;
+}
+
+
+static size_t list_mask(size_t size) {
+    if (size > 1 && (size & (size - 1)) == 0) {
+        return size - 1;
+    }
+    return 0;
+}
+
+/*
+    Wraps an index into the internal array. Uses a mask when the
+    array size is a power of two, otherwise a modulo.
+*/
+static inline size_t l_wrap(List* list, size_t index) {
+    if (list->mask) {
+        return index & list->mask;
+    }
+    return index % list->data_size;
+}
+
+
+static List* new_list_s_in(Arena* arena, size_t size) {
+    List *p_list = a_malloc(arena, sizeof(List));
     if (p_list == NULL) {
+        if (arena != NULL) {
+            return NULL;
+        }
         list_mem_error_exit_failing();
     }
-    p_list->data = malloc(size * sizeof(void*));
+    p_list->data = a_malloc(arena, size * sizeof(void*));
     if (p_list->data == NULL) {
-        free(p_list);
+        a_free(arena, p_list);
+        if (arena != NULL) {
+            return NULL;
+        }
         list_mem_error_exit_failing();
     }
+    p_list->arena = arena;
     p_list->data_size = size;
+    p_list->mask = list_mask(size);
+    p_list->growth_factor = 2;
     p_list->start = 0;
     p_list->end = 0;
     p_list->len = 0;
@@ -113,46 +190,74 @@ List* new_list_s(size_t size) {
     return p_list;
 }
 
+List* new_list_s(size_t size) {
+    return new_list_s_in(NULL, size);
+}
+
+/*
+    Makes a list with an internal array size of at least 'size',
+    rounded up to a power of two so the list uses mask based wrapping.
+*/
+List* new_list_p2(size_t size) {
+    size_t p2 = 2;
+    while (p2 < size) {
+        p2 <<= 1;
+    }
+    return new_list_s(p2);
+}
+
 List* new_list() {
-    return new_list_s(10);
+    return new_list_p2(16);
+}
+
+/*
+    Makes a list whose memory comes from 'arena' (see Arena.h). Returns
+    NULL if the arena is out of memory.
+*/
+List* new_list_in(Arena* arena) {
+    return new_list_s_in(arena, 16);
 }
 
 
 
 /*
-    doubles the internal array of the list
+    Sets the internal array of the list to 'new_size' (which must be
+    bigger than the list's length), moving the elements to the start
+    of the array.
+
+    If the elements are already in one contiguous run the existing array
+    is reused with realloc (which glibc services with mremap for very large
+    arrays), otherwise a new array is allocated and both halves of the ring
+    are copied over.
 
     returns 0 if successful
 */
-int resize(List* list) {
-
-    /*
-        int size = size();
-        T[] newData = (T[]) new Object[data.length * 2];
-        if (startIndex > endIndex) {
-            int startSize = this.data.length - startIndex;
-            System.arraycopy(this.data, startIndex, newData, 0, startSize);
-            System.arraycopy(this.data, 0, newData, startSize, endIndex);
-        }
-        else if (startIndex == endIndex) {
-            // do nothing empty array
+static int resize_s(List* list, size_t new_size) {
+
+    if (list->start <= list->end) {
+
+        // shift elements to the front of the array
+        if (list->start > 0) {
+            memmove(
+                list->data, 
+                list->data + list->start, 
+                list->len * sizeof(void*)
+            );
+            list->start = 0;
+            list->end = list->len;
         }
-        else {
-            System.arraycopy(this.data, startIndex, newData, 0, size);
-        }
-
-        data = newData;
-        startIndex = 0;
-        endIndex = size;
-    */
 
-    size_t new_size = list->data_size * 2;
-    void** new_data = malloc(new_size * sizeof(void*));
-    if (new_data == NULL) {
-        list_mem_error_exit_failing();
+        void** new_data = a_realloc(list->arena, list->data, list->data_size * sizeof(void*), new_size * sizeof(void*));
+        if (new_data == NULL) {
+            return list_mem_error(list);
+        }
+        list->data = new_data;
     }
-
-    if (list->start > list->end) {
+    else {
+        void** new_data = a_malloc(list->arena, new_size * sizeof(void*));
+        if (new_data == NULL) {
+            return list_mem_error(list);
+        }
 
         // copy start index to array end
         memcpy(
@@ -166,26 +271,62 @@ int resize(List* list) {
             list->data, 
             list->end * sizeof(void*)
         );
-    }
-    else {
-        memcpy(
-            new_data, 
-            list->data + list->start, 
-            (list->end - list->start) * sizeof(void*)
-        );
+
+        // freeing list but not contents
+        a_free(list->arena, list->data);
+        list->data = new_data;
     }
 
-    // freeing list but not contents
-    free(list->data);
-    list->data = new_data;
     list->data_size = new_size;
+    list->mask = list_mask(new_size);
     list->start = 0;
     list->end = list->len;
 
-
     return 0;
 }
 
+/*
+    Grows the internal array of the list by the list's growth_factor.
+
+    returns 0 if successful
+*/
+int resize(List* list) {
+
+    size_t new_size = list->data_size * list->growth_factor;
+    if (new_size <= list->data_size) {
+        new_size = list->data_size + 1;
+    }
+
+    return resize_s(list, new_size);
+}
+
+/*
+    Shrinks the internal array of the list down to what it needs to hold
+    its current elements. Lists with a power of two array size are rounded
+    up to the next power of two so they keep using mask based wrapping.
+
+    This is a O(n) operation at worst, and is useful for long lived lists
+    that grew large once and now hold far fewer elements.
+*/
+void l_shrink_to_fit(List* list) {
+
+    size_t new_size = list->len + 1;
+    if (new_size < 2) {
+        new_size = 2;
+    }
+    if (list->mask) {
+        size_t p2 = 2;
+        while (p2 < new_size) {
+            p2 <<= 1;
+        }
+        new_size = p2;
+    }
+
+    if (new_size < list->data_size) {
+        resize_s(list, new_size);
+    }
+}
+
 
 
 
@@ -198,16 +339,22 @@ int resize(List* list) {
     can be passed in. This pointer will be stored 
     in the list. If this data is freed or goes out
     of scope, the list will be in a bad state.
+
+    returns 0 if successful
 */
-void l_push(List* list, void* data) {
+int l_push(List* list, void* data) {
     
     if (list->len == list->data_size - 1) {
-        resize(list);
+        if (resize(list) != 0) {
+            return 1;
+        }
     }
 
     list->data[list->end] = data;
-    list->end = (list->end + 1) % list->data_size;
+    list->end = l_wrap(list, list->end + 1);
     list->len = list->len + 1;
+
+    return 0;
 }
 
 /*
@@ -219,16 +366,22 @@ void l_push(List* list, void* data) {
     can be passed in. This pointer will be stored 
     in the list. If this data is freed or goes out
     of scope, the list will be in a bad state.
+
+    returns 0 if successful
 */
-void l_push_front(List* list, void* data) {
+int l_push_front(List* list, void* data) {
 
     if (list->len == list->data_size - 1) {
-        resize(list);
+        if (resize(list) != 0) {
+            return 1;
+        }
     }
 
-    list->start = (list->start - 1 + list->data_size) % list->data_size;
+    list->start = l_wrap(list, list->start - 1 + list->data_size);
     list->data[list->start] = data;
     list->len = list->len + 1;
+
+    return 0;
 }
 
 /*
@@ -250,7 +403,7 @@ void* l_pop(List* list) {
     }
 
 
-    list->end = (list->end - 1 + list->data_size) % list->data_size;
+    list->end = l_wrap(list, list->end - 1 + list->data_size);
     list->len = list->len - 1;
     void* data = list->data[list->end];
     list->data[list->end] = NULL;
@@ -278,7 +431,7 @@ void* l_pop_front(List* list) {
 
     void* data = list->data[list->start];
     list->data[list->start] = NULL;
-    list->start = (list->start + 1) % list->data_size;
+    list->start = l_wrap(list, list->start + 1);
     list->len = list->len - 1;
 
     return data;
@@ -289,11 +442,11 @@ void* l_pop_front(List* list) {
 static int convert_index(List* list, int index) {
 
 
-    while (index < 0) {
+    if (index < 0) {
         index += list->len;
     }
 
-    int in_bounds = index < list->len;
+    int in_bounds = index >= 0 && index < list->len;
     if (!in_bounds) {
         fprintf(stderr, "Index ");
         fprintf(stderr, "%d", index);
@@ -302,7 +455,7 @@ static int convert_index(List* list, int index) {
         exit(EXIT_FAILURE);
     }
     
-    return (list->start + index) % list->data_size;
+    return l_wrap(list, list->start + index);
 }
 
 
@@ -324,6 +477,22 @@ void l_set(List* list, int index, void* data) {
     list->data[real_index] = data;
 }
 
+/*
+    Same as l_get() but without negative index support or bounds
+    checking. Only use this when 'index' is known to be in [0, len).
+*/
+static inline void* l_get_unchecked(List* list, size_t index) {
+    return list->data[l_wrap(list, list->start + index)];
+}
+
+/*
+    Same as l_set() but without negative index support or bounds
+    checking. Only use this when 'index' is known to be in [0, len).
+*/
+static inline void l_set_unchecked(List* list, size_t index, void* data) {
+    list->data[l_wrap(list, list->start + index)] = data;
+}
+
 
 
 /*
@@ -333,7 +502,7 @@ void l_clear(List* list, int is_freeing_objects) {
     // Free each pointer inside data
     if (is_freeing_objects) {
         for (size_t i = 0; i < list->len; i++) {
-            free(l_get(list, i));
+            free(l_get_unchecked(list, i));
         }
     }
     list->len = 0;
@@ -347,9 +516,9 @@ void l_clear(List* list, int is_freeing_objects) {
 void free_list(List* list, int is_freeing_objects) {
     // Free data
     l_clear(list, is_freeing_objects);
-    free(list->data);
+    a_free(list->arena, list->data);
     // Free the struct itself
-    free(list);
+    a_free(list->arena, list);
 }
 
 
@@ -369,7 +538,7 @@ List* l_slice(List* list, int start, int end) {
         new_len = real_end - real_start;
     }
 
-    List* new_list = new_list_s(new_len * 2);
+    List* new_list = new_list_p2(new_len * 2);
 
     if (real_start > real_end) {
 
@@ -403,11 +572,347 @@ List* l_slice(List* list, int start, int end) {
 }
 
 
+/*
+    A view of a range of a list. Views don't copy anything, they just point
+    at a range of the list's internal array (wrapping around the ring buffer
+    if needed), so they're cheap to make and pass around by value.
+
+    A view is only valid until the list is resized or the elements in its
+    range are popped.
+
+    ```
+    ListView view = l_view(list, 1, 4);
+    for (size_t i = 0; i < view.len; ++i) {
+        int ele = *(int*) lv_get(view, i);
+    }
+    ```
+*/
+typedef struct ListView {
+    List* list;
+    size_t start; // index into the list's internal array
+    size_t len;
+} ListView;
+
+/*
+    Makes a view of the list from 'start' to 'end' (inclusive, exclusive).
+    Negative indices count back from the end of the list. O(1)
+*/
+ListView l_view(List* list, int start, int end) {
+    if (start < 0) start += list->len;
+    if (end < 0) end += list->len;
+    if (start < 0 || end > list->len || start > end) {
+        fprintf(stderr, "View ");
+        fprintf(stderr, "%d", start);
+        fprintf(stderr, " to ");
+        fprintf(stderr, "%d", end);
+        fprintf(stderr, " out of bounds for len ");
+        fprintf(stderr, "%zu", list->len);
+        exit(EXIT_FAILURE);
+    }
+
+    ListView view = {list, l_wrap(list, list->start + start), end - start};
+    return view;
+}
+
+/*
+    Gets the element at 'index' in the view. O(1)
+*/
+void* lv_get(ListView view, size_t index) {
+    if (index >= view.len) {
+        fprintf(stderr, "Index ");
+        fprintf(stderr, "%zu", index);
+        fprintf(stderr, " out of bounds for view len ");
+        fprintf(stderr, "%zu", view.len);
+        exit(EXIT_FAILURE);
+    }
+    return view.list->data[l_wrap(view.list, view.start + index)];
+}
+
+/*
+    Makes a view of part of another view (inclusive, exclusive). O(1)
+*/
+ListView lv_slice(ListView view, size_t start, size_t end) {
+    if (end > view.len) end = view.len;
+    if (start > end) start = end;
+    ListView slice = {view.list, l_wrap(view.list, view.start + start), end - start};
+    return slice;
+}
+
+
+
+static void l_reverse(void** data, size_t from, size_t to) {
+    while (from + 1 < to) {
+        --to;
+        void* tmp = data[from];
+        data[from] = data[to];
+        data[to] = tmp;
+        ++from;
+    }
+}
+
+/*
+    Moves the list's elements so they are all in a row at the start
+    of the internal array, without allocating a new array.
+
+    O(n) where n is the size of the internal array.
+*/
+void l_linearize(List* list) {
+
+    if (list->start <= list->end) {
+        if (list->start > 0) {
+            memmove(list->data, list->data + list->start, list->len * sizeof(void*));
+        }
+    }
+    else {
+        // rotate the whole array left by 'start', which puts the front half
+        // of the ring first, the back half second, and the unused gap last
+        l_reverse(list->data, 0, list->start);
+        l_reverse(list->data, list->start, list->data_size);
+        l_reverse(list->data, 0, list->data_size);
+    }
+
+    list->start = 0;
+    list->end = list->len;
+}
+
+
+
+// lists at least this long are sorted with l_sort_parallel() by l_sort()
+const size_t L_PARALLEL_SORT_THRESHOLD = 131072;
+
+typedef struct LSortTask {
+    void** src;
+    void** dst;
+    size_t from;
+    size_t mid;
+    size_t to;
+    int (* compar)(const void *, const void *);
+} LSortTask;
+
+static void* l_sort_run_task(void* arg) {
+    LSortTask* task = (LSortTask*) arg;
+    qsort(task->src + task->from, task->to - task->from, sizeof(void*), task->compar);
+    return NULL;
+}
+
+static void* l_merge_task(void* arg) {
+    LSortTask* task = (LSortTask*) arg;
+    size_t i = task->from;
+    size_t j = task->mid;
+    size_t k = task->from;
+    while (i < task->mid && j < task->to) {
+        if (task->compar(&task->src[j], &task->src[i]) < 0) {
+            task->dst[k++] = task->src[j++];
+        }
+        else {
+            task->dst[k++] = task->src[i++];
+        }
+    }
+    memcpy(task->dst + k, task->src + i, (task->mid - i) * sizeof(void*));
+    k += task->mid - i;
+    memcpy(task->dst + k, task->src + j, (task->to - j) * sizeof(void*));
+    return NULL;
+}
+
+/*
+    Sorts the list using 'num_threads' threads. The list is cut into one run
+    per thread, each run is sorted with qsort on its own thread, then the runs
+    are merged pairwise (each pair merge on its own thread) until one is left.
+
+    'num_threads' of 0 uses one thread per online cpu. Like qsort, the sort
+    isn't stable. Needs a temporary array the size of the list.
+*/
+void l_sort_parallel(List* list, int (* __compar)(const void *, const void *), size_t num_threads) {
+
+    l_linearize(list);
+
+    if (num_threads == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        num_threads = cpus > 0 ? cpus : 1;
+    }
+    if (num_threads > list->len / 2) {
+        num_threads = list->len / 2;
+    }
+    if (num_threads < 2) {
+        qsort(list->data, list->len, sizeof(void*), __compar);
+        return;
+    }
+
+    void** tmp = malloc(list->len * sizeof(void*));
+    LSortTask* tasks = malloc(num_threads * sizeof(LSortTask));
+    pthread_t* threads = malloc(num_threads * sizeof(pthread_t));
+    size_t* bounds = malloc((num_threads + 1) * sizeof(size_t));
+    int* started = malloc(num_threads * sizeof(int));
+    if (tmp == NULL || tasks == NULL || threads == NULL || bounds == NULL || started == NULL) {
+        free(tmp);
+        free(tasks);
+        free(threads);
+        free(bounds);
+        free(started);
+        list_mem_error_exit_failing();
+    }
+
+    // sort runs
+    size_t runs = num_threads;
+    for (size_t r = 0; r <= runs; ++r) {
+        bounds[r] = list->len * r / runs;
+    }
+    for (size_t r = 0; r < runs; ++r) {
+        tasks[r] = (LSortTask) {list->data, NULL, bounds[r], 0, bounds[r + 1], __compar};
+
+        // a run whose thread can't be started is sorted on this one
+        started[r] = pthread_create(&threads[r], NULL, l_sort_run_task, &tasks[r]) == 0;
+        if (!started[r]) {
+            l_sort_run_task(&tasks[r]);
+        }
+    }
+    for (size_t r = 0; r < runs; ++r) {
+        if (started[r]) {
+            pthread_join(threads[r], NULL);
+        }
+    }
+
+    // merge runs pairwise, bouncing between the list array and tmp
+    void** src = list->data;
+    void** dst = tmp;
+    while (runs > 1) {
+        size_t merges = runs / 2;
+        for (size_t m = 0; m < merges; ++m) {
+            tasks[m] = (LSortTask) {src, dst, bounds[2*m], bounds[2*m + 1], bounds[2*m + 2], __compar};
+            started[m] = pthread_create(&threads[m], NULL, l_merge_task, &tasks[m]) == 0;
+            if (!started[m]) {
+                l_merge_task(&tasks[m]);
+            }
+        }
+        // odd run out is just copied across
+        if (runs % 2 == 1) {
+            memcpy(dst + bounds[runs - 1], src + bounds[runs - 1], (bounds[runs] - bounds[runs - 1]) * sizeof(void*));
+        }
+        for (size_t m = 0; m < merges; ++m) {
+            if (started[m]) {
+                pthread_join(threads[m], NULL);
+            }
+        }
+
+        size_t new_runs = 0;
+        for (size_t r = 0; r < runs; r += 2) {
+            bounds[new_runs++] = bounds[r];
+        }
+        bounds[new_runs] = list->len;
+        runs = new_runs;
+
+        void** swap = src;
+        src = dst;
+        dst = swap;
+    }
+
+    if (src != list->data) {
+        memcpy(list->data, src, list->len * sizeof(void*));
+    }
+
+    free(tmp);
+    free(tasks);
+    free(threads);
+    free(bounds);
+    free(started);
+}
+
+/*
+    Sorts the list with the given comparator (the same kind qsort takes,
+    so it receives pointers to the list's pointers). Sorts in place without
+    reallocating the list, and uses l_sort_parallel() for large lists.
+*/
 void l_sort(List* list, int (* __compar)(const void *, const void *)) {
-    resize(list); // get list data all in a row
+    if (list->len >= L_PARALLEL_SORT_THRESHOLD) {
+        l_sort_parallel(list, __compar, 0);
+        return;
+    }
+    l_linearize(list); // get list data all in a row
     qsort(list->data, list->len, sizeof(void*),  __compar);
 }
 
 
 
+static void l_str_insertion_sort(char** strs, size_t len, size_t depth) {
+    for (size_t i = 1; i < len; ++i) {
+        char* s = strs[i];
+        size_t j = i;
+        while (j > 0 && strcmp(strs[j - 1] + depth, s + depth) > 0) {
+            strs[j] = strs[j - 1];
+            --j;
+        }
+        strs[j] = s;
+    }
+}
+
+static void l_str_radix_sort(char** strs, char** aux, size_t len, size_t depth) {
+
+    if (len < 32) {
+        l_str_insertion_sort(strs, len, depth);
+        return;
+    }
+
+    // bucket 0 holds strings that end at this depth
+    size_t counts[256];
+    int shared_char = 1;
+    while (shared_char) {
+        memset(counts, 0, sizeof(counts));
+        for (size_t i = 0; i < len; ++i) {
+            ++counts[(unsigned char) strs[i][depth]];
+        }
+
+        // skip over prefixes every string shares without recursing
+        unsigned char first = (unsigned char) strs[0][depth];
+        shared_char = first != 0 && counts[first] == len;
+        if (shared_char) {
+            ++depth;
+        }
+    }
+
+    size_t starts[256];
+    size_t total = 0;
+    for (int b = 0; b < 256; ++b) {
+        starts[b] = total;
+        total += counts[b];
+    }
+
+    size_t next[256];
+    memcpy(next, starts, sizeof(next));
+    for (size_t i = 0; i < len; ++i) {
+        aux[next[(unsigned char) strs[i][depth]]++] = strs[i];
+    }
+    memcpy(strs, aux, len * sizeof(char*));
+
+    // strings that ended are equal, recurse into the rest
+    for (int b = 1; b < 256; ++b) {
+        if (counts[b] > 1) {
+            l_str_radix_sort(strs + starts[b], aux, counts[b], depth + 1);
+        }
+    }
+}
+
+/*
+    Sorts a list of char* (null terminated strings) in strcmp order using
+    an MSD radix sort, which only looks at each character about once instead
+    of comparing whole strings against each other like qsort does.
+
+    Sorts in place without reallocating the list. Needs a temporary array
+    the size of the list.
+*/
+void l_sort_str(List* list) {
+    l_linearize(list);
+    if (list->len < 2) {
+        return;
+    }
+
+    char** aux = malloc(list->len * sizeof(char*));
+    if (aux == NULL) {
+        list_mem_error_exit_failing();
+    }
+    l_str_radix_sort((char**) list->data, aux, list->len, 0);
+    free(aux);
+}
+
+
+
 #endif
\ No newline at end of file
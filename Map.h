@@ -1,6 +1,8 @@
 #ifndef MAP
 #define MAP
 
+#include "Pool.h"
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -87,6 +89,10 @@ typedef struct Element {
     The map returns NULL if a value is not in the map instead of exiting the program
     or something.
 
+    Maps made with new_map_in() keep their table, elements and key copies in an
+    arena (see Arena.h), and the put and unique methods return 1 instead of
+    exiting if the arena runs out, leaving the map as it was.
+
 
 
     # METHODS
@@ -99,6 +105,7 @@ typedef struct Element {
     - clear_map() -> O(n)
     - map_elements() -> O(n)
     - m_contains() m_int_contains() m_any_contains() -> O(1) amoritized
+    - m_reserve() -> O(n)
 
 
 
@@ -111,6 +118,13 @@ typedef struct Element {
     When the hash table is 70% full we do a resize, using the next prime table size
     in a predefined primes list.
 
+    Erased elements leave a tombstone behind so probing for elements placed after
+    them still works. Tombstones count towards the 70%, and a table that's full
+    mostly because of them is rebuilt at the same size instead of grown.
+
+    Elements and key copies come from the size class pools in Pool.h, so steady
+    inserting and erasing doesn't call malloc or free.
+
 
 
 */
@@ -118,10 +132,17 @@ typedef struct Map {
     Element** data; // pointer to array of pointers
     size_t data_size;
     size_t len;
+    size_t deleted; // tombstones left by erased elements
+
+    Arena* arena; // where the map's memory comes from, or NULL for the heap
 } Map;
 
 const char* DELETED_KEY = "<DELETED>";
 
+// the tombstone left where an element was erased (its key size never
+// matches a real key)
+static Element MAP_DELETED_ELEMENT = {"<DELETED>", (size_t) -1, NULL};
+
 const size_t PRIMES[] = {
     127,
     257,
@@ -173,17 +194,37 @@ static void map_mem_error_exit_failing() {
 }
 
 
-static Map* new_map_s(size_t size) {
+/*
+    Maps in an arena report running out of memory, maps on the heap exit.
+    returns 1 (an error)
+*/
+static int map_mem_error(Map* map) {
+    if (map->arena == NULL) {
+        map_mem_error_exit_failing();
+    }
+    return 1;
+}
+
 
-    Map *map = malloc(sizeof(Map));
+static Map* new_map_s(Arena* arena, size_t size) {
+
+    Map *map = a_malloc(arena, sizeof(Map));
     if (map == NULL) {
+        if (arena != NULL) {
+            return NULL;
+        }
         map_mem_error_exit_failing();
     }
-    map->data = malloc(size * sizeof(void*));
+    map->data = a_malloc(arena, size * sizeof(void*));
     if (map->data == NULL) {
-        free(map);
+        a_free(arena, map);
+        if (arena != NULL) {
+            return NULL;
+        }
         map_mem_error_exit_failing();
     }
+    map->arena = arena;
+    map->deleted = 0;
     map->data_size = size;
     for (int i = 0; i < size; ++i) {
         map->data[i] = NULL;
@@ -197,7 +238,15 @@ static Map* new_map_s(size_t size) {
     Creates an empty map
 */
 Map* new_map() {
-    return new_map_s(PRIMES[0]);
+    return new_map_s(NULL, PRIMES[0]);
+}
+
+/*
+    Creates an empty map whose memory comes from 'arena' (see Arena.h).
+    Returns NULL if the arena is out of memory.
+*/
+Map* new_map_in(Arena* arena) {
+    return new_map_s(arena, PRIMES[0]);
 }
 
 /*
@@ -287,15 +336,15 @@ static size_t probe(Map* map, void* key, size_t key_size, int* hash_collisions)
 
 static void free_map_data(Map* map, int is_freeing_objects) {
     for (size_t i = 0; i < map->data_size; ++i) {
-        if (map->data[i] != NULL) {
-            free( map->data[i]->key);
+        if (map->data[i] != NULL && map->data[i] != &MAP_DELETED_ELEMENT) {
+            a_pool_free(map->arena, map->data[i]->key, map->data[i]->key_size);
             if (is_freeing_objects) {
                 free(map->data[i]->data);
             }
-            free( map->data[i]);
+            a_pool_free(map->arena, map->data[i], sizeof(Element));
         }
     }
-    free(map->data);
+    a_free(map->arena, map->data);
 }
 
 /*
@@ -303,11 +352,14 @@ static void free_map_data(Map* map, int is_freeing_objects) {
 */
 void free_map(Map* map, int is_freeing_objects) {
     free_map_data(map, is_freeing_objects);
-    free(map);
+    a_free(map->arena, map);
 }
 
 
-static void insert_no_resize(Map* map, void* key, size_t key_size, void* data, size_t data_size) {
+/*
+    returns 0 if successful
+*/
+static int insert_no_resize(Map* map, void* key, size_t key_size, void* data, size_t data_size) {
     int hash_collisions = 0;
     size_t index = probe(map, key, key_size, &hash_collisions);
 
@@ -316,16 +368,17 @@ static void insert_no_resize(Map* map, void* key, size_t key_size, void* data, s
     if (map->data[index] == NULL) {
 
         // copy the key
-        char* key_copy = malloc(key_size);
+        char* key_copy = a_pool_alloc(map->arena, key_size);
         if (key_copy == NULL) {
-            map_mem_error_exit_failing();
+            return map_mem_error(map);
         }
         memcpy(key_copy, key, key_size);
 
         // make a new element
-        Element *element = malloc(sizeof(Element));
+        Element *element = a_pool_alloc(map->arena, sizeof(Element));
         if (element == NULL) {
-            map_mem_error_exit_failing();
+            a_pool_free(map->arena, key_copy, key_size);
+            return map_mem_error(map);
         }
         element->key = key_copy;
         element->key_size = key_size;
@@ -345,52 +398,93 @@ static void insert_no_resize(Map* map, void* key, size_t key_size, void* data, s
 
     }
 
+    return 0;
+}
+
+/*
+    moves every element into a new table of 'new_table_size'
+    returns 0 if successful, otherwise the map is left as it was
+*/
+static int rehash_map(Map* map, size_t new_table_size) {
+
+    // make new table and move each element over (the elements and
+    // their keys are reused, not copied)
+    Map* new_map = new_map_s(map->arena, new_table_size);
+    if (new_map == NULL) {
+        return 1;
+    }
+    for (size_t i = 0; i < map->data_size; ++i) {
+        Element* element = map->data[i];
+        if (element != NULL && element != &MAP_DELETED_ELEMENT) {
+            int hash_collisions = 0;
+            size_t index = probe(new_map, element->key, element->key_size, &hash_collisions);
+            new_map->data[index] = element;
+        }
+    }
+
+    a_free(map->arena, map->data);
+    map->data = new_map->data;
+    map->data_size = new_map->data_size;
+    map->deleted = 0;
+
+    a_free(map->arena, new_map);
 
+    return 0;
 }
 
-static void resize_map(Map* map) {
+/*
+    returns 0 if successful, otherwise the map is left as it was
+*/
+static int resize_map(Map* map) {
     size_t NUM_PRIMES = sizeof(PRIMES) / sizeof(PRIMES[0]);
 
-    // get next table size
-    size_t new_table_size = PRIMES[0];
-    for (int i = 0; i < NUM_PRIMES; ++i) {
-        if (PRIMES[i] > map->data_size) {
-            new_table_size = PRIMES[i];
-            break;
+    // get next table size, or keep the size if the table is mostly
+    // tombstones and just needs rebuilding
+    size_t new_table_size = map->data_size;
+    if (map->data_size * 0.35 < map->len + 1) {
+        new_table_size = PRIMES[0];
+        for (int i = 0; i < NUM_PRIMES; ++i) {
+            if (PRIMES[i] > map->data_size) {
+                new_table_size = PRIMES[i];
+                break;
+            }
         }
     }
 
-    // make new table and insert each element
-    size_t DELETED_KEY_SIZE = strlen(DELETED_KEY) + 1;
-    Map* new_map = new_map_s(new_table_size);
-    for (size_t i = 0; i < map->data_size; ++i) {
+    return rehash_map(map, new_table_size);
+}
 
-        // if an element insert into new map
-        if (map->data[i] != NULL) {
+/*
+    Grows the table so 'len' elements in total fit without any more
+    resizes, for when it's known ahead of time how many elements are
+    coming (loading a table for example).
 
-            // check if deleted
-            int deleted = 0;
-            if (map->data[i]->key_size == DELETED_KEY_SIZE) {
-                if (strcmp(map->data[i]->key, DELETED_KEY) == 0) {
-                    deleted = 1;
-                }
-            }
+    returns 0 if successful, otherwise the map is left as it was
+*/
+int m_reserve(Map* map, size_t len) {
+    size_t NUM_PRIMES = sizeof(PRIMES) / sizeof(PRIMES[0]);
 
-            // an element insert into map
-            if (!deleted) {
-                Element* element = map->data[i];
-                insert_no_resize(new_map, element->key, element->key_size, element->data, -1);
+    for (int i = 0; i < NUM_PRIMES; ++i) {
+        if (PRIMES[i] * 0.7 >= len + 1) {
+            if (PRIMES[i] <= map->data_size) {
+                return 0;
             }
+            return rehash_map(map, PRIMES[i]);
         }
     }
+    return map_mem_error(map);
+}
 
-    free_map_data(map, 0);
-    map->data = new_map->data;
-    map->data_size = new_map->data_size;
-    map->len = new_map->len;
-
-    new_map->data = NULL; // so it won't free the data array copied above
-    free(new_map);
+/*
+    grows the table first if adding an element would make it too full,
+    so a failed resize leaves the map unchanged
+    returns 0 if successful
+*/
+static int resize_map_for_insert(Map* map) {
+    if (map->data_size * 0.7 < map->len + map->deleted + 1) {
+        return resize_map(map);
+    }
+    return 0;
 }
 
 
@@ -411,15 +505,16 @@ static void resize_map(Map* map) {
     Use the insert methods to overwrite object, or simply retrieve objects
     and modify them.
 
+    returns 0 if successful
 */
-void m_any_unique(Map* map, void* key, size_t key_size, void* data) {
-
-    insert_no_resize(map, key, key_size, data, -1);
+int m_any_unique(Map* map, void* key, size_t key_size, void* data) {
 
     // resize if neeeded
-    if (map->data_size * 0.7 < map->len) {
-        resize_map(map);
+    if (resize_map_for_insert(map) != 0) {
+        return 1;
     }
+
+    return insert_no_resize(map, key, key_size, data, -1);
 }
 
 /*
@@ -430,8 +525,8 @@ void m_any_unique(Map* map, void* key, size_t key_size, void* data) {
     Use the insert methods to overwrite object, or simply retrieve objects
     and modify them.
 */
-void m_int_unique(Map* map, int key, void* data) {
-    m_any_unique(map, &key, sizeof(int), data);
+int m_int_unique(Map* map, int key, void* data) {
+    return m_any_unique(map, &key, sizeof(int), data);
 }
 
 /*
@@ -442,8 +537,8 @@ void m_int_unique(Map* map, int key, void* data) {
     Use the insert methods to overwrite object, or simply retrieve objects
     and modify them.
 */
-void m_unique(Map* map, char* key, void* data) {
-    m_any_unique(map, key, (strlen(key) + 1) * sizeof(char), data);
+int m_unique(Map* map, char* key, void* data) {
+    return m_any_unique(map, key, (strlen(key) + 1) * sizeof(char), data);
 }
 
 
@@ -459,22 +554,23 @@ void m_unique(Map* map, char* key, void* data) {
     m_any_put(map, &key, sizeof(key), &object, sizeof(object));
     ```
 
+    returns 0 if successful
 */
-void m_any_put(Map* map, void* key, size_t key_size, void* data, size_t data_size) {
-
-    insert_no_resize(map, key, key_size, data, data_size);
+int m_any_put(Map* map, void* key, size_t key_size, void* data, size_t data_size) {
 
     // resize if neeeded
-    if (map->data_size * 0.7 < map->len) {
-        resize_map(map);
+    if (resize_map_for_insert(map) != 0) {
+        return 1;
     }
+
+    return insert_no_resize(map, key, key_size, data, data_size);
 }
 
 /*
     Function to insert an object in the map using an int as the key.
 */
-void m_int_put(Map* map, int key, void* data, size_t data_size) {
-    m_any_put(map, &key, sizeof(int), data, data_size);
+int m_int_put(Map* map, int key, void* data, size_t data_size) {
+    return m_any_put(map, &key, sizeof(int), data, data_size);
 }
 
 /*
@@ -483,8 +579,8 @@ void m_int_put(Map* map, int key, void* data, size_t data_size) {
     The key is copied so the key passed in can be freed before the map
     if needed. (the key copy is freed by the free_map() function)
 */
-void m_put(Map* map, char* key, void* data, size_t data_size) {
-    m_any_put(map, key, (strlen(key) + 1) * sizeof(char), data, data_size);
+int m_put(Map* map, char* key, void* data, size_t data_size) {
+    return m_any_put(map, key, (strlen(key) + 1) * sizeof(char), data, data_size);
 }
 
 
@@ -550,27 +646,14 @@ void* m_any_m_erase(Map* map, void* key, size_t key_size) {
 
     void* data = map->data[index]->data;
     Element* element = map->data[index];
-    free(element->key);
-    free(element);
-
-    if (hash_collisions != 0) {
+    a_pool_free(map->arena, element->key, element->key_size);
+    a_pool_free(map->arena, element, sizeof(Element));
 
-        // make deleted key
-        size_t DELETED_KEY_SIZE = strlen(DELETED_KEY) + 1;
-        char deleted_key_copy[DELETED_KEY_SIZE];
-        strcpy(deleted_key_copy, DELETED_KEY);
-
-        // set as deleted
-        map->data[index]->key = deleted_key_copy;
-        map->data[index]->key_size = DELETED_KEY_SIZE;
-        map->data[index]->data = NULL;
-
-        --map->len;
-    }
-    else {
-        map->data[index] = NULL;
-        --map->len;
-    }
+    // set as deleted (other elements may have probed past this one, so
+    // the slot can't just be emptied)
+    map->data[index] = &MAP_DELETED_ELEMENT;
+    ++map->deleted;
+    --map->len;
 
     return data;
 }
@@ -608,21 +691,10 @@ Element** map_elements(Map* map) {
     Element** array = malloc(map->len * sizeof(Element));
 
     int l = 0;
-    size_t DELETED_KEY_SIZE = strlen(DELETED_KEY) + 1;
     for (size_t i = 0; i < map->data_size; ++i) {
-        if (map->data[i] != NULL) {
-            
-            int deleted = 0;
-            if (map->data[i]->key_size == DELETED_KEY_SIZE) {
-                if (strcmp(map->data[i]->key, DELETED_KEY) == 0) {
-                    deleted = 1;
-                }
-            }
-
-            if(!deleted) {
-                array[l] = map->data[i];
-                ++l;
-            }
+        if (map->data[i] != NULL && map->data[i] != &MAP_DELETED_ELEMENT) {
+            array[l] = map->data[i];
+            ++l;
         }
     }
 
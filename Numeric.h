@@ -0,0 +1,436 @@
+#ifndef NUMERIC
+#define NUMERIC
+
+#include "String.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+
+
+/*
+    Number parsing and formatting for CSV cells, working directly on
+    StringViews so nothing has to be copied or null terminated first, and
+    nothing is allocated.
+
+    ```
+    long likes;
+    if (sv_to_long(sv("5723409234"), &likes) == 0 && likes > 10) {
+        ...
+    }
+
+    double price;
+    sv_to_double(sv("19.99"), &price);
+
+    char buffer[NUMERIC_BUFFER_SIZE];
+    format_double(0.1 + 0.2, buffer); // "0.30000000000000004"
+    append_long(ss, likes);
+    ```
+
+    The parsers accept the whole view or nothing: an optional sign, digits,
+    and for doubles an optional fraction and exponent. Anything else
+    (spaces, trailing characters, an empty view, overflow) fails with 1 and
+    leaves 'out' alone.
+
+    format_double() writes the shortest digits that parse back to exactly
+    the same double, so numbers survive a round trip through a CSV file.
+
+
+
+    # DESIGN
+
+    Integers are parsed 8 digits at a time by loading them into one 64 bit
+    word and checking and combining all 8 with a few multiplies (SWAR, SIMD
+    within a register), which is faster than the usual digit by digit loop
+    for the long ids and counts found in CSV files.
+
+    Most doubles in CSV files have few significant digits (prices, ratios,
+    coordinates), and for those the digits and the power of ten are both
+    exact doubles, so one multiply or divide gives the correctly rounded
+    result. Only the rare number that doesn't fit this falls back to
+    strtod(). Formatting uses the same fact in reverse, trying more and more
+    decimal places until the digits read back as the same double.
+
+*/
+
+
+// big enough for any number from format_long() or format_double()
+#define NUMERIC_BUFFER_SIZE 32
+
+
+static const double n_powers_of_ten[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+// largest integer every smaller integer can be stored exactly in a double
+const uint64_t N_MAX_EXACT_INT = (uint64_t) 1 << 53;
+
+
+
+static void numeric_mem_error_exit_failing() {
+    fprintf(stderr, "Numeric couldn't get more memory on the system! Exiting...");
+    exit(EXIT_FAILURE);
+}
+
+
+static inline int n_is_digit(char c) {
+    return (unsigned char) (c - '0') < 10;
+}
+
+/*
+    returns 1 if all 8 bytes of 'chunk' are '0' to '9'
+*/
+static inline int n_is_eight_digits(uint64_t chunk) {
+    return ((chunk & 0xF0F0F0F0F0F0F0F0) | (((chunk + 0x0606060606060606) & 0xF0F0F0F0F0F0F0F0) >> 4)) == 0x3333333333333333;
+}
+
+/*
+    turns 8 digit characters loaded little endian into their value
+*/
+static inline uint64_t n_parse_eight_digits(uint64_t chunk) {
+    chunk -= 0x3030303030303030;
+    chunk = (chunk * 10) + (chunk >> 8); // pairs of digits
+    return (((chunk & 0x000000FF000000FF) * 0x000F424000000064) +
+            (((chunk >> 16) & 0x000000FF000000FF) * 0x0000271000000001)) >> 32;
+}
+
+/*
+    reads digits starting at 'ptr' into 'value', stopping at 'end' or the
+    first non digit. Returns a pointer to where it stopped. 'num_digits'
+    counts the significant digits in 'value' (leading zeros don't count),
+    and digits past the first 19 significant ones are counted in 'dropped'
+    instead of being added to 'value' so it can't overflow.
+*/
+static char* n_read_digits(char* ptr, char* end, uint64_t* value, size_t* num_digits, size_t* dropped) {
+    uint64_t v = *value;
+    size_t n = *num_digits;
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    while (end - ptr >= 8 && n + 8 <= 19) {
+        uint64_t chunk;
+        memcpy(&chunk, ptr, 8);
+        if (!n_is_eight_digits(chunk)) {
+            break;
+        }
+        v = v * 100000000 + n_parse_eight_digits(chunk);
+        if (n > 0) {
+            n += 8;
+        }
+        else {
+            for (uint64_t rest = v; rest > 0; rest /= 10) {
+                ++n;
+            }
+        }
+        ptr += 8;
+    }
+#endif
+
+    while (ptr < end && n_is_digit(*ptr)) {
+        if (n < 19) {
+            v = v * 10 + (*ptr - '0');
+            if (v != 0) {
+                ++n;
+            }
+        }
+        else {
+            ++*dropped;
+        }
+        ++ptr;
+    }
+
+    *value = v;
+    *num_digits = n;
+    return ptr;
+}
+
+
+
+/*
+    Parses the whole view as a base 10 integer with an optional sign.
+    Returns 0 and sets 'out' if successful, or 1 if the view isn't an
+    integer or doesn't fit in a long.
+*/
+int sv_to_long(StringView view, long* out) {
+    char* ptr = view.ptr;
+    char* end = view.ptr + view.len;
+
+    int negative = 0;
+    if (ptr < end && (*ptr == '-' || *ptr == '+')) {
+        negative = *ptr == '-';
+        ++ptr;
+    }
+    if (ptr == end) {
+        return 1;
+    }
+
+    uint64_t value = 0;
+    size_t num_digits = 0;
+    size_t dropped = 0;
+    if (n_read_digits(ptr, end, &value, &num_digits, &dropped) != end || dropped > 0) {
+        return 1;
+    }
+
+    uint64_t limit = negative ? (uint64_t) LONG_MAX + 1 : (uint64_t) LONG_MAX;
+    if (value > limit) {
+        return 1;
+    }
+
+    *out = negative ? (long) (0 - value) : (long) value;
+    return 0;
+}
+
+/*
+    Parses the whole view as a double, like "12", "-0.5", "1e-3" or
+    "inf". Returns 0 and sets 'out' if successful, or 1 if the view isn't
+    a number.
+*/
+int sv_to_double(StringView view, double* out) {
+    char* ptr = view.ptr;
+    char* end = view.ptr + view.len;
+
+    int negative = 0;
+    if (ptr < end && (*ptr == '-' || *ptr == '+')) {
+        negative = *ptr == '-';
+        ++ptr;
+    }
+
+    uint64_t mantissa = 0;
+    size_t num_digits = 0;
+    size_t dropped = 0;
+    char* digits_start = ptr;
+    ptr = n_read_digits(ptr, end, &mantissa, &num_digits, &dropped);
+    long exponent = dropped;
+    int has_digits = ptr != digits_start;
+
+    if (ptr < end && *ptr == '.') {
+        ++ptr;
+        char* fraction_start = ptr;
+        size_t fraction_dropped = 0;
+        ptr = n_read_digits(ptr, end, &mantissa, &num_digits, &fraction_dropped);
+        has_digits |= ptr != fraction_start;
+
+        // every fraction digit kept in the mantissa moves the point left
+        exponent -= (ptr - fraction_start) - fraction_dropped;
+        dropped += fraction_dropped;
+    }
+
+    if (has_digits && ptr < end && (*ptr == 'e' || *ptr == 'E')) {
+        char* exponent_start = ptr;
+        ++ptr;
+        int exponent_negative = 0;
+        if (ptr < end && (*ptr == '-' || *ptr == '+')) {
+            exponent_negative = *ptr == '-';
+            ++ptr;
+        }
+        if (ptr == end || !n_is_digit(*ptr)) {
+            ptr = exponent_start; // not an exponent, so the view doesn't parse
+        }
+        else {
+            long e = 0;
+            while (ptr < end && n_is_digit(*ptr)) {
+                if (e < 100000) {
+                    e = e * 10 + (*ptr - '0');
+                }
+                ++ptr;
+            }
+            exponent += exponent_negative ? -e : e;
+        }
+    }
+
+    // fast path, exact digits times an exact power of ten
+    if (has_digits && ptr == end && dropped == 0 && mantissa <= N_MAX_EXACT_INT && exponent >= -22 && exponent <= 22) {
+        double value = (double) mantissa;
+        if (exponent < 0) {
+            value /= n_powers_of_ten[-exponent];
+        }
+        else {
+            value *= n_powers_of_ten[exponent];
+        }
+        *out = negative ? -value : value;
+        return 0;
+    }
+
+    // slow path for long, tiny or huge numbers, and inf/nan
+    if (has_digits ? ptr != end : ptr == end || (*ptr != 'i' && *ptr != 'I' && *ptr != 'n' && *ptr != 'N')) {
+        return 1;
+    }
+
+    char small[64];
+    char* copy = small;
+    if (view.len >= sizeof(small)) {
+        copy = malloc(view.len + 1);
+        if (copy == NULL) {
+            numeric_mem_error_exit_failing();
+        }
+    }
+    memcpy(copy, view.ptr, view.len);
+    copy[view.len] = '\0';
+
+    char* parsed_end;
+    double value = strtod(copy, &parsed_end);
+    int failed = parsed_end != copy + view.len;
+
+    if (copy != small) {
+        free(copy);
+    }
+    if (failed) {
+        return 1;
+    }
+    *out = value;
+    return 0;
+}
+
+
+
+static const char n_digit_pairs[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+/*
+    writes the digits of 'value' into 'buffer' (without a null terminator),
+    returning how many were written
+*/
+static size_t n_format_u64(uint64_t value, char* buffer) {
+    char digits[20];
+    char* ptr = digits + sizeof(digits);
+
+    // two digits at a time
+    while (value >= 100) {
+        size_t pair = (value % 100) * 2;
+        value /= 100;
+        ptr -= 2;
+        memcpy(ptr, n_digit_pairs + pair, 2);
+    }
+    if (value >= 10) {
+        ptr -= 2;
+        memcpy(ptr, n_digit_pairs + value * 2, 2);
+    }
+    else {
+        *--ptr = '0' + value;
+    }
+
+    size_t len = digits + sizeof(digits) - ptr;
+    memcpy(buffer, ptr, len);
+    return len;
+}
+
+/*
+    Writes 'value' as a null terminated string into 'buffer', which needs
+    to hold at least NUMERIC_BUFFER_SIZE characters. Returns the length
+    written (not counting the null terminator).
+*/
+size_t format_long(long value, char* buffer) {
+    size_t len = 0;
+    uint64_t magnitude = value;
+    if (value < 0) {
+        buffer[len++] = '-';
+        magnitude = 0 - magnitude;
+    }
+    len += n_format_u64(magnitude, buffer + len);
+    buffer[len] = '\0';
+    return len;
+}
+
+/*
+    Writes the shortest decimal that parses back to exactly 'value' as a
+    null terminated string into 'buffer', which needs to hold at least
+    NUMERIC_BUFFER_SIZE characters. Returns the length written (not
+    counting the null terminator).
+*/
+size_t format_double(double value, char* buffer) {
+
+    if (value != value || value - value != 0) { // nan or inf
+        return snprintf(buffer, NUMERIC_BUFFER_SIZE, "%g", value);
+    }
+
+    size_t len = 0;
+    if (value < 0 || (value == 0 && 1 / value < 0)) {
+        buffer[len++] = '-';
+        value = -value;
+    }
+
+    // fast path, find the fewest decimal places that round trip exactly
+    for (size_t places = 0; places <= 17; ++places) {
+        double scaled = value * n_powers_of_ten[places];
+        if (scaled >= N_MAX_EXACT_INT) {
+            break;
+        }
+        uint64_t digits = (uint64_t) (scaled + 0.5);
+        if ((double) digits / n_powers_of_ten[places] != value) {
+            continue;
+        }
+
+        char integer[20];
+        size_t num_digits = n_format_u64(digits, integer);
+        if (places == 0) {
+            memcpy(buffer + len, integer, num_digits);
+            len += num_digits;
+        }
+        else {
+            // put the point 'places' digits from the right, padding with zeros
+            if (num_digits <= places) {
+                buffer[len++] = '0';
+                buffer[len++] = '.';
+                memset(buffer + len, '0', places - num_digits);
+                len += places - num_digits;
+                memcpy(buffer + len, integer, num_digits);
+                len += num_digits;
+            }
+            else {
+                memcpy(buffer + len, integer, num_digits - places);
+                len += num_digits - places;
+                buffer[len++] = '.';
+                memcpy(buffer + len, integer + num_digits - places, places);
+                len += places;
+            }
+        }
+        buffer[len] = '\0';
+        return len;
+    }
+
+    // slow path for big, tiny or long numbers
+    for (int precision = 15; precision <= 17; ++precision) {
+        size_t n = snprintf(buffer + len, NUMERIC_BUFFER_SIZE - len, "%.*g", precision, value);
+        if (precision == 17 || strtod(buffer + len, NULL) == value) {
+            return len + n;
+        }
+    }
+    return len;
+}
+
+
+
+/*
+    Appends 'value' in base 10 to the end of the string.
+    returns 0 if successful
+*/
+int append_long(String* stream, long value) {
+    char buffer[NUMERIC_BUFFER_SIZE];
+    size_t len = format_long(value, buffer);
+    return append_n(stream, buffer, len);
+}
+
+/*
+    Appends the shortest decimal that parses back to exactly 'value' to
+    the end of the string. returns 0 if successful
+*/
+int append_double(String* stream, double value) {
+    char buffer[NUMERIC_BUFFER_SIZE];
+    size_t len = format_double(value, buffer);
+    return append_n(stream, buffer, len);
+}
+
+
+
+#endif
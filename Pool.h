@@ -0,0 +1,260 @@
+#ifndef POOL
+#define POOL
+
+#include "Arena.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+
+/*
+    Pools of small fixed size objects, used by Map (elements and key
+    copies), Set (items) and CsvDb (rows) instead of calling malloc and free
+    for every one.
+
+    Each thread has a free list per size class (every multiple of 16 bytes
+    up to POOL_MAX_SIZE). pool_free() pushes an object onto its class's free
+    list and pool_alloc() pops one off, so once a program has warmed up,
+    inserting and deleting doesn't call malloc or free at all. New objects
+    are cut from 64KB slabs, which keeps same sized objects packed together
+    instead of scattered across the heap.
+
+    ```
+    Element* element = pool_alloc(sizeof(Element));
+    ...
+    pool_free(element, sizeof(Element)); // the size must match pool_alloc()
+    ```
+
+    Objects bigger than POOL_MAX_SIZE go straight to malloc and free.
+
+    Memory given back to a pool stays with the pool for reuse and is never
+    returned to the system, so pools suit objects that are made and thrown
+    away over and over, not one off spikes. An object can be freed on a
+    different thread than the one that allocated it, it just ends up on the
+    freeing thread's free list.
+
+    A thread that's about to exit should call pool_thread_release(), which
+    hands its free lists and the rest of its slab over to the other
+    threads, as objects from its slabs (rows it loaded, say) can outlive it.
+
+    pool_stats() shows what the calling thread's pools have done.
+
+    Compile with -DPOOL_USE_MALLOC to turn the pools off (every call goes
+    to malloc and free), which helps tools like AddressSanitizer and
+    valgrind find use after free bugs.
+
+*/
+typedef struct PoolStats {
+    size_t allocs; // objects handed out
+    size_t frees; // objects given back
+    size_t reused; // allocations served from a free list
+    size_t large; // allocations too big for the pools (passed to malloc)
+    size_t slabs; // slabs malloc'd
+    size_t slab_bytes;
+} PoolStats;
+
+
+#define POOL_MAX_SIZE 256
+#define POOL_NUM_CLASSES (POOL_MAX_SIZE / 16)
+
+const size_t POOL_SLAB_SIZE = 65536;
+
+
+typedef struct PoolFreeObject {
+    struct PoolFreeObject* next;
+} PoolFreeObject;
+
+static _Thread_local PoolFreeObject* pool_free_lists[POOL_NUM_CLASSES];
+static _Thread_local char* pool_slab; // unused part of the current slab
+static _Thread_local size_t pool_slab_left;
+static _Thread_local PoolStats pool_thread_stats;
+
+// what exited threads left behind (see pool_thread_release()), taken up by
+// threads before they malloc a new slab. Unused slab ends are kept as a list
+// of PoolSlabEnds.
+typedef struct PoolSlabEnd {
+    struct PoolSlabEnd* next;
+    size_t size;
+} PoolSlabEnd;
+
+static PoolFreeObject* pool_released_lists[POOL_NUM_CLASSES];
+static PoolSlabEnd* pool_released_slab_ends;
+static pthread_mutex_t pool_released_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+
+static inline size_t pool_class(size_t size) {
+    return size == 0 ? 0 : (size - 1) >> 4;
+}
+
+/*
+    takes up the objects of class 'c' or a slab end of at least
+    'class_size' bytes released by exited threads, returning 0 if there
+    were some
+*/
+static int pool_take_released(size_t c, size_t class_size) {
+    int taken = 0;
+    pthread_mutex_lock(&pool_released_lock);
+    if (pool_released_lists[c] != NULL) {
+        pool_free_lists[c] = pool_released_lists[c];
+        pool_released_lists[c] = NULL;
+        taken = 1;
+    }
+    else {
+        PoolSlabEnd** end = &pool_released_slab_ends;
+        while (*end != NULL && (*end)->size < class_size) {
+            end = &(*end)->next;
+        }
+        if (*end != NULL) {
+            PoolSlabEnd* slab_end = *end;
+            *end = slab_end->next;
+            pool_slab = (char*) slab_end;
+            pool_slab_left = slab_end->size;
+            taken = 1;
+        }
+    }
+    pthread_mutex_unlock(&pool_released_lock);
+    return !taken;
+}
+
+/*
+    Gets an object of 'size' bytes, from a free list if one's been given
+    back, otherwise from the current slab. Returns NULL if the system is
+    out of memory.
+*/
+void* pool_alloc(size_t size) {
+#ifdef POOL_USE_MALLOC
+    return malloc(size);
+#else
+    if (size > POOL_MAX_SIZE) {
+        ++pool_thread_stats.large;
+        return malloc(size);
+    }
+
+    size_t c = pool_class(size);
+    PoolFreeObject* object = pool_free_lists[c];
+    if (object != NULL) {
+        pool_free_lists[c] = object->next;
+        ++pool_thread_stats.allocs;
+        ++pool_thread_stats.reused;
+        return object;
+    }
+
+    size_t class_size = (c + 1) << 4;
+    if (pool_slab_left < class_size && pool_take_released(c, class_size) == 0) {
+        // there's room now, in the taken free list or slab end
+        return pool_alloc(size);
+    }
+    if (pool_slab_left < class_size) {
+        // the rest of the old slab is too small for this class, so it's
+        // left unused
+        char* slab = malloc(POOL_SLAB_SIZE);
+        if (slab == NULL) {
+            return NULL;
+        }
+        pool_slab = slab;
+        pool_slab_left = POOL_SLAB_SIZE;
+        ++pool_thread_stats.slabs;
+        pool_thread_stats.slab_bytes += POOL_SLAB_SIZE;
+    }
+
+    void* ptr = pool_slab;
+    pool_slab += class_size;
+    pool_slab_left -= class_size;
+    ++pool_thread_stats.allocs;
+
+    return ptr;
+#endif
+}
+
+/*
+    Gives an object from pool_alloc() back, 'size' being the same size it
+    was allocated with.
+*/
+void pool_free(void* ptr, size_t size) {
+#ifdef POOL_USE_MALLOC
+    free(ptr);
+#else
+    if (ptr == NULL) {
+        return;
+    }
+    if (size > POOL_MAX_SIZE) {
+        free(ptr);
+        return;
+    }
+
+    size_t c = pool_class(size);
+    PoolFreeObject* object = ptr;
+    object->next = pool_free_lists[c];
+    pool_free_lists[c] = object;
+    ++pool_thread_stats.frees;
+#endif
+}
+
+/*
+    Hands the calling thread's free lists and the unused end of its slab to
+    the other threads, for a thread that's about to exit. Without it they'd
+    be lost with the thread, while the slabs stay allocated for the objects
+    still in use.
+*/
+void pool_thread_release() {
+#ifndef POOL_USE_MALLOC
+    pthread_mutex_lock(&pool_released_lock);
+    for (size_t c = 0; c < POOL_NUM_CLASSES; ++c) {
+        PoolFreeObject* list = pool_free_lists[c];
+        if (list != NULL) {
+            PoolFreeObject* last = list;
+            while (last->next != NULL) {
+                last = last->next;
+            }
+            last->next = pool_released_lists[c];
+            pool_released_lists[c] = list;
+            pool_free_lists[c] = NULL;
+        }
+    }
+
+    // slab ends are whole size classes, so always big enough to hold one
+    if (pool_slab_left >= sizeof(PoolSlabEnd)) {
+        PoolSlabEnd* slab_end = (PoolSlabEnd*) pool_slab;
+        slab_end->size = pool_slab_left;
+        slab_end->next = pool_released_slab_ends;
+        pool_released_slab_ends = slab_end;
+    }
+    pool_slab = NULL;
+    pool_slab_left = 0;
+    pthread_mutex_unlock(&pool_released_lock);
+#endif
+}
+
+/*
+    Returns the calling thread's pool statistics.
+*/
+PoolStats pool_stats() {
+    return pool_thread_stats;
+}
+
+
+
+/*
+    Allocation helpers for small objects of containers that can live either
+    in an arena (arena is given) or on the heap, where they come from the
+    pools.
+*/
+static inline void* a_pool_alloc(Arena* arena, size_t size) {
+    if (arena == NULL) {
+        return pool_alloc(size);
+    }
+    return arena_alloc(arena, size);
+}
+
+static inline void a_pool_free(Arena* arena, void* ptr, size_t size) {
+    if (arena == NULL) {
+        pool_free(ptr, size);
+    }
+}
+
+
+
+#endif
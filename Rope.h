@@ -0,0 +1,219 @@
+#ifndef ROPE
+#define ROPE
+
+#include "List.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+
+/*
+    A string builder for very large outputs, made of fixed size chunks instead
+    of one contiguous buffer. Both appending and prepending are O(1) amoritized
+    per character and never copy what's already in the rope, and the rope can
+    be written to a file with writev straight from the chunks. So building and
+    writing a multi-GB file never needs one huge buffer or a full copy.
+
+    ```
+    Rope* rope = new_rope();
+    rope_append(rope, "user_123,bob@gmail.com\n");
+    rope_append(rope, "user_456,sarah@gmail.com\n");
+    rope_prepend(rope, "END\n");
+    rope_write_file(rope, "out.txt");
+    free_rope(rope);
+    ```
+
+    Use a String instead when you need the result as one char*.
+*/
+typedef struct RopeChunk {
+    size_t start; // first used byte in data
+    size_t end; // one past the last used byte in data
+    char data[];
+} RopeChunk;
+
+typedef struct Rope {
+    List* chunks; // list of RopeChunk*
+    size_t len;
+} Rope;
+
+
+const size_t ROPE_CHUNK_SIZE = 65536;
+
+
+
+static void rope_mem_error_exit_failing() {
+    fprintf(stderr, "Rope couldn't get more memory on the system! Exiting...");
+    exit(EXIT_FAILURE);
+}
+
+
+Rope* new_rope() {
+    Rope* rope = malloc(sizeof(Rope));
+    if (rope == NULL) {
+        rope_mem_error_exit_failing();
+    }
+    rope->chunks = new_list();
+    rope->len = 0;
+
+    return rope;
+}
+
+void free_rope(Rope* rope) {
+    free_list(rope->chunks, 1);
+    free(rope);
+}
+
+/*
+    'start' is where the chunk's (empty) contents begin: 0 for chunks
+    filled forwards by appends, ROPE_CHUNK_SIZE for chunks filled
+    backwards by prepends
+*/
+static RopeChunk* new_rope_chunk(size_t start) {
+    RopeChunk* chunk = malloc(sizeof(RopeChunk) + ROPE_CHUNK_SIZE);
+    if (chunk == NULL) {
+        rope_mem_error_exit_failing();
+    }
+    chunk->start = start;
+    chunk->end = start;
+    return chunk;
+}
+
+
+
+/*
+    Appends 'len' characters starting at 'ptr' to the end of the rope.
+*/
+void rope_append_n(Rope* rope, char* ptr, size_t len) {
+    rope->len += len;
+
+    while (len > 0) {
+        RopeChunk* last = rope->chunks->len > 0 ? l_get_unchecked(rope->chunks, rope->chunks->len - 1) : NULL;
+        if (last == NULL || last->end == ROPE_CHUNK_SIZE) {
+            last = new_rope_chunk(0);
+            l_push(rope->chunks, last);
+        }
+
+        size_t n = ROPE_CHUNK_SIZE - last->end;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(last->data + last->end, ptr, n);
+        last->end += n;
+        ptr += n;
+        len -= n;
+    }
+}
+
+/*
+    Appends a null terminated string to the end of the rope.
+*/
+void rope_append(Rope* rope, char* str) {
+    rope_append_n(rope, str, strlen(str));
+}
+
+/*
+    Adds 'len' characters starting at 'ptr' to the front of the rope.
+*/
+void rope_prepend_n(Rope* rope, char* ptr, size_t len) {
+    rope->len += len;
+
+    // fill chunks from the back of the input forwards
+    while (len > 0) {
+        RopeChunk* first = rope->chunks->len > 0 ? l_get_unchecked(rope->chunks, 0) : NULL;
+        if (first == NULL || first->start == 0) {
+            first = new_rope_chunk(ROPE_CHUNK_SIZE);
+            l_push_front(rope->chunks, first);
+        }
+
+        size_t n = first->start;
+        if (n > len) {
+            n = len;
+        }
+        first->start -= n;
+        memcpy(first->data + first->start, ptr + len - n, n);
+        len -= n;
+    }
+}
+
+/*
+    Adds a null terminated string to the front of the rope.
+*/
+void rope_prepend(Rope* rope, char* str) {
+    rope_prepend_n(rope, str, strlen(str));
+}
+
+
+
+/*
+    Writes the whole rope to a file descriptor with writev, passing the
+    chunks straight to the kernel. Returns 0 if successful.
+*/
+int rope_write_fd(Rope* rope, int fd) {
+
+    // chunks per writev call
+    struct iovec iov[1024];
+    long iov_max = sysconf(_SC_IOV_MAX);
+    size_t max_iov = iov_max > 0 && iov_max < 1024 ? iov_max : 1024;
+
+    size_t c = 0;
+    while (c < rope->chunks->len) {
+        size_t count = 0;
+        for (; c < rope->chunks->len && count < max_iov; ++c) {
+            RopeChunk* chunk = l_get_unchecked(rope->chunks, c);
+            if (chunk->end > chunk->start) {
+                iov[count].iov_base = chunk->data + chunk->start;
+                iov[count].iov_len = chunk->end - chunk->start;
+                ++count;
+            }
+        }
+
+        // writev can write less than asked, so keep going until the batch is out
+        struct iovec* next = iov;
+        while (count > 0) {
+            ssize_t written = writev(fd, next, count);
+            if (written < 0) {
+                perror("Error writing rope");
+                return 1;
+            }
+            while (count > 0 && written >= next->iov_len) {
+                written -= next->iov_len;
+                ++next;
+                --count;
+            }
+            if (count > 0) {
+                next->iov_base = (char*) next->iov_base + written;
+                next->iov_len -= written;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/*
+    Writes the whole rope to a file, replacing what was in it.
+    Returns 0 if successful.
+*/
+int rope_write_file(Rope* rope, char* path) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror("Failed to open file");
+        return 1;
+    }
+
+    int failed = rope_write_fd(rope, fd);
+    if (close(fd) != 0) {
+        perror("Error closing file");
+        failed = 1;
+    }
+
+    return failed;
+}
+
+
+
+#endif
@@ -1,6 +1,8 @@
 #ifndef SET
 #define SET
 
+#include "Pool.h"
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -11,17 +13,24 @@ typedef struct Item {
 } Item;
 
 /*
-    
-
+    An unordered hash set, built the same way as the map in Map.h. Items
+    come from the size class pools in Pool.h.
 */
 typedef struct Set {
     Item** data; // pointer to array of pointers
     size_t data_size;
     size_t len;
+    size_t deleted; // tombstones left by erased items
+
+    Arena* arena; // where the set's memory comes from, or NULL for the heap
 } Set;
 
 const char* SET_DELETED_KEY = "<DELETED>";
 
+// the tombstone left where an item was erased (its size never matches a
+// real item)
+static Item SET_DELETED_ITEM = {"<DELETED>", (size_t) -1};
+
 const size_t SET_PRIMES[] = {
     127,
     257,
@@ -73,17 +82,37 @@ static void set_mem_error_exit_failing() {
 }
 
 
-static Set* new_set_s(size_t size) {
+/*
+    Sets in an arena report running out of memory, sets on the heap exit.
+    returns 1 (an error)
+*/
+static int set_mem_error(Set* set) {
+    if (set->arena == NULL) {
+        set_mem_error_exit_failing();
+    }
+    return 1;
+}
+
+
+static Set* new_set_s(Arena* arena, size_t size) {
 
-    Set *set = malloc(sizeof(Set));
+    Set *set = a_malloc(arena, sizeof(Set));
     if (set == NULL) {
+        if (arena != NULL) {
+            return NULL;
+        }
         set_mem_error_exit_failing();
     }
-    set->data = malloc(size * sizeof(void*));
+    set->data = a_malloc(arena, size * sizeof(void*));
     if (set->data == NULL) {
-        free(set);
+        a_free(arena, set);
+        if (arena != NULL) {
+            return NULL;
+        }
         set_mem_error_exit_failing();
     }
+    set->arena = arena;
+    set->deleted = 0;
     set->data_size = size;
     for (int i = 0; i < size; ++i) {
         set->data[i] = NULL;
@@ -97,7 +126,16 @@ static Set* new_set_s(size_t size) {
     Creates an empty set
 */
 Set* new_set() {
-    return new_set_s(SET_PRIMES[0]);
+    return new_set_s(NULL, SET_PRIMES[0]);
+}
+
+/*
+    Creates an empty set whose memory comes from 'arena' (see Arena.h).
+    Adding to it returns 1 instead of exiting if the arena runs out.
+    Returns NULL if the arena is out of memory.
+*/
+Set* new_set_in(Arena* arena) {
+    return new_set_s(arena, SET_PRIMES[0]);
 }
 
 
@@ -149,11 +187,11 @@ static size_t probe_s(Set* set, char* data, size_t data_size, int* hash_collisio
 
 static void free_set_data(Set* set) {
     for (size_t i = 0; i < set->data_size; ++i) {
-        if (set->data[i] != NULL) {
-            free( set->data[i]);
+        if (set->data[i] != NULL && set->data[i] != &SET_DELETED_ITEM) {
+            a_pool_free(set->arena, set->data[i], sizeof(Item));
         }
     }
-    free(set->data);
+    a_free(set->arena, set->data);
 }
 
 /*
@@ -166,11 +204,14 @@ static void free_set_data(Set* set) {
 */
 void free_set(Set* set) {
     free_set_data(set);
-    free(set);
+    a_free(set->arena, set);
 }
 
 
-static void s_add_no_resize(Set* set, void* data, size_t data_size) {
+/*
+    returns 0 if successful
+*/
+static int s_add_no_resize(Set* set, void* data, size_t data_size) {
     int hash_collisions = 0;
     size_t index = probe_s(set, data, data_size, &hash_collisions);
 
@@ -180,9 +221,9 @@ static void s_add_no_resize(Set* set, void* data, size_t data_size) {
 
 
         // make a new item
-        Item *item = malloc(sizeof(Item));
+        Item *item = a_pool_alloc(set->arena, sizeof(Item));
         if (item == NULL) {
-            set_mem_error_exit_failing();
+            return set_mem_error(set);
         }
         item->data = data;
         item->data_size = data_size;
@@ -194,52 +235,50 @@ static void s_add_no_resize(Set* set, void* data, size_t data_size) {
         memcpy(set->data[index]->data, data, data_size);
     }
 
-
+    return 0;
 }
 
-static void resize_set(Set* set) {
+/*
+    returns 0 if successful, otherwise the set is left as it was
+*/
+static int resize_set(Set* set) {
     size_t NUM_SET_PRIMES = sizeof(SET_PRIMES) / sizeof(SET_PRIMES[0]);
 
-    // get next table size
-    size_t new_table_size = SET_PRIMES[0];
-    for (int i = 0; i < NUM_SET_PRIMES; ++i) {
-        if (SET_PRIMES[i] > set->data_size) {
-            new_table_size = SET_PRIMES[i];
-            break;
+    // get next table size, or keep the size if the table is mostly
+    // tombstones and just needs rebuilding
+    size_t new_table_size = set->data_size;
+    if (set->data_size * 0.35 < set->len + 1) {
+        new_table_size = SET_PRIMES[0];
+        for (int i = 0; i < NUM_SET_PRIMES; ++i) {
+            if (SET_PRIMES[i] > set->data_size) {
+                new_table_size = SET_PRIMES[i];
+                break;
+            }
         }
     }
 
-    // make new table and insert each element
-    size_t SET_DELETED_KEY_SIZE = strlen(SET_DELETED_KEY) + 1;
-    Set* new_set = new_set_s(new_table_size);
+    // make new table and move each item over
+    Set* new_set = new_set_s(set->arena, new_table_size);
+    if (new_set == NULL) {
+        return 1;
+    }
     for (size_t i = 0; i < set->data_size; ++i) {
-
-        // if an element insert into new set
-        if (set->data[i] != NULL) {
-
-            // check if deleted
-            int deleted = 0;
-            if (set->data[i]->data_size == SET_DELETED_KEY_SIZE) {
-                if (strcmp(set->data[i]->data, SET_DELETED_KEY) == 0) {
-                    deleted = 1;
-                }
-            }
-
-            // an element insert into set
-            if (!deleted) {
-                Item* item = set->data[i];
-                s_add_no_resize(new_set, item->data, item->data_size);
-            }
+        Item* item = set->data[i];
+        if (item != NULL && item != &SET_DELETED_ITEM) {
+            int hash_collisions = 0;
+            size_t index = probe_s(new_set, item->data, item->data_size, &hash_collisions);
+            new_set->data[index] = item;
         }
     }
 
-    free_set_data(set);
+    a_free(set->arena, set->data);
     set->data = new_set->data;
     set->data_size = new_set->data_size;
-    set->len = new_set->len;
+    set->deleted = 0;
+
+    a_free(set->arena, new_set);
 
-    new_set->data = NULL; // so it won't free the data array copied above
-    free(new_set);
+    return 0;
 }
 
 
@@ -254,29 +293,32 @@ static void resize_set(Set* set) {
     s_any_add(set, &object, sizeof(object));
     ```
 
+    returns 0 if successful
 */
-void s_any_add(Set* set, void* data, size_t data_size) {
+int s_any_add(Set* set, void* data, size_t data_size) {
 
-    s_add_no_resize(set, data, data_size);
-
-    // resize if neeeded
-    if (set->data_size * 0.7 < set->len) {
-        resize_set(set);
+    // resize if neeeded (first, so a failed resize leaves the set unchanged)
+    if (set->data_size * 0.7 < set->len + set->deleted + 1) {
+        if (resize_set(set) != 0) {
+            return 1;
+        }
     }
+
+    return s_add_no_resize(set, data, data_size);
 }
 
 /*
     Function to insert an int in the set.
 */
-void s_int_add(Set* set, int data) {
-    s_any_add(set, &data, sizeof(int));
+int s_int_add(Set* set, int data) {
+    return s_any_add(set, &data, sizeof(int));
 }
 
 /*
     Function to insert a string in the set.
 */
-void s_add(Set* set, char* data) {
-    s_any_add(set, data, (strlen(data) + 1) * sizeof(char));
+int s_add(Set* set, char* data) {
+    return s_any_add(set, data, (strlen(data) + 1) * sizeof(char));
 }
 
 
@@ -292,55 +334,44 @@ void s_add(Set* set, char* data) {
     ```
 
     If the key doesn't exist nothing happens
+
+    returns 0 if the item was erased, or 1 if it wasn't in the set
 */
-void* s_any_erase(Set* set, void* data, size_t data_size) {
+int s_any_erase(Set* set, void* data, size_t data_size) {
     int hash_collisions = 0;
     size_t index = probe_s(set, data, data_size, &hash_collisions);
 
     if (set->data[index] == NULL) {
-        return NULL;
+        return 1;
     }
 
     Item* item = set->data[index];
-    free(item);
-
-    if (hash_collisions != 0) {
-
-        // make deleted key
-        size_t SET_DELETED_KEY_SIZE = strlen(SET_DELETED_KEY) + 1;
-        char deleted_key_copy[SET_DELETED_KEY_SIZE];
-        strcpy(deleted_key_copy, SET_DELETED_KEY);
+    a_pool_free(set->arena, item, sizeof(Item));
 
-        // set as deleted
-        set->data[index]->data = deleted_key_copy;
-        set->data[index]->data_size = SET_DELETED_KEY_SIZE;
-        set->data[index]->data = NULL;
-
-        --set->len;
-    }
-    else {
-        set->data[index] = NULL;
-        --set->len;
-    }
+    // set as deleted (other items may have probed past this one, so the
+    // slot can't just be emptied)
+    set->data[index] = &SET_DELETED_ITEM;
+    ++set->deleted;
+    --set->len;
 
-    return data;
+    return 0;
 }
 
 /*
     Function to remove an int in the set.
 
-    If the key doesn't exist nothing happens
+    If the key doesn't exist nothing happens (see s_any_erase())
 */
-void* s_int_erase(Set* set, int key) {
+int s_int_erase(Set* set, int key) {
     return s_any_erase(set, &key, sizeof(key));
 }
 
 /*
     Function to remove a string in the set.
 
-    If the key doesn't exist nothing happens
+    If the key doesn't exist nothing happens (see s_any_erase())
 */
-void* s_erase(Set* set, char* key) {
+int s_erase(Set* set, char* key) {
     return s_any_erase(set, key, (strlen(key) + 1) * sizeof(char));
 }
 
@@ -358,21 +389,10 @@ void** set_items(Set* set) {
     void** array = malloc(set->len * sizeof(Item));
 
     int l = 0;
-    size_t SET_DELETED_KEY_SIZE = strlen(SET_DELETED_KEY) + 1;
     for (size_t i = 0; i < set->data_size; ++i) {
-        if (set->data[i] != NULL) {
-            
-            int deleted = 0;
-            if (set->data[i]->data_size == SET_DELETED_KEY_SIZE) {
-                 if (strcmp(set->data[i]->data, SET_DELETED_KEY) == 0) {
-                    deleted = 1;
-                }
-            }
-
-            if(!deleted) {
-                array[l] = set->data[i]->data;
-                ++l;
-            }
+        if (set->data[i] != NULL && set->data[i] != &SET_DELETED_ITEM) {
+            array[l] = set->data[i]->data;
+            ++l;
         }
     }
 
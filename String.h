@@ -1,22 +1,61 @@
 #ifndef STRING_STREAM
 #define STRING_STREAM
 
+#include "Arena.h"
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <stdarg.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 
+// size of the buffer stored inside the String itself (23 characters
+// plus a null terminator)
+#define STRING_SMALL_SIZE 24
 
 /*
     String stream object that maintains an interal buffer
     allowing efficient and easy appending of strings.
+
+    The buffer grows by 'growth_factor' (2 by default) when full, and
+    can be trimmed back down with string_shrink_to_fit().
+
+    Short strings (up to 23 characters) are kept in a small buffer inside
+    the String itself, so they don't need a second allocation. A String can
+    even live on the stack with no allocations at all:
+    ```
+    String ss;
+    init_string(&ss);
+    append(&ss, "hi");
+    ...
+    free_string_buffer(&ss); // only frees anything if the string got long
+    ```
+
+    Because of the small buffer, don't copy a String struct by value, pass
+    pointers around instead.
+
+    Strings made with new_string_in() keep their buffer in an arena (see
+    Arena.h), and the append methods return 1 instead of exiting if the
+    arena runs out, leaving the string as it was.
 */
 typedef struct String {
-    char* buffer; // string buffer
+    char* buffer; // string buffer (points at 'small' for short strings)
     size_t buffer_size;
+    double growth_factor;
 
     size_t start;
     size_t end;
     size_t len;
+
+    Arena* arena; // where the buffer comes from, or NULL for the heap
+
+    char small[STRING_SMALL_SIZE];
 } String;
 
 
@@ -26,76 +65,242 @@ static void stream_mem_error_exit_failing() {
     exit(EXIT_FAILURE);
 }
 
-
-String* new_string_s(size_t size) {
-    String *p_stream = malloc(sizeof(String));
-    if (p_stream == NULL) {
+/*
+    Strings in an arena report running out of memory, strings on the heap
+    exit. returns 1 (an error)
+*/
+static int stream_mem_error(String* stream) {
+    if (stream->arena == NULL) {
         stream_mem_error_exit_failing();
     }
-    p_stream->buffer = malloc(size * sizeof(void*));
-    if (p_stream->buffer == NULL) {
-        free(p_stream);
+    return 1;
+}
+
+
+/*
+    Sets up a String struct you've allocated yourself (on the stack or
+    inside another struct) as an empty string using its small buffer.
+    Clean it up with free_string_buffer().
+*/
+void init_string(String* stream) {
+    stream->buffer = stream->small;
+    stream->buffer_size = STRING_SMALL_SIZE;
+    stream->growth_factor = 2;
+    stream->start = 0;
+    stream->end = 0;
+    stream->len = 0;
+    stream->arena = NULL;
+
+    stream->buffer[0] = '\0'; // null terminate
+}
+
+static String* new_string_s_in(Arena* arena, size_t size) {
+    String *p_stream = a_malloc(arena, sizeof(String));
+    if (p_stream == NULL) {
+        if (arena != NULL) {
+            return NULL;
+        }
         stream_mem_error_exit_failing();
     }
-    p_stream->buffer_size = size;
-    p_stream->start = 0;
-    p_stream->end = 0;
-    p_stream->len = 0;
+    init_string(p_stream);
+    p_stream->arena = arena;
 
-    p_stream->buffer[0] = '\0'; // null terminate
+    if (size > STRING_SMALL_SIZE) {
+        p_stream->buffer = a_malloc(arena, size * sizeof(char));
+        if (p_stream->buffer == NULL) {
+            a_free(arena, p_stream);
+            if (arena != NULL) {
+                return NULL;
+            }
+            stream_mem_error_exit_failing();
+        }
+        p_stream->buffer_size = size;
+        p_stream->buffer[0] = '\0'; // null terminate
+    }
 
     return p_stream;
 }
 
+String* new_string_s(size_t size) {
+    return new_string_s_in(NULL, size);
+}
+
 String* new_string() {
-    return new_string_s(100);
+    return new_string_s(STRING_SMALL_SIZE);
 }
 
+/*
+    Makes a string whose buffer comes from 'arena' (see Arena.h). Returns
+    NULL if the arena is out of memory.
+*/
+String* new_string_in(Arena* arena) {
+    return new_string_s_in(arena, STRING_SMALL_SIZE);
+}
 
 
-static int resize_string(String* stream) {
 
-    size_t new_size = stream->buffer_size * 2;
-    char* new_data = malloc(new_size * sizeof(char));
-    if (new_data == NULL) {
-        stream_mem_error_exit_failing();
+/*
+    Sets the internal buffer to 'new_size' (which must be bigger than
+    the string's length), placing the string 'front' characters into it so
+    there's room to append_front() without moving it again. Sizes that fit
+    in the small buffer move the string back into it.
+
+    Heap buffers are reused with realloc (which glibc services with mremap
+    for very large buffers) and the string is moved within them.
+
+    returns 0 if successful, otherwise the string is left as it was
+*/
+static int resize_string_s(String* stream, size_t new_size, size_t front) {
+
+    int was_small = stream->buffer == stream->small;
+    if (new_size <= STRING_SMALL_SIZE) {
+
+        // back into the small buffer (through a temporary in case it's
+        // already there)
+        char tmp[STRING_SMALL_SIZE];
+        new_size = STRING_SMALL_SIZE;
+        if (front + stream->len + 1 > new_size) {
+            front = new_size - stream->len - 1;
+        }
+        memcpy(tmp, stream->buffer + stream->start, stream->len * sizeof(char));
+        memcpy(stream->small + front, tmp, stream->len * sizeof(char));
+        if (!was_small) {
+            a_free(stream->arena, stream->buffer);
+        }
+        stream->buffer = stream->small;
     }
+    else if (new_size == stream->buffer_size) {
 
-    if (stream->start > stream->end) {
+        // just moving the string within the buffer
+        memmove(stream->buffer + front, stream->buffer + stream->start, stream->len * sizeof(char));
+    }
+    else if (!was_small && new_size < stream->buffer_size) {
+
+        // shift the string into place before the end is cut off
+        memmove(stream->buffer + front, stream->buffer + stream->start, stream->len * sizeof(char));
+        stream->start = front;
+        stream->end = front + stream->len;
 
-        // copy start index to array end
-        memcpy(
-            new_data, 
-            stream->buffer + stream->start, 
-            (stream->buffer_size - stream->start) * sizeof(char)
-        );
-        // copy array start to end index
-        memcpy(
-            new_data + (stream->buffer_size - stream->start), 
-            stream->buffer, 
-            stream->end * sizeof(char)
-        );
+        char* new_data = a_realloc(stream->arena, stream->buffer, stream->buffer_size * sizeof(char), new_size * sizeof(char));
+        if (new_data == NULL) {
+            return stream_mem_error(stream);
+        }
+        stream->buffer = new_data;
+    }
+    else if (!was_small) {
+        char* new_data = a_realloc(stream->arena, stream->buffer, stream->buffer_size * sizeof(char), new_size * sizeof(char));
+        if (new_data == NULL) {
+            return stream_mem_error(stream);
+        }
+        stream->buffer = new_data;
+        memmove(stream->buffer + front, stream->buffer + stream->start, stream->len * sizeof(char));
     }
     else {
-        memcpy(
-            new_data, 
-            stream->buffer + stream->start, 
-            (stream->end - stream->start) * sizeof(char)
-        );
+        char* new_data = a_malloc(stream->arena, new_size * sizeof(char));
+        if (new_data == NULL) {
+            return stream_mem_error(stream);
+        }
+        memcpy(new_data + front, stream->buffer + stream->start, stream->len * sizeof(char));
+        stream->buffer = new_data;
     }
 
-    // freeing stream but not contents
-    free(stream->buffer);
-    stream->buffer = new_data;
     stream->buffer_size = new_size;
-    stream->start = 0;
-    stream->end = stream->len;
+    stream->start = front;
+    stream->end = front + stream->len;
+    stream->buffer[stream->end] = '\0';
 
     return 0;
 }
 
+/*
+    Shrinks the internal buffer down to what the string needs (its
+    length plus a null terminator). Useful for long lived strings
+    that were built up large once.
+*/
+void string_shrink_to_fit(String* stream) {
+    if (stream->buffer != stream->small && stream->len + 1 < stream->buffer_size) {
+        resize_string_s(stream, stream->len + 1, 0);
+    }
+}
+
 
 
+/*
+    Makes room for the string to grow by 'needed' characters in total, with
+    'front' of them at the front. When the string only fills up to half the
+    buffer it's moved over within it, otherwise the buffer grows by
+    'growth_factor'. Either way many more characters can be added at the
+    same end before it has to happen again, keeping appends to both ends
+    O(1) amoritized.
+*/
+static int make_room_string(String* stream, size_t needed, size_t front) {
+    size_t new_size = stream->buffer_size;
+    if (stream->len + needed + 1 > stream->buffer_size / 2) {
+        new_size = stream->buffer_size * stream->growth_factor;
+        if (new_size < stream->len + needed + 1) {
+            new_size = stream->len + needed + 1;
+        }
+    }
+
+    // strings only ever appended to stay at the start of the buffer, the
+    // spare room of ones that are prepended to is split between both ends
+    size_t spare = new_size - (stream->len + needed + 1);
+    if (front > 0 || stream->start > 0) {
+        front += spare / 2;
+    }
+    return resize_string_s(stream, new_size, front);
+}
+
+/*
+    Makes sure 'extra' more characters (plus a null terminator) can be
+    appended without another resize.
+
+    returns 0 if successful
+*/
+static int reserve_string(String* stream, size_t extra) {
+    if (stream->end + extra + 1 > stream->buffer_size) {
+        return make_room_string(stream, extra, 0);
+    }
+    return 0;
+}
+
+/*
+    Makes sure 'extra' more characters can be added to the front without
+    another resize.
+
+    returns 0 if successful
+*/
+static int reserve_string_front(String* stream, size_t extra) {
+    if (stream->start < extra) {
+        return make_room_string(stream, extra, extra);
+    }
+    return 0;
+}
+
+
+
+/*
+    Appends 'len' characters starting at 'ptr' to the stream. Unlike append()
+    the input doesn't need to be null terminated and no strlen is done, so it's
+    the one to use when you already know the length (or have a StringView).
+
+    This is a O(1) amoritized operation
+
+    returns 0 if successful
+*/
+int append_n(String* stream, char* ptr, size_t len) {
+    if (reserve_string(stream, len) != 0) {
+        return 1;
+    }
+
+    memcpy(stream->buffer + stream->end, ptr, len * sizeof(char));
+    stream->end += len;
+    stream->len += len;
+    stream->buffer[stream->end] = '\0';
+
+    return 0;
+}
+
 /*
     Appends a character to a stream, ocassionaly
     resizing an internal buffer if the string is getting
@@ -103,90 +308,138 @@ static int resize_string(String* stream) {
 
     This is a O(1) amoritized operation
 */
-void append(String* stream, char* str) {
-    
-    int str_len = strlen(str) + 1; // including null terminator
-    while (stream->len + str_len > stream->buffer_size) {
-        resize_string(stream);
+int append(String* stream, char* str) {
+    return append_n(stream, str, strlen(str));
+}
+
+/*
+    Appends 'num_strs' strings with 'sep' between each of them, checking the
+    buffer's capacity only once. Handy for writing out csv rows:
+    ```
+    char* cells[] = {"user_123", "bob@gmail.com", "12"};
+    append_join(ss, cells, 3, ",");
+    ```
+*/
+int append_join(String* stream, char** strs, size_t num_strs, char* sep) {
+    if (num_strs == 0) {
+        return 0;
+    }
+
+    size_t sep_len = strlen(sep);
+    size_t total = sep_len * (num_strs - 1);
+    for (size_t i = 0; i < num_strs; ++i) {
+        total += strlen(strs[i]);
+    }
+    if (reserve_string(stream, total) != 0) {
+        return 1;
+    }
+
+    char* out = stream->buffer + stream->end;
+    for (size_t i = 0; i < num_strs; ++i) {
+        if (i > 0) {
+            memcpy(out, sep, sep_len);
+            out += sep_len;
+        }
+        size_t len = strlen(strs[i]);
+        memcpy(out, strs[i], len);
+        out += len;
     }
+    *out = '\0';
 
-    memcpy(stream->buffer + stream->end, str, str_len * sizeof(char));
-    stream->end += str_len - 1;
+    stream->end += total;
+    stream->len += total;
 
-    stream->len += str_len - 1;
+    return 0;
 }
 
-void append_c(String* stream, char c) {
+/*
+    Appends printf style formatted text straight into the stream's buffer.
+    ```
+    append_f(ss, "%s/%zu.trans", directory, timestamp);
+    ```
+*/
+int append_f(String* stream, const char* format, ...) {
+
+    size_t room = stream->buffer_size - stream->end;
+
+    va_list args;
+    va_start(args, format);
+    va_list retry;
+    va_copy(retry, args);
+
+    int written = vsnprintf(stream->buffer + stream->end, room, format, args);
+    int failed = 0;
+    if (written >= 0 && written >= room) {
+        failed = reserve_string(stream, written);
+        if (!failed) {
+            vsnprintf(stream->buffer + stream->end, written + 1, format, retry);
+        }
+    }
+    va_end(retry);
+    va_end(args);
+
+    if (written > 0 && !failed) {
+        stream->end += written;
+        stream->len += written;
+    }
+    stream->buffer[stream->end] = '\0';
+
+    return failed;
+}
+
+int append_c(String* stream, char c) {
     
-    if (stream->len + 1 > stream->buffer_size) {
-        resize_string(stream);
+    if (stream->end + 1 + 1 > stream->buffer_size) {
+        if (reserve_string(stream, 1) != 0) {
+            return 1;
+        }
     }
 
     stream->buffer[stream->end] = c;
     stream->end += 1;
     stream->len += 1;
     stream->buffer[stream->end] = '\0';
+
+    return 0;
 }
 
 
 /*
-    Appends a character to the front of a stream, ocassionaly
+    Appends a string to the front of a stream, ocassionaly
     resizing an internal buffer if the string is getting
     too long.
 
-    This method is less efficient than append, as it will
-    cause an extra restructering of the internal array when
-    str() is called. 
-
-    This operation itself is a O(1) amoritized operation. But
-    if called, this method will cause str() to O(n) instead of 
-    O(1).
+    The buffer keeps spare room in front of strings that get prepended
+    to, so this is a O(1) amoritized operation just like append(), and
+    the string stays in one piece (str() is still O(1)).
 */
-void append_front(String* stream, char* str) {
+int append_front(String* stream, char* str) {
 
-    int str_len = strlen(str);
-    while (stream->len + str_len + 1 > stream->buffer_size) {
-        resize_string(stream);
+    size_t str_len = strlen(str);
+    if (reserve_string_front(stream, str_len) != 0) {
+        return 1;
     }
 
-    if (stream->start > 0) {
-        if (stream->start - str_len > 0) {
-            memcpy(stream->buffer + (stream->start - str_len), str, str_len * sizeof(char)); 
-            stream->start -= str_len;
-        }
-        else {
-            int second_len = stream->start;
-            int first_len = str_len - second_len;
-            memcpy(stream->buffer, str + first_len, second_len * sizeof(char));
-            memcpy(stream->buffer + (stream->buffer_size - first_len), str, first_len * sizeof(char));
-            stream->start = stream->buffer_size - first_len;
-        }
-    }
-    else {
-        memcpy(stream->buffer + (stream->buffer_size - str_len), str, str_len * sizeof(char));
-        stream->start = stream->buffer_size - str_len;
-    }
-
-
+    stream->start -= str_len;
+    memcpy(stream->buffer + stream->start, str, str_len * sizeof(char));
     stream->len += str_len;
+
+    return 0;
 }
 
-void append_front_c(String* stream, char c) {
+int append_front_c(String* stream, char c) {
     
-    if (stream->len + 1 + 1 > stream->buffer_size) {
-        resize_string(stream);
-    }
-
-    if (stream->start > 0) {
-        stream->buffer[stream->start - 1] = c;
-        stream->start -= 1;
-    }
-    else {
-        stream->start = stream->buffer_size - 1;
-        stream->buffer[stream->start] = c;
+    if (stream->start == 0) {
+        if (reserve_string_front(stream, 1) != 0) {
+            return 1;
+        }
     }
 
+    stream->start -= 1;
+    stream->buffer[stream->start] = c;
     stream->len += 1;
+
+    return 0;
 }
 
 /*
@@ -197,22 +450,10 @@ void append_front_c(String* stream, char c) {
 
     There is no need to clean up this string if you call free_string().
 
-    O(1) amoritized unless append_front() has been used. In that case
-    it will be O(n).
+    O(1), the string is always kept in one piece in the buffer.
 */
 char* str(String* stream) {
-    if (stream->start == 0) {
-        return stream->buffer;
-    }
-    else if(stream->start > stream->end) {
-        resize_string(stream);
-        return stream->buffer;
-    }
-    else {
-        return stream->buffer + stream->start;
-    }
-
-    return NULL;
+    return stream->buffer + stream->start;
 } 
 
 
@@ -227,6 +468,110 @@ char* str_c(String* stream) {
 
 
 
+/*
+    Finds the first 'c' in the 'len' bytes at 's', or returns NULL.
+
+    Compares 32 bytes at a time with AVX2 (or 16 with SSE2) when the
+    compiler targets them, falling back to memchr otherwise.
+*/
+static char* find_c(char* s, size_t len, char c) {
+    size_t i = 0;
+#if defined(__AVX2__)
+    __m256i target = _mm256_set1_epi8(c);
+    for (; i + 32 <= len; i += 32) {
+        __m256i block = _mm256_loadu_si256((__m256i*) (s + i));
+        unsigned int mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, target));
+        if (mask != 0) {
+            return s + i + __builtin_ctz(mask);
+        }
+    }
+#elif defined(__SSE2__)
+    __m128i target = _mm_set1_epi8(c);
+    for (; i + 16 <= len; i += 16) {
+        __m128i block = _mm_loadu_si128((__m128i*) (s + i));
+        unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, target));
+        if (mask != 0) {
+            return s + i + __builtin_ctz(mask);
+        }
+    }
+#endif
+    return memchr(s + i, c, len - i);
+}
+
+/*
+    Finds the first occurance of the 'needle_len' bytes at 'needle' in the
+    'len' bytes at 's', or returns NULL.
+
+    With AVX2 or SSE2, blocks of positions are filtered by comparing both
+    the needle's first and last character at once, and only positions where
+    both match are checked with memcmp.
+*/
+static char* find_str(char* s, size_t len, char* needle, size_t needle_len) {
+    if (needle_len == 0) {
+        return s;
+    }
+    if (needle_len > len) {
+        return NULL;
+    }
+    if (needle_len == 1) {
+        return find_c(s, len, needle[0]);
+    }
+
+    size_t i = 0;
+    size_t last = needle_len - 1;
+#if defined(__AVX2__)
+    __m256i first_c = _mm256_set1_epi8(needle[0]);
+    __m256i last_c = _mm256_set1_epi8(needle[last]);
+    for (; i + 32 + last <= len; i += 32) {
+        __m256i block_first = _mm256_loadu_si256((__m256i*) (s + i));
+        __m256i block_last = _mm256_loadu_si256((__m256i*) (s + i + last));
+        unsigned int mask = _mm256_movemask_epi8(_mm256_and_si256(
+            _mm256_cmpeq_epi8(block_first, first_c),
+            _mm256_cmpeq_epi8(block_last, last_c)
+        ));
+        while (mask != 0) {
+            size_t at = i + __builtin_ctz(mask);
+            if (memcmp(s + at + 1, needle + 1, last - 1) == 0) {
+                return s + at;
+            }
+            mask &= mask - 1;
+        }
+    }
+#elif defined(__SSE2__)
+    __m128i first_c = _mm_set1_epi8(needle[0]);
+    __m128i last_c = _mm_set1_epi8(needle[last]);
+    for (; i + 16 + last <= len; i += 16) {
+        __m128i block_first = _mm_loadu_si128((__m128i*) (s + i));
+        __m128i block_last = _mm_loadu_si128((__m128i*) (s + i + last));
+        unsigned int mask = _mm_movemask_epi8(_mm_and_si128(
+            _mm_cmpeq_epi8(block_first, first_c),
+            _mm_cmpeq_epi8(block_last, last_c)
+        ));
+        while (mask != 0) {
+            size_t at = i + __builtin_ctz(mask);
+            if (memcmp(s + at + 1, needle + 1, last - 1) == 0) {
+                return s + at;
+            }
+            mask &= mask - 1;
+        }
+    }
+#endif
+
+    // scalar tail (or everything without SIMD)
+    while (i + needle_len <= len) {
+        char* found = memchr(s + i, needle[0], len - needle_len + 1 - i);
+        if (found == NULL) {
+            return NULL;
+        }
+        if (memcmp(found + 1, needle + 1, last) == 0) {
+            return found;
+        }
+        i = found - s + 1;
+    }
+
+    return NULL;
+}
+
 static int convert_index_string(String* stream, int index, int include_last) {
 
 
@@ -249,7 +594,7 @@ static int convert_index_string(String* stream, int index, int include_last) {
         exit(EXIT_FAILURE);
     }
 
-    return (stream->start + index) % stream->buffer_size;
+    return stream->start + index;
 }
 
 /*
@@ -275,38 +620,10 @@ void set_char(String* stream, int index, char c) {
 String* substr(String* stream, int start, int end) {
     int real_start = convert_index_string(stream, start, 0);
     int real_end = convert_index_string(stream, end, 1);
-    int new_len = 0;
-    if (real_start > real_end) {
-        new_len = stream->buffer_size - real_start + real_end;
-    }
-    else {
-        new_len = real_end - real_start;
-    }
-
+    int new_len = real_end - real_start;
 
     String* new_string = new_string_s(new_len * 2);
-
-    if (real_start > real_end) {
-        // copy start index to array end
-        memcpy(
-            new_string->buffer, 
-            stream->buffer + real_start, 
-            (stream->buffer_size - real_start) * sizeof(char)
-        );
-        // copy array start to end index
-        memcpy(
-            new_string->buffer + (stream->buffer_size - real_start), 
-            stream->buffer, 
-            real_end * sizeof(char)
-        );
-    }
-    else {
-        memcpy(
-            new_string->buffer, 
-            stream->buffer + real_start, 
-            (real_end - real_start) * sizeof(char)
-        );
-    }
+    memcpy(new_string->buffer, stream->buffer + real_start, new_len * sizeof(char));
 
     new_string->start = 0;
     new_string->end = new_len;
@@ -321,19 +638,58 @@ String* substr(String* stream, int start, int end) {
     internal buffer, returning that instead for use. 
 
     The resulting string NEEDS to be freed after you are done
-    with it.
+    with it, unless the string is in an arena, in which case the
+    result is in the arena too.
+
+    If append_front() left room in front of the string, the string is
+    moved to the start of the buffer first so the result can be freed.
 */
 char* free_string_str(String* ss) {
-    char* str_res = str(ss);
+    if (ss->arena != NULL) {
+        return str(ss);
+    }
+    if (ss->buffer == ss->small) {
+        char* str_res = strdup(str(ss));
+        free(ss);
+        return str_res;
+    }
+    if (ss->start > 0) {
+        memmove(ss->buffer, ss->buffer + ss->start, (ss->len + 1) * sizeof(char));
+    }
+    char* str_res = ss->buffer;
     free(ss);
     return str_res;
 }
 
+/*
+    Empties the string, keeping its buffer for reuse.
+*/
+void clear_string(String* ss) {
+    ss->start = 0;
+    ss->end = 0;
+    ss->len = 0;
+    ss->buffer[0] = '\0';
+}
+
+/*
+    Frees the heap buffer of a String set up with init_string() (if
+    it grew past the small buffer), but not the String struct itself.
+*/
+void free_string_buffer(String* ss) {
+    Arena* arena = ss->arena;
+    if (ss->buffer != ss->small) {
+        a_free(arena, ss->buffer);
+    }
+    init_string(ss);
+    ss->arena = arena;
+}
+
 void free_string(String* ss) {
+    Arena* arena = ss->arena;
     // Free data
-    free(ss->buffer);
+    free_string_buffer(ss);
     // Free the struct itself
-    free(ss);
+    a_free(arena, ss);
 }
 
 void free_strings(String** strings, size_t num_strings) {
@@ -344,157 +700,277 @@ void free_strings(String** strings, size_t num_strings) {
     free(strings);
 }
 
-String* replace(String* ss, char* str, char* replacement) {
-    int str_len = strlen(str);
-    int rep_len = strlen(replacement);
-
-    String* new_ss = new_string();
-    for (int i = 0; i < ss->len; ++i) {
+/*
+    Replaces every occurance of 'target' with 'replacement', returning a new
+    string and freeing the one passed in.
 
-        // handle matches
-        char c = char_at(ss, i);
-        if (c == str[0]) {
-            int is_match = 1;
-            for(int j = 0; j < str_len; ++j) {
-                c = char_at(ss, i+j);
-                if (c != str[j]) {
-                    is_match = 0;
-                    break;
-                }
-            }
-            if (is_match) {
-                for(int j = 0; j < rep_len; ++j) {
+    ```
+    ss = replace(ss, "at", "@");
+    ```
+*/
+String* replace(String* ss, char* target, char* replacement) {
+    size_t target_len = strlen(target);
+    size_t rep_len = strlen(replacement);
+    if (target_len == 0) {
+        return ss;
+    }
 
-                    append_c(new_ss, replacement[j]);
-                }
-                i += str_len - 1;
-            }
-        }
-        // otherwise just append
-        else {
-            append_c(new_ss, c);
-        }
+    char* s = str(ss);
+    String* new_ss = new_string_s(ss->len + 1);
+    size_t i = 0;
+    char* found;
+    while ((found = find_str(s + i, ss->len - i, target, target_len)) != NULL) {
+        size_t keep = found - (s + i);
+        append_n(new_ss, s + i, keep);
+        append_n(new_ss, replacement, rep_len);
+        i += keep + target_len;
     }
+    append_n(new_ss, s + i, ss->len - i);
 
     free_string(ss);
 
     return new_ss;
 }
 
+static String* new_string_from(char* s, size_t len) {
+    String* piece = new_string_s(len + 1);
+    memcpy(piece->buffer, s, len);
+    piece->buffer[len] = '\0';
+    piece->end = len;
+    piece->len = len;
+    return piece;
+}
+
+/*
+    Splits the string on every occurance of 'delim', returning an array of
+    new strings and setting 'num_splits' to its length. A string with n
+    delimiters gives n + 1 pieces.
+
+    The array and each string in it need to be freed (see free_strings()).
+    If you don't need to keep the pieces, sv_split_next() splits without
+    allocating anything.
+*/
 String** split(String* ss, char* delim, size_t* num_splits) {
 
-    // count splits
+    char* s = str(ss);
+    size_t delim_len = strlen(delim);
+
+    size_t splits_size = 16;
+    String** splits = malloc(splits_size * sizeof(String*));
+    if (splits == NULL) {
+        stream_mem_error_exit_failing();
+    }
     *num_splits = 0;
-    int delim_len = strlen(delim);
-    for (int i = 0; i < ss->len; ++i) {
-
-        // find matches
-        char c = char_at(ss, i);
-        if (c == delim[0]) {
-            int is_match = 1;
-            for(int j = 0; j < delim_len; ++j) {
-                c = char_at(ss, i+j);
-                if (c != delim[j]) {
-                    is_match = 0;
-                    break;
-                }
-            }
-            if (is_match) {
-                ++*num_splits;
+
+    size_t i = 0;
+    char* found;
+    while (delim_len > 0 && (found = find_str(s + i, ss->len - i, delim, delim_len)) != NULL) {
+        if (*num_splits + 1 == splits_size) {
+            splits_size *= 2;
+            String** new_splits = realloc(splits, splits_size * sizeof(String*));
+            if (new_splits == NULL) {
+                stream_mem_error_exit_failing();
             }
+            splits = new_splits;
         }
+
+        size_t piece_len = found - (s + i);
+        splits[(*num_splits)++] = new_string_from(s + i, piece_len);
+        i += piece_len + delim_len;
     }
-    ++*num_splits;
-
-    // split string
-    String** splits = malloc(*num_splits * sizeof(String));
-    int s_index = 0;
-    String* buffer = new_string();
-    for (int i = 0; i < ss->len; ++i) {
-
-        // find matches
-        char c = char_at(ss, i);
-        if (c == delim[0]) {
-            int is_match = 1;
-            for(int j = 0; j < delim_len; ++j) {
-                c = char_at(ss, i+j);
-                if (c != delim[j]) {
-                    is_match = 0;
-                    break;
-                }
-            }
-            if (is_match) {
-                splits[s_index] = buffer;
-                buffer = new_string();
-                ++s_index;
-                i += delim_len - 1;
-            }
-            else {
-                append_c(buffer, c);
-            }
-        }
-        // else append to current buffer
-        else {
-            append_c(buffer, c);
-        }
+    splits[(*num_splits)++] = new_string_from(s + i, ss->len - i);
+
+    return splits;
+}
+
+int equals(String* ss, char* other) {
+    size_t other_len = strlen(other);
+    return ss->len == other_len && memcmp(str(ss), other, other_len) == 0;
+}
+
+int contains_str(String* ss, char* other) {
+    return find_str(str(ss), ss->len, other, strlen(other)) != NULL;
+}
+
+int starts_with(String* ss, char* other) {
+    size_t other_len = strlen(other);
+    return ss->len >= other_len && memcmp(str(ss), other, other_len) == 0;
+}
+
+int ends_with(String* ss, char* other) {
+    size_t other_len = strlen(other);
+    return ss->len >= other_len && memcmp(str(ss) + ss->len - other_len, other, other_len) == 0;
+}
+
+
+/*
+    A view of part of a string. Views don't own or copy anything, they're
+    just a pointer and a length into someone else's buffer (a String, a
+    char*, a file in memory...), so they're free to make and pass around by
+    value. The bytes a view points at are NOT null terminated.
+
+    A view is only valid as long as the buffer it points into is. Appending
+    to a String can move its buffer, so take views after you're done
+    building the string.
+
+    ```
+    String* line = new_string();
+    append(line, "user_123,bob@gmail.com,12");
+
+    StringView rest = string_view(line, 0, line->len);
+    StringView cell;
+    while (sv_split_next(&rest, ',', &cell)) {
+        printf("%.*s\n", (int) cell.len, cell.ptr);
     }
+    ```
+*/
+typedef struct StringView {
+    char* ptr;
+    size_t len;
+} StringView;
 
-    splits[s_index] = buffer;
+/*
+    Makes a view of a null terminated string.
+*/
+StringView sv(char* str) {
+    StringView view = {str, strlen(str)};
+    return view;
+}
 
-    return splits;
+/*
+    Makes a view of 'len' bytes starting at 'ptr'.
+*/
+StringView sv_n(char* ptr, size_t len) {
+    StringView view = {ptr, len};
+    return view;
 }
 
-int equals(String* ss, char* str) {
-    for (int i = 0; i < ss->len; ++i) {
-        if (char_at(ss, i) != str[i]) {
-            return 0;
-        }
-        else if (str[i] == '\0') {
-            return 0;
-        }
+/*
+    Makes a view of a String from 'start' to 'end' (inclusive, exclusive).
+    Negative indices count back from the end of the string. O(1)
+*/
+StringView string_view(String* stream, int start, int end) {
+    if (start < 0) start += stream->len;
+    if (end < 0) end += stream->len;
+    if (start < 0 || end > stream->len || start > end) {
+        fprintf(stderr, "View ");
+        fprintf(stderr, "%d", start);
+        fprintf(stderr, " to ");
+        fprintf(stderr, "%d", end);
+        fprintf(stderr, " out of bounds for len ");
+        fprintf(stderr, "%zu", stream->len);
+        exit(EXIT_FAILURE);
     }
 
-    return 1;
+    StringView view = {str(stream) + start, end - start};
+    return view;
 }
 
-int contains_str(String* ss, char* str) {
+/*
+    Makes a view of part of another view (inclusive, exclusive). O(1)
+*/
+StringView sv_slice(StringView view, size_t start, size_t end) {
+    if (end > view.len) end = view.len;
+    if (start > end) start = end;
+    StringView slice = {view.ptr + start, end - start};
+    return slice;
+}
 
-    int match = 0;
-    int other_i = 0;
-    for (int i = 0; i < ss->len; ++i) {
-        if (char_at(ss, i) != str[other_i]) {
-            other_i = 0;
-        }
-        else {
-            ++other_i;
-            if (other_i == strlen(str)) {
-                return 1;
-            }
-        }
+/*
+    Copies the view into a new null terminated string that must be freed.
+*/
+char* sv_to_str(StringView view) {
+    char* copy = malloc(view.len + 1);
+    if (copy == NULL) {
+        stream_mem_error_exit_failing();
     }
+    memcpy(copy, view.ptr, view.len);
+    copy[view.len] = '\0';
+    return copy;
+}
 
-    return 0;
+int sv_equals(StringView a, StringView b) {
+    return a.len == b.len && memcmp(a.ptr, b.ptr, a.len) == 0;
 }
 
-int starts_with(String* ss, char* str) {
+int sv_equals_str(StringView view, char* str) {
+    return sv_equals(view, sv(str));
+}
 
-    for (int i = 0; i < strlen(str); ++i) {
-        if (char_at(ss, i) != str[i]) {
-            return 0;
-        }
+/*
+    Compares two views like strcmp does, returning a negative number,
+    zero, or a positive number.
+*/
+int sv_compare(StringView a, StringView b) {
+    size_t len = a.len < b.len ? a.len : b.len;
+    int cmp = memcmp(a.ptr, b.ptr, len);
+    if (cmp != 0) {
+        return cmp;
     }
+    return (a.len > b.len) - (a.len < b.len);
+}
 
-    return 1;
+int sv_starts_with(StringView view, char* str) {
+    size_t str_len = strlen(str);
+    return view.len >= str_len && memcmp(view.ptr, str, str_len) == 0;
 }
 
-int ends_with(String* ss, char* str) {
+/*
+    djb2 hash of the bytes in the view.
+*/
+size_t sv_hash(StringView view) {
+    size_t hash = 5381;
+    for (size_t i = 0; i < view.len; ++i) {
+        hash = ((hash << 5) + hash) + (unsigned char) view.ptr[i];
+    }
+    return hash;
+}
 
-    int other_i = 0;
-    for (int i = ss->len - strlen(str); i < ss->len; ++i) {
-        if (char_at(ss, i) != str[other_i]) {
-            return 0;
-        }
-        ++other_i;
+/*
+    Returns the index of the first 'c' in the view, or -1.
+*/
+long sv_find_c(StringView view, char c) {
+    char* found = find_c(view.ptr, view.len, c);
+    if (found == NULL) {
+        return -1;
+    }
+    return found - view.ptr;
+}
+
+/*
+    Returns the index of the first occurance of 'needle' in the view, or -1.
+*/
+long sv_find(StringView view, StringView needle) {
+    char* found = find_str(view.ptr, view.len, needle.ptr, needle.len);
+    if (found == NULL) {
+        return -1;
+    }
+    return found - view.ptr;
+}
+
+/*
+    Splits off the next piece of 'rest' up to 'delim', putting it in 'out' and
+    advancing 'rest' past the delimiter. Returns 0 once every piece has been
+    returned. Like split(), a string with n delimiters gives n + 1 pieces.
+
+    Nothing is allocated, 'out' points into the same buffer as 'rest'.
+*/
+int sv_split_next(StringView* rest, char delim, StringView* out) {
+    if (rest->ptr == NULL) {
+        return 0;
+    }
+
+    long i = sv_find_c(*rest, delim);
+    if (i < 0) {
+        *out = *rest;
+        rest->ptr = NULL;
+        rest->len = 0;
+    }
+    else {
+        out->ptr = rest->ptr;
+        out->len = i;
+        rest->ptr += i + 1;
+        rest->len -= i + 1;
     }
 
     return 1;
@@ -0,0 +1,279 @@
+#ifndef STRING_POOL
+#define STRING_POOL
+
+#include "List.h"
+#include "String.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+
+/*
+    A pool of interned strings. Every distinct string added to the pool is
+    stored exactly once, and adding the same characters again gives back the
+    same pointer (and the same id). So for strings from the same pool
+    ```
+    sp_intern(pool, a) == sp_intern(pool, b)
+    ```
+    is true exactly when a and b are equal, and equality checks become pointer
+    compares.
+
+    Used like so:
+    ```
+    StringPool* pool = new_string_pool();
+    char* status = sp_intern(pool, "active");
+    char* status2 = sp_intern(pool, "active"); // status == status2
+
+    unsigned int id = sp_intern_id(pool, sv("inactive"));
+    char* inactive = sp_get(pool, id);
+
+    free_string_pool(pool); // frees every interned string at once
+    ```
+
+    Interned strings are null terminated, must not be modified, and stay at the
+    same address until the pool is freed. They can't be removed one at a time,
+    so pools suit values that repeat a lot (statuses, countries, email domains)
+    rather than values that are unique and change often.
+
+
+
+    # DESIGN
+
+    Strings are copied into large blocks (a simple arena) instead of being
+    malloc'd one by one, and looked up with an open addressing hash table of
+    ids using linear probing. Hashes are kept per id so growing the table never
+    rehashes string data.
+
+*/
+typedef struct StringPool {
+    char** strings; // id to interned string
+    size_t* hashes; // id to hash of the string
+    size_t* lens; // id to length of the string
+    size_t len; // number of interned strings
+    size_t strings_size;
+
+    unsigned int* slots; // hash table of id + 1 (0 is an empty slot)
+    size_t slots_size; // always a power of two
+
+    List* blocks; // arena blocks holding the string data
+    char* block;
+    size_t block_used;
+    size_t block_size;
+
+    size_t bytes; // bytes of string data interned (including null terminators)
+} StringPool;
+
+
+const size_t STRING_POOL_BLOCK_SIZE = 65536;
+
+
+
+static void pool_mem_error_exit_failing() {
+    fprintf(stderr, "StringPool couldn't get more memory on the system! Exiting...");
+    exit(EXIT_FAILURE);
+}
+
+
+StringPool* new_string_pool() {
+    StringPool* pool = malloc(sizeof(StringPool));
+    if (pool == NULL) {
+        pool_mem_error_exit_failing();
+    }
+
+    pool->strings_size = 64;
+    pool->strings = malloc(pool->strings_size * sizeof(char*));
+    pool->hashes = malloc(pool->strings_size * sizeof(size_t));
+    pool->lens = malloc(pool->strings_size * sizeof(size_t));
+    pool->slots_size = 128;
+    pool->slots = calloc(pool->slots_size, sizeof(unsigned int));
+    if (pool->strings == NULL || pool->hashes == NULL || pool->lens == NULL || pool->slots == NULL) {
+        pool_mem_error_exit_failing();
+    }
+    pool->len = 0;
+
+    pool->blocks = new_list();
+    pool->block = NULL;
+    pool->block_used = 0;
+    pool->block_size = 0;
+
+    pool->bytes = 0;
+
+    return pool;
+}
+
+void free_string_pool(StringPool* pool) {
+    free_list(pool->blocks, 1);
+    free(pool->strings);
+    free(pool->hashes);
+    free(pool->lens);
+    free(pool->slots);
+    free(pool);
+}
+
+
+
+/*
+    copies 'len' characters into the pool's arena, null terminating them
+*/
+static char* sp_copy(StringPool* pool, char* ptr, size_t len) {
+
+    if (pool->block == NULL || pool->block_used + len + 1 > pool->block_size) {
+
+        // big strings get a block of their own so they don't waste the
+        // rest of the current block
+        size_t size = STRING_POOL_BLOCK_SIZE;
+        if (len + 1 > STRING_POOL_BLOCK_SIZE / 4) {
+            size = len + 1;
+        }
+
+        char* block = malloc(size);
+        if (block == NULL) {
+            pool_mem_error_exit_failing();
+        }
+        l_push(pool->blocks, block);
+
+        if (size == STRING_POOL_BLOCK_SIZE || pool->block == NULL) {
+            pool->block = block;
+            pool->block_used = 0;
+            pool->block_size = size;
+        }
+        else {
+            memcpy(block, ptr, len);
+            block[len] = '\0';
+            return block;
+        }
+    }
+
+    char* copy = pool->block + pool->block_used;
+    memcpy(copy, ptr, len);
+    copy[len] = '\0';
+    pool->block_used += len + 1;
+
+    return copy;
+}
+
+static void sp_grow_slots(StringPool* pool) {
+    size_t new_size = pool->slots_size * 2;
+    unsigned int* new_slots = calloc(new_size, sizeof(unsigned int));
+    if (new_slots == NULL) {
+        pool_mem_error_exit_failing();
+    }
+
+    for (size_t id = 0; id < pool->len; ++id) {
+        size_t index = pool->hashes[id] & (new_size - 1);
+        while (new_slots[index] != 0) {
+            index = (index + 1) & (new_size - 1);
+        }
+        new_slots[index] = id + 1;
+    }
+
+    free(pool->slots);
+    pool->slots = new_slots;
+    pool->slots_size = new_size;
+}
+
+/*
+    Same as sp_intern_id() but with the hash (from sv_hash()) already worked
+    out, for callers that hash strings ahead of time (on other threads for
+    example).
+*/
+unsigned int sp_intern_hashed(StringPool* pool, StringView view, size_t hash) {
+
+    size_t index = hash & (pool->slots_size - 1);
+    while (pool->slots[index] != 0) {
+        unsigned int id = pool->slots[index] - 1;
+        if (pool->hashes[id] == hash && pool->lens[id] == view.len) {
+            if (memcmp(pool->strings[id], view.ptr, view.len) == 0) {
+                return id;
+            }
+        }
+        index = (index + 1) & (pool->slots_size - 1);
+    }
+
+    // new string
+    if (pool->len == pool->strings_size) {
+        size_t new_size = pool->strings_size * 2;
+        char** new_strings = realloc(pool->strings, new_size * sizeof(char*));
+        if (new_strings == NULL) {
+            pool_mem_error_exit_failing();
+        }
+        pool->strings = new_strings;
+        size_t* new_hashes = realloc(pool->hashes, new_size * sizeof(size_t));
+        if (new_hashes == NULL) {
+            pool_mem_error_exit_failing();
+        }
+        pool->hashes = new_hashes;
+        size_t* new_lens = realloc(pool->lens, new_size * sizeof(size_t));
+        if (new_lens == NULL) {
+            pool_mem_error_exit_failing();
+        }
+        pool->lens = new_lens;
+        pool->strings_size = new_size;
+    }
+
+    unsigned int id = pool->len;
+    pool->strings[id] = sp_copy(pool, view.ptr, view.len);
+    pool->hashes[id] = hash;
+    pool->lens[id] = view.len;
+    pool->slots[index] = id + 1;
+    ++pool->len;
+    pool->bytes += view.len + 1;
+
+    // keep the table at most half full
+    if (pool->len * 2 > pool->slots_size) {
+        sp_grow_slots(pool);
+    }
+
+    return id;
+}
+
+/*
+    Interns the characters in the view, returning the string's id in the
+    pool. Ids count up from 0 in the order strings were first added.
+*/
+unsigned int sp_intern_id(StringPool* pool, StringView view) {
+    return sp_intern_hashed(pool, view, sv_hash(view));
+}
+
+/*
+    Gets the interned string with the given id.
+*/
+char* sp_get(StringPool* pool, unsigned int id) {
+    return pool->strings[id];
+}
+
+/*
+    Interns the characters in the view, returning the pool's copy of them.
+*/
+char* sp_intern_view(StringPool* pool, StringView view) {
+    unsigned int id = sp_intern_id(pool, view);
+    return pool->strings[id];
+}
+
+/*
+    Interns a null terminated string, returning the pool's copy of it.
+*/
+char* sp_intern(StringPool* pool, char* str) {
+    return sp_intern_view(pool, sv(str));
+}
+
+/*
+    Returns 1 if the characters in the view have been interned.
+*/
+int sp_contains(StringPool* pool, StringView view) {
+    size_t hash = sv_hash(view);
+    size_t index = hash & (pool->slots_size - 1);
+    while (pool->slots[index] != 0) {
+        unsigned int id = pool->slots[index] - 1;
+        if (pool->hashes[id] == hash && pool->lens[id] == view.len && memcmp(pool->strings[id], view.ptr, view.len) == 0) {
+            return 1;
+        }
+        index = (index + 1) & (pool->slots_size - 1);
+    }
+    return 0;
+}
+
+
+
+#endif
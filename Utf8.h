@@ -0,0 +1,428 @@
+#ifndef UTF8
+#define UTF8
+
+#include "String.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+
+/*
+    UTF-8 aware functions for Strings and StringViews, which otherwise only
+    know about bytes.
+
+    ```
+    String* ss = new_string();
+    append(ss, "(╯°□°）╯︵ ┻━┻");
+    utf8_valid(ss); // 1
+    utf8_len(ss); // 12 characters (in 30 bytes)
+    display_width(ss); // 14 terminal columns, "）" and "︵" are double width
+    ```
+
+    display_width() counts how many terminal columns text takes up, so
+    columns of text with box drawing characters, icons, CJK text and ANSI
+    colors (see AnsiiCodes.h) can be lined up. append_padded() does the
+    lining up:
+    ```
+    append_padded(line, sv(GREEN "✔" ANSI_RESET " done"), 10); // "✔ done" + 4 spaces
+    ```
+
+    Widths follow the usual terminal rules: most characters are 1 column,
+    East Asian wide characters and emoji are 2, and combining marks, zero
+    width characters, control characters and ANSI escape sequences are 0.
+
+
+
+    # DESIGN
+
+    Most CSV data and terminal text is plain ASCII, so every function checks
+    32 bytes at a time with AVX2 (or 16 with SSE2) when the compiler targets
+    them, skipping whole blocks of ASCII in a few instructions and only
+    decoding characters one at a time around non ASCII bytes. Counting code
+    points never decodes at all: it counts the bytes in each block that
+    aren't continuation bytes.
+
+*/
+
+
+#if defined(__AVX2__)
+#define UTF8_BLOCK 32
+#elif defined(__SSE2__)
+#define UTF8_BLOCK 16
+#endif
+
+#ifdef UTF8_BLOCK
+
+/*
+    bit i set if byte i of the block at 'p' isn't ASCII
+*/
+static inline unsigned int u_non_ascii_mask(char* p) {
+#if defined(__AVX2__)
+    return _mm256_movemask_epi8(_mm256_loadu_si256((__m256i*) p));
+#else
+    return _mm_movemask_epi8(_mm_loadu_si128((__m128i*) p));
+#endif
+}
+
+/*
+    bit i set if byte i of the block at 'p' starts a character (isn't a
+    continuation byte, 0x80 to 0xBF)
+*/
+static inline unsigned int u_lead_mask(char* p) {
+#if defined(__AVX2__)
+    __m256i block = _mm256_loadu_si256((__m256i*) p);
+    return _mm256_movemask_epi8(_mm256_cmpgt_epi8(block, _mm256_set1_epi8((char) 0xBF)));
+#else
+    __m128i block = _mm_loadu_si128((__m128i*) p);
+    return _mm_movemask_epi8(_mm_cmpgt_epi8(block, _mm_set1_epi8((char) 0xBF)));
+#endif
+}
+
+/*
+    bit i set if byte i of the block at 'p' isn't printable ASCII
+    (a control character, DEL or non ASCII)
+*/
+static inline unsigned int u_non_printable_mask(char* p) {
+#if defined(__AVX2__)
+    __m256i block = _mm256_loadu_si256((__m256i*) p);
+    __m256i low = _mm256_cmpgt_epi8(_mm256_set1_epi8(0x20), block); // < 0x20 or >= 0x80 (signed)
+    __m256i del = _mm256_cmpeq_epi8(block, _mm256_set1_epi8(0x7F));
+    return _mm256_movemask_epi8(_mm256_or_si256(low, del));
+#else
+    __m128i block = _mm_loadu_si128((__m128i*) p);
+    __m128i low = _mm_cmplt_epi8(block, _mm_set1_epi8(0x20)); // < 0x20 or >= 0x80 (signed)
+    __m128i del = _mm_cmpeq_epi8(block, _mm_set1_epi8(0x7F));
+    return _mm_movemask_epi8(_mm_or_si128(low, del));
+#endif
+}
+
+#endif
+
+
+
+/*
+    Decodes the character starting at 'p' (with 'len' bytes left), setting
+    'code_point'. Returns how many bytes it takes up, or 0 if it isn't valid
+    UTF-8 (overlong, a surrogate, past U+10FFFF or cut short).
+*/
+static size_t u_decode(unsigned char* p, size_t len, unsigned int* code_point) {
+    unsigned char b = p[0];
+    if (b < 0x80) {
+        *code_point = b;
+        return 1;
+    }
+
+    size_t n;
+    unsigned int cp;
+    unsigned char min = 0x80;
+    unsigned char max = 0xBF;
+    if (b >= 0xC2 && b <= 0xDF) {
+        n = 2;
+        cp = b & 0x1F;
+    }
+    else if (b >= 0xE0 && b <= 0xEF) {
+        n = 3;
+        cp = b & 0x0F;
+        if (b == 0xE0) min = 0xA0; // overlong
+        if (b == 0xED) max = 0x9F; // surrogates
+    }
+    else if (b >= 0xF0 && b <= 0xF4) {
+        n = 4;
+        cp = b & 0x07;
+        if (b == 0xF0) min = 0x90; // overlong
+        if (b == 0xF4) max = 0x8F; // past U+10FFFF
+    }
+    else {
+        return 0;
+    }
+
+    if (len < n || p[1] < min || p[1] > max) {
+        return 0;
+    }
+    cp = (cp << 6) | (p[1] & 0x3F);
+    for (size_t i = 2; i < n; ++i) {
+        if ((p[i] & 0xC0) != 0x80) {
+            return 0;
+        }
+        cp = (cp << 6) | (p[i] & 0x3F);
+    }
+
+    *code_point = cp;
+    return n;
+}
+
+
+
+/*
+    Returns 1 if the view is valid UTF-8.
+*/
+int sv_utf8_valid(StringView view) {
+    unsigned char* p = (unsigned char*) view.ptr;
+    size_t len = view.len;
+    size_t i = 0;
+
+    while (i < len) {
+#ifdef UTF8_BLOCK
+        // skip blocks of ASCII
+        if (i + UTF8_BLOCK <= len && u_non_ascii_mask((char*) p + i) == 0) {
+            i += UTF8_BLOCK;
+            continue;
+        }
+#endif
+        if (p[i] < 0x80) {
+            ++i;
+            continue;
+        }
+        unsigned int code_point;
+        size_t n = u_decode(p + i, len - i, &code_point);
+        if (n == 0) {
+            return 0;
+        }
+        i += n;
+    }
+
+    return 1;
+}
+
+/*
+    Returns the number of characters (code points) in the view, which
+    should be valid UTF-8 (see sv_utf8_valid()).
+*/
+size_t sv_utf8_len(StringView view) {
+    size_t count = 0;
+    size_t i = 0;
+#ifdef UTF8_BLOCK
+    for (; i + UTF8_BLOCK <= view.len; i += UTF8_BLOCK) {
+        count += __builtin_popcount(u_lead_mask(view.ptr + i));
+    }
+#endif
+    for (; i < view.len; ++i) {
+        count += ((unsigned char) view.ptr[i] & 0xC0) != 0x80;
+    }
+    return count;
+}
+
+/*
+    Decodes the next character of 'rest' into 'code_point' and moves 'rest'
+    past it. Invalid bytes decode to U+FFFD (the replacement character) one
+    byte at a time. Returns 0 once 'rest' is empty.
+
+    ```
+    StringView rest = sv("a→b");
+    unsigned int code_point;
+    while (sv_utf8_next(&rest, &code_point)) {
+        // 'a', 0x2192, 'b'
+    }
+    ```
+*/
+int sv_utf8_next(StringView* rest, unsigned int* code_point) {
+    if (rest->len == 0) {
+        return 0;
+    }
+
+    size_t n = u_decode((unsigned char*) rest->ptr, rest->len, code_point);
+    if (n == 0) {
+        *code_point = 0xFFFD;
+        n = 1;
+    }
+    rest->ptr += n;
+    rest->len -= n;
+
+    return 1;
+}
+
+
+
+typedef struct UnicodeRange {
+    unsigned int first;
+    unsigned int last;
+} UnicodeRange;
+
+// combining marks and zero width characters (sorted)
+static const UnicodeRange u_zero_width[] = {
+    {0x0300, 0x036F}, {0x0483, 0x0489}, {0x0591, 0x05BD}, {0x0610, 0x061A},
+    {0x064B, 0x065F}, {0x0E31, 0x0E31}, {0x0E34, 0x0E3A}, {0x0E47, 0x0E4E},
+    {0x1AB0, 0x1AFF}, {0x1DC0, 0x1DFF}, {0x200B, 0x200F}, {0x202A, 0x202E},
+    {0x2060, 0x2064}, {0x20D0, 0x20FF}, {0xFE00, 0xFE0F}, {0xFE20, 0xFE2F},
+    {0xFEFF, 0xFEFF}, {0xE0100, 0xE01EF}
+};
+
+// East Asian wide and fullwidth characters, and emoji (sorted)
+static const UnicodeRange u_double_width[] = {
+    {0x1100, 0x115F}, {0x231A, 0x231B}, {0x2329, 0x232A}, {0x23E9, 0x23EC},
+    {0x23F0, 0x23F0}, {0x23F3, 0x23F3}, {0x25FD, 0x25FE}, {0x2614, 0x2615},
+    {0x2648, 0x2653}, {0x267F, 0x267F}, {0x2693, 0x2693}, {0x26A1, 0x26A1},
+    {0x26AA, 0x26AB}, {0x26BD, 0x26BE}, {0x26C4, 0x26C5}, {0x26CE, 0x26CE},
+    {0x26D4, 0x26D4}, {0x26EA, 0x26EA}, {0x26F2, 0x26F3}, {0x26F5, 0x26F5},
+    {0x26FA, 0x26FA}, {0x26FD, 0x26FD}, {0x2705, 0x2705}, {0x270A, 0x270B},
+    {0x2728, 0x2728}, {0x274C, 0x274C}, {0x274E, 0x274E}, {0x2753, 0x2755},
+    {0x2757, 0x2757}, {0x2795, 0x2797}, {0x27B0, 0x27B0}, {0x27BF, 0x27BF},
+    {0x2B1B, 0x2B1C}, {0x2B50, 0x2B50}, {0x2B55, 0x2B55}, {0x2E80, 0x303E},
+    {0x3041, 0x33FF}, {0x3400, 0x4DBF}, {0x4E00, 0x9FFF}, {0xA000, 0xA4CF},
+    {0xA960, 0xA97F}, {0xAC00, 0xD7A3}, {0xF900, 0xFAFF}, {0xFE10, 0xFE19},
+    {0xFE30, 0xFE6F}, {0xFF00, 0xFF60}, {0xFFE0, 0xFFE6}, {0x1F004, 0x1F004},
+    {0x1F0CF, 0x1F0CF}, {0x1F18E, 0x1F18E}, {0x1F191, 0x1F19A}, {0x1F200, 0x1F251},
+    {0x1F300, 0x1F64F}, {0x1F680, 0x1F6FF}, {0x1F7E0, 0x1F7EB}, {0x1F900, 0x1F9FF},
+    {0x1FA70, 0x1FAFF}, {0x20000, 0x2FFFD}, {0x30000, 0x3FFFD}
+};
+
+static int u_in_ranges(unsigned int code_point, const UnicodeRange* ranges, size_t num_ranges) {
+    if (code_point < ranges[0].first || code_point > ranges[num_ranges - 1].last) {
+        return 0;
+    }
+
+    size_t low = 0;
+    size_t high = num_ranges;
+    while (low < high) {
+        size_t mid = (low + high) / 2;
+        if (code_point > ranges[mid].last) {
+            low = mid + 1;
+        }
+        else if (code_point < ranges[mid].first) {
+            high = mid;
+        }
+        else {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+    Returns how many terminal columns a character takes up: 0, 1 or 2.
+    Control characters are 0.
+*/
+int utf8_char_width(unsigned int code_point) {
+    if (code_point >= 0x20 && code_point < 0x7F) {
+        return 1;
+    }
+    if (code_point < 0xA0) {
+        return 0; // control characters
+    }
+    if (u_in_ranges(code_point, u_zero_width, sizeof(u_zero_width) / sizeof(u_zero_width[0]))) {
+        return 0;
+    }
+    if (u_in_ranges(code_point, u_double_width, sizeof(u_double_width) / sizeof(u_double_width[0]))) {
+        return 2;
+    }
+    return 1;
+}
+
+/*
+    skips the ANSI escape sequence starting at 'p' (an ESC), returning
+    its length
+*/
+static size_t u_escape_len(unsigned char* p, size_t len) {
+    if (len < 2) {
+        return len;
+    }
+    if (p[1] != '[') {
+        return 2; // ESC and one character
+    }
+
+    // CSI: parameters and intermediates then a final byte 0x40 to 0x7E
+    size_t i = 2;
+    while (i < len && p[i] >= 0x20 && p[i] <= 0x3F) {
+        ++i;
+    }
+    if (i < len && p[i] >= 0x40 && p[i] <= 0x7E) {
+        ++i;
+    }
+    return i;
+}
+
+/*
+    Returns how many terminal columns the view takes up when printed,
+    skipping ANSI escape sequences.
+*/
+size_t sv_display_width(StringView view) {
+    unsigned char* p = (unsigned char*) view.ptr;
+    size_t len = view.len;
+    size_t width = 0;
+    size_t i = 0;
+
+    while (i < len) {
+#ifdef UTF8_BLOCK
+        // blocks of printable ASCII are a column per byte
+        if (i + UTF8_BLOCK <= len) {
+            unsigned int mask = u_non_printable_mask((char*) p + i);
+            if (mask == 0) {
+                width += UTF8_BLOCK;
+                i += UTF8_BLOCK;
+                continue;
+            }
+            size_t run = __builtin_ctz(mask);
+            width += run;
+            i += run;
+        }
+#endif
+        if (p[i] >= 0x20 && p[i] < 0x7F) {
+            ++width;
+            ++i;
+        }
+        else if (p[i] == 0x1B) {
+            i += u_escape_len(p + i, len - i);
+        }
+        else {
+            unsigned int code_point;
+            size_t n = u_decode(p + i, len - i, &code_point);
+            if (n == 0) {
+                width += 1; // shown as a replacement character
+                n = 1;
+            }
+            else {
+                width += utf8_char_width(code_point);
+            }
+            i += n;
+        }
+    }
+
+    return width;
+}
+
+
+
+/*
+    Returns 1 if the string is valid UTF-8.
+*/
+int utf8_valid(String* stream) {
+    return sv_utf8_valid(string_view(stream, 0, stream->len));
+}
+
+/*
+    Returns the number of characters (code points) in the string.
+*/
+size_t utf8_len(String* stream) {
+    return sv_utf8_len(string_view(stream, 0, stream->len));
+}
+
+/*
+    Returns how many terminal columns the string takes up when printed.
+*/
+size_t display_width(String* stream) {
+    return sv_display_width(string_view(stream, 0, stream->len));
+}
+
+/*
+    Appends 'text' followed by enough spaces for it to take up 'width'
+    terminal columns (text already wider than 'width' isn't cut).
+    returns 0 if successful
+*/
+int append_padded(String* stream, StringView text, size_t width) {
+    size_t text_width = sv_display_width(text);
+    size_t pad = text_width < width ? width - text_width : 0;
+    if (reserve_string(stream, text.len + pad) != 0) {
+        return 1;
+    }
+    append_n(stream, text.ptr, text.len);
+    memset(stream->buffer + stream->end, ' ', pad);
+    stream->end += pad;
+    stream->len += pad;
+    stream->buffer[stream->end] = '\0';
+    return 0;
+}
+
+
+
+#endif
@@ -1,8 +1,21 @@
 #include <stdio.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
 #include "List.h"
+#include "Deque.h"
 #include "Map.h"
 #include "String.h"
 #include "Set.h"
+#include "StringPool.h"
+#include "Rope.h"
+#include "Numeric.h"
+#include "Arena.h"
+#include "Pool.h"
+#include "Utf8.h"
+#include "Csv.h"
+#include "Columns.h"
+#include "AnsiiCodes.h"
 #include "CsvDb.h"
 
 /*
@@ -228,12 +241,202 @@ void list_test_push_push_front_pop_pop_front_resize_get_set() {
     assert(*t == 5, "slice check");
     free_list(slice_list, 0);
 
+    ListView view = l_view(list, 1, 4);
+    assert(view.len == 3 && *(int*) lv_get(view, 0) == 3, "view check");
+    assert(*(int*) lv_get(view, 2) == 5, "view check");
+    view = l_view(list, -3, list->len);
+    assert(*(int*) lv_get(lv_slice(view, 1, 3), 1) == 15, "view slice check");
+
+
+    // shrinking keeps elements and mask wrapping
+    for (int i = 0; i < 100; ++i) {
+        l_push(list, &i13);
+    }
+    while (list->len > 3) {
+        l_pop(list);
+    }
+    l_shrink_to_fit(list);
+    assert(list->data_size == 4 && list->mask == 3, "shrink to fit");
+    t = (int*) l_get(list, 1);
+    assert(*t == 3, "shrink to fit keeps elements");
+
+    list->growth_factor = 1.5;
+    l_push(list, &i14);
+    l_push(list, &i15);
+    assert(list->data_size == 6, "growth factor");
+    t = (int*) l_get(list, -1);
+    assert(*t == 15, "growth factor keeps elements");
 
     free_list(list, 0);
 
 
 }
 
+double elapsed_ms(struct timespec start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start.tv_sec) * 1000.0 + (now.tv_nsec - start.tv_nsec) / 1000000.0;
+}
+
+/*
+    Compares push/pop/get throughput of a list using modulo wrapping
+    (a size that isn't a power of two) against the default mask wrapping.
+*/
+void list_benchmark() {
+
+    size_t n = 10000000;
+    int value = 1;
+    char* names[2] = {"modulo (new_list_s(10))", "mask (new_list())"};
+
+    for (int mode = 0; mode < 2; ++mode) {
+        List* list = mode == 0 ? new_list_s(10) : new_list();
+        struct timespec start;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (size_t i = 0; i < n; ++i) {
+            if (i % 2 == 0) l_push(list, &value);
+            else l_push_front(list, &value);
+        }
+        printf("%s push: %.1f ms\n", names[mode], elapsed_ms(start));
+
+        size_t sum = 0;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int i = 0; i < list->len; ++i) {
+            sum += *(int*) l_get(list, i);
+        }
+        printf("%s l_get: %.1f ms\n", names[mode], elapsed_ms(start));
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (size_t i = 0; i < list->len; ++i) {
+            sum += *(int*) l_get_unchecked(list, i);
+        }
+        printf("%s l_get_unchecked: %.1f ms\n", names[mode], elapsed_ms(start));
+        assert(sum == 2 * n, "benchmark sum");
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        while (list->len > 0) {
+            if (list->len % 2 == 0) l_pop(list);
+            else l_pop_front(list);
+        }
+        printf("%s pop: %.1f ms\n", names[mode], elapsed_ms(start));
+
+        free_list(list, 0);
+    }
+}
+
+int compare_ints(const void* a, const void* b) {
+    int x = **(int**) a;
+    int y = **(int**) b;
+    return (x > y) - (x < y);
+}
+
+void list_sort_test() {
+
+    // wrapped list sorts in place
+    List* list = new_list();
+    int values[300];
+    for (int i = 0; i < 300; ++i) {
+        values[i] = (i * 7919) % 300;
+        if (i % 2 == 0) l_push(list, &values[i]);
+        else l_push_front(list, &values[i]);
+    }
+    size_t data_size = list->data_size;
+    l_sort(list, compare_ints);
+    int sorted = list->data_size == data_size;
+    for (int i = 0; i < 300; ++i) {
+        sorted = sorted && *(int*) l_get(list, i) == i;
+    }
+    assert(sorted, "l_sort sorts without reallocating");
+
+    l_sort_parallel(list, compare_ints, 3);
+    sorted = 1;
+    for (int i = 0; i < 300; ++i) {
+        sorted = sorted && *(int*) l_get(list, i) == i;
+    }
+    assert(sorted, "l_sort_parallel");
+    free_list(list, 0);
+
+    // strings
+    list = new_list();
+    char* words[] = {"CSV/17.trans", "b", "", "CSV/1700.trans", "abc", "ab", "CSV/16.trans", "\xff", "a"};
+    size_t num_words = sizeof(words) / sizeof(words[0]);
+    for (int r = 0; r < 10; ++r) {
+        for (size_t i = 0; i < num_words; ++i) {
+            l_push_front(list, words[i]);
+        }
+    }
+    l_sort_str(list);
+    sorted = 1;
+    for (size_t i = 1; i < list->len; ++i) {
+        sorted = sorted && strcmp(l_get(list, i - 1), l_get(list, i)) <= 0;
+    }
+    assert(sorted, "l_sort_str");
+    free_list(list, 0);
+}
+
+void deque_test() {
+
+    Deque* deque = new_deque();
+    size_t n = DEQUE_CHUNK_SIZE * 20 + 7;
+    int* values = malloc(n * sizeof(int));
+    for (size_t i = 0; i < n; ++i) {
+        values[i] = i;
+    }
+
+    // 0..n/2 pushed to the front in reverse, the rest pushed to the back
+    for (size_t i = n / 2; i > 0; --i) {
+        d_push_front(deque, &values[i - 1]);
+    }
+    void** ref = d_get_ref(deque, 0);
+    for (size_t i = n / 2; i < n; ++i) {
+        d_push(deque, &values[i]);
+    }
+    assert(deque->len == n, "deque len");
+    assert(*ref == &values[0], "deque slots don't move");
+
+    int in_order = 1;
+    for (size_t i = 0; i < n; ++i) {
+        in_order = in_order && *(int*) d_get(deque, i) == i;
+    }
+    assert(in_order, "deque get");
+    assert(*(int*) d_get(deque, -1) == n - 1, "deque negative get");
+
+    d_set(deque, 5, &values[0]);
+    assert(*(int*) d_get(deque, 5) == 0, "deque set");
+
+    // drain from both ends
+    int popped_in_order = 1;
+    size_t front = 0;
+    size_t back = n;
+    while (deque->len > 0) {
+        if (deque->len % 3 == 0) {
+            --back;
+            popped_in_order = popped_in_order && *(int*) d_pop(deque) == back;
+        }
+        else {
+            int v = *(int*) d_pop_front(deque);
+            popped_in_order = popped_in_order && (front == 5 || v == front);
+            ++front;
+        }
+    }
+    assert(popped_in_order && front == back, "deque pop both ends");
+    assert(d_pop(deque) == NULL && d_pop_front(deque) == NULL, "deque empty pop");
+
+    // back and forth across a chunk boundary
+    for (int r = 0; r < 3; ++r) {
+        for (size_t i = 0; i < DEQUE_CHUNK_SIZE + 1; ++i) {
+            d_push_front(deque, &values[i]);
+        }
+        for (size_t i = 0; i < DEQUE_CHUNK_SIZE + 1; ++i) {
+            d_pop(deque);
+        }
+    }
+    assert(deque->len == 0 && deque->num_chunks == 0, "deque reuse");
+
+    free_deque(deque, 0);
+    free(values);
+}
+
 void map_resizing_all_methods() {
 
     // Testing with Structs
@@ -361,9 +564,1445 @@ void stringstream_test() {
     ss = replace(ss, "at", "@+");
     printf("%s\n", str(ss));
 
+    assert(equals(ss, "Th@+'s wh@+ hi bye! beautiful!"), "replace");
+    assert(!equals(ss, "Th@+'s"), "equals prefix isn't equal");
+    assert(contains_str(ss, "bye! beau"), "contains");
+    assert(!contains_str(ss, "bye!!"), "doesn't contain");
+    assert(starts_with(ss, "Th@+") && !starts_with(ss, "Th@+'s wh@+ hi bye! beautiful!!"), "starts with");
+    assert(ends_with(ss, "ful!") && !ends_with(ss, "full!"), "ends with");
+
+    size_t num_splits;
+    String** splits = split(ss, "@+", &num_splits);
+    assert(num_splits == 3, "split count");
+    assert(equals(splits[0], "Th") && equals(splits[2], " hi bye! beautiful!"), "split pieces");
+    free_strings(splits, num_splits);
+
+    String* long_ss = new_string();
+    for (int i = 0; i < 100; ++i) {
+        append(long_ss, "user_123,bob@gmail.com,12\n");
+    }
+    append(long_ss, "needle,in,haystack");
+    assert(contains_str(long_ss, "needle,in,haystack"), "contains past simd blocks");
+    splits = split(long_ss, "\n", &num_splits);
+    assert(num_splits == 101 && equals(splits[100], "needle,in,haystack"), "split lines");
+    free_strings(splits, num_splits);
+    long_ss = replace(long_ss, "bob", "robert");
+    assert(long_ss->len == 100 * 29 + 18 && starts_with(long_ss, "user_123,robert@"), "replace many");
+    free_string(long_ss);
+
+    String* row_ss = new_string();
+    char* cells[] = {"user_123", "bob@gmail.com", "12"};
+    append_join(row_ss, cells, 3, ",");
+    append_n(row_ss, "\nxyz", 2);
+    append_f(row_ss, "%s=%d;", "likes", 12);
+    for (int i = 0; i < 40; ++i) {
+        append_f(row_ss, "%05d", i);
+    }
+    assert(starts_with(row_ss, "user_123,bob@gmail.com,12\nxlikes=12;00000000010000200003"), "append join, n and f");
+    assert(ends_with(row_ss, "00039") && row_ss->len == 26 + 1 + 9 + 200, "append f resizes");
+    free_string(row_ss);
+
+    String small_ss;
+    init_string(&small_ss);
+    append(&small_ss, "short");
+    append_front(&small_ss, "a ");
+    assert(small_ss.buffer == small_ss.small && equals(&small_ss, "a short"), "small string stays inline");
+    append(&small_ss, " string that is now too long");
+    assert(small_ss.buffer != small_ss.small && equals(&small_ss, "a short string that is now too long"), "small string moves to heap");
+    free_string_buffer(&small_ss);
+
+    String* cell = new_string();
+    append(cell, "bob@gmail.com");
+    assert(cell->buffer == cell->small, "new string starts inline");
+    char* cell_str = free_string_str(cell);
+    assert(strcmp(cell_str, "bob@gmail.com") == 0, "inline string to str");
+    free(cell_str);
+
+    // prepending keeps the string in one piece and in a buffer that
+    // doesn't grow out of proportion
+    String* both_ss = new_string();
+    for (int i = 0; i < 10000; ++i) {
+        append_front_c(both_ss, 'a' + i % 26);
+        append_c(both_ss, 'a' + i % 26);
+        if (i % 100 == 0) {
+            append_front(both_ss, "<");
+            append(both_ss, ">");
+        }
+    }
+    char* both_str = str(both_ss);
+    int mirrored = both_ss->len == 20200 && strlen(both_str) == both_ss->len;
+    for (size_t i = 0; i < both_ss->len; ++i) {
+        char c = both_str[i];
+        char mirror = both_str[both_ss->len - 1 - i];
+        mirrored &= c == mirror || (c == '<' && mirror == '>') || (c == '>' && mirror == '<');
+    }
+    assert(mirrored && char_at(both_ss, 0) == 'z' - 25 + 9999 % 26, "append front and back");
+    assert(both_ss->buffer_size <= 4 * both_ss->len, "prepending buffer size");
+    assert(str(both_ss) == both_str, "str doesn't move the string");
+    StringView both_view = string_view(both_ss, 1, 3);
+    assert(both_view.ptr == both_str + 1, "string view of a prepended string");
+    both_str = free_string_str(both_ss);
+    assert(strlen(both_str) == 20200 && both_str[0] == 'a' + 9999 % 26, "prepended string to str");
+    free(both_str);
+
+    string_shrink_to_fit(ss);
+    assert(ss->buffer_size == ss->len + 1, "string shrink to fit");
+    append(ss, "!");
+    assert(str(ss)[ss->len - 1] == '!', "append after shrink");
+    String* sub_ss = substr(ss, 0, 4);
+    string_shrink_to_fit(ss);
+    assert(ss->buffer != ss->small, "long string stays on heap");
+    assert(sub_ss->buffer == sub_ss->small && equals(sub_ss, "Th@+"), "short substr is inline");
+    free_string(sub_ss);
+
+
+    free_string(ss);
+
+}
+
+void string_view_test() {
+
+    String* ss = new_string();
+    append(ss, "bob@gmail.com,12,");
+    append_front(ss, "user_123,");
+
+    StringView rest = string_view(ss, 0, ss->len);
+    StringView cells[4];
+    int num_cells = 0;
+    StringView cell;
+    while (sv_split_next(&rest, ',', &cell)) {
+        cells[num_cells++] = cell;
+    }
+    assert(num_cells == 4, "view split count");
+    assert(sv_equals_str(cells[0], "user_123"), "view split first");
+    assert(sv_equals_str(cells[1], "bob@gmail.com"), "view split middle");
+    assert(cells[3].len == 0, "view split trailing empty");
+
+    assert(sv_find(cells[1], sv("gmail")) == 4, "view find");
+    assert(sv_find(cells[1], sv("gmx")) == -1, "view find missing");
+    assert(sv_find_c(cells[1], '@') == 3, "view find char");
+    assert(sv_compare(cells[0], sv("user_124")) < 0, "view compare");
+    assert(sv_compare(sv("user"), cells[0]) < 0, "view compare prefix");
+    assert(sv_hash(cells[0]) == sv_hash(sv("user_123")), "view hash");
+    assert(sv_starts_with(sv_slice(cells[1], 4, 100), "gmail.com"), "view slice");
+
+    char* copy = sv_to_str(cells[1]);
+    assert(strcmp(copy, "bob@gmail.com") == 0, "view to str");
+    free(copy);
+
+    free_string(ss);
+}
+
+/*
+    Measures split, contains_str and replace over a ~64MB csv like string.
+*/
+void string_benchmark() {
+
+    String* ss = new_string();
+    while (ss->len < 64 * 1024 * 1024) {
+        append(ss, "user_1234567,somebody@gmail.com,1234,active,US,2023-01-01\n");
+    }
+    double mb = ss->len / (1024.0 * 1024.0);
+    struct timespec start;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int found = contains_str(ss, "nobody@gmail.com");
+    double ms = elapsed_ms(start);
+    printf("contains_str (miss): %.1f ms, %.0f MB/s\n", ms, mb / (ms / 1000));
+
+    size_t num_splits;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    String** lines = split(ss, "\n", &num_splits);
+    ms = elapsed_ms(start);
+    printf("split into %zu lines: %.1f ms, %.0f MB/s\n", num_splits, ms, mb / (ms / 1000));
+    free_strings(lines, num_splits);
+
+    size_t cells = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    StringView rest = string_view(ss, 0, ss->len);
+    StringView cell;
+    while (sv_split_next(&rest, ',', &cell)) {
+        ++cells;
+    }
+    ms = elapsed_ms(start);
+    printf("sv_split_next over %zu cells: %.1f ms, %.0f MB/s\n", cells, ms, mb / (ms / 1000));
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    ss = replace(ss, "gmail", "yahoo");
+    ms = elapsed_ms(start);
+    printf("replace: %.1f ms, %.0f MB/s\n", ms, mb / (ms / 1000));
+
+    assert(!found, "benchmark search");
+    free_string(ss);
+}
+
+void string_pool_test() {
+
+    StringPool* pool = new_string_pool();
+    char* active = sp_intern(pool, "active");
+    char buffer[] = "inactive,active";
+    assert(sp_intern_view(pool, sv_n(buffer + 9, 6)) == active, "interned strings are the same pointer");
+    assert(sp_intern(pool, "inactive") != active && pool->len == 2, "different strings get different pointers");
+    assert(sp_intern_id(pool, sv("active")) == 0 && strcmp(sp_get(pool, 1), "inactive") == 0, "ids");
+    assert(sp_contains(pool, sv("inactive")) && !sp_contains(pool, sv("inact")), "pool contains");
+
+    // enough strings to grow the table and fill several blocks
+    char key[32];
+    char* first = NULL;
+    for (int i = 0; i < 20000; ++i) {
+        snprintf(key, sizeof(key), "country_%d", i % 5000);
+        char* interned = sp_intern(pool, key);
+        if (i == 0) first = interned;
+        if (i == 5000) assert(interned == first, "pointers are stable after growing");
+    }
+    assert(pool->len == 5002, "each value stored once");
+
+    char big[STRING_POOL_BLOCK_SIZE];
+    memset(big, 'x', sizeof(big) - 1);
+    big[sizeof(big) - 1] = '\0';
+    assert(strcmp(sp_intern(pool, big), big) == 0, "big strings");
+    assert(sp_intern(pool, "") == sp_intern(pool, ""), "empty string");
+
+    free_string_pool(pool);
+}
+
+void rope_test() {
+
+    Rope* rope = new_rope();
+    String* expected = new_string();
+
+    // appends and prepends that span several chunks
+    char* big = malloc(ROPE_CHUNK_SIZE * 2 + 10);
+    for (size_t i = 0; i < ROPE_CHUNK_SIZE * 2 + 9; ++i) {
+        big[i] = 'a' + i % 26;
+    }
+    big[ROPE_CHUNK_SIZE * 2 + 9] = '\0';
+
+    for (int i = 0; i < 1000; ++i) {
+        rope_append(rope, "user_123,bob@gmail.com,12\n");
+        append(expected, "user_123,bob@gmail.com,12\n");
+    }
+    rope_append(rope, big);
+    append(expected, big);
+    rope_prepend(rope, big);
+    append_front(expected, big);
+    rope_prepend(rope, "END\n");
+    append_front(expected, "END\n");
+    assert(rope->len == expected->len, "rope len");
+
+    char* path = "rope_test.txt";
+    assert(rope_write_file(rope, path) == 0, "rope write");
+    FILE* file = fopen(path, "r");
+    char* contents = malloc(expected->len + 1);
+    size_t read = fread(contents, 1, expected->len + 1, file);
+    fclose(file);
+    remove(path);
+    assert(read == expected->len && memcmp(contents, str(expected), read) == 0, "rope file contents");
+
+    free(contents);
+    free(big);
+    free_string(expected);
+    free_rope(rope);
+}
+
+void numeric_test() {
+
+    long l = 0;
+    assert(sv_to_long(sv("5723409234"), &l) == 0 && l == 5723409234L, "parse long");
+    assert(sv_to_long(sv("-1"), &l) == 0 && l == -1, "parse negative long");
+    assert(sv_to_long(sv("0000000000000000000000042"), &l) == 0 && l == 42, "parse leading zeros");
+    assert(sv_to_long(sv("9223372036854775807"), &l) == 0 && l == LONG_MAX, "parse LONG_MAX");
+    assert(sv_to_long(sv("-9223372036854775808"), &l) == 0 && l == LONG_MIN, "parse LONG_MIN");
+    assert(sv_to_long(sv("9223372036854775808"), &l) == 1, "long overflow fails");
+    assert(sv_to_long(sv("12a"), &l) == 1 && sv_to_long(sv(""), &l) == 1 && sv_to_long(sv("-"), &l) == 1, "bad longs fail");
+    char cells[] = "12,345";
+    assert(sv_to_long(sv_n(cells + 3, 3), &l) == 0 && l == 345, "parse long from a view");
+
+    double d = 0;
+    assert(sv_to_double(sv("19.99"), &d) == 0 && d == 19.99, "parse double");
+    assert(sv_to_double(sv("-0.001"), &d) == 0 && d == -0.001, "parse small double");
+    assert(sv_to_double(sv("1e-3"), &d) == 0 && d == 1e-3, "parse exponent");
+    assert(sv_to_double(sv(".5"), &d) == 0 && d == 0.5, "parse no integer part");
+    assert(sv_to_double(sv("inf"), &d) == 0 && d > 1e308, "parse inf");
+    assert(sv_to_double(sv("1.7976931348623157e308"), &d) == 0 && d == 1.7976931348623157e308, "parse slow path");
+    assert(sv_to_double(sv("1e"), &d) == 1 && sv_to_double(sv("."), &d) == 1 && sv_to_double(sv(" 1"), &d) == 1, "bad doubles fail");
+
+    char buffer[NUMERIC_BUFFER_SIZE];
+    format_long(LONG_MIN, buffer);
+    assert(strcmp(buffer, "-9223372036854775808") == 0, "format LONG_MIN");
+    format_double(0.1 + 0.2, buffer);
+    assert(strcmp(buffer, "0.30000000000000004") == 0, "format shortest");
+    format_double(19.99, buffer);
+    assert(strcmp(buffer, "19.99") == 0, "format price");
+    format_double(1e-20, buffer);
+    assert(strtod(buffer, NULL) == 1e-20, "format tiny");
+
+    // round trips against libc
+    int all_match = 1;
+    char libc[64];
+    srand(1);
+    for (int i = 0; i < 200000; ++i) {
+        long value = ((long) rand() << 31 | rand()) * (i % 2 ? 1 : -1) >> (i % 40);
+        snprintf(libc, sizeof(libc), "%ld", value);
+        format_long(value, buffer);
+        all_match &= strcmp(libc, buffer) == 0 && sv_to_long(sv(buffer), &l) == 0 && l == value;
+
+        double x = (double) rand() / RAND_MAX * n_powers_of_ten[i % 12] / n_powers_of_ten[i % 7];
+        snprintf(libc, sizeof(libc), "%.*g", i % 18, x);
+        all_match &= sv_to_double(sv(libc), &d) == 0 && d == strtod(libc, NULL);
+        format_double(x, buffer);
+        all_match &= strtod(buffer, NULL) == x && strlen(buffer) <= strlen(libc) + 2 + (i % 18 < 17 ? 17 : 0);
+    }
+    assert(all_match, "numeric round trips match libc");
+
+    String* ss = new_string();
+    append_long(ss, -42);
+    append_c(ss, ',');
+    append_double(ss, 2.5);
+    assert(equals(ss, "-42,2.5"), "append numbers");
+    free_string(ss);
+}
+
+void numeric_benchmark() {
+
+    size_t n = 2000000;
+    char** ints = malloc(n * sizeof(char*));
+    char** doubles = malloc(n * sizeof(char*));
+    char buffer[64];
+    srand(1);
+    for (size_t i = 0; i < n; ++i) {
+        snprintf(buffer, sizeof(buffer), "%ld", (long) rand() * rand());
+        ints[i] = strdup(buffer);
+        snprintf(buffer, sizeof(buffer), "%.2f", rand() / 1000.0);
+        doubles[i] = strdup(buffer);
+    }
+    struct timespec start;
+    unsigned long long_sum = 0;
+    double double_sum = 0;
+    double double_sum2 = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t i = 0; i < n; ++i) long_sum += (unsigned long) strtol(ints[i], NULL, 10);
+    printf("strtol: %.1f ms\n", elapsed_ms(start));
+
+    long l;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t i = 0; i < n; ++i) {
+        sv_to_long(sv(ints[i]), &l);
+        long_sum -= (unsigned long) l;
+    }
+    printf("sv_to_long: %.1f ms\n", elapsed_ms(start));
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t i = 0; i < n; ++i) double_sum += strtod(doubles[i], NULL);
+    printf("strtod: %.1f ms\n", elapsed_ms(start));
+
+    double d;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t i = 0; i < n; ++i) {
+        sv_to_double(sv(doubles[i]), &d);
+        double_sum2 += d;
+    }
+    printf("sv_to_double: %.1f ms\n", elapsed_ms(start));
+
+    size_t chars = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t i = 0; i < n; ++i) chars += snprintf(buffer, sizeof(buffer), "%ld", (long) i * 7919);
+    printf("snprintf %%ld: %.1f ms\n", elapsed_ms(start));
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t i = 0; i < n; ++i) chars -= format_long((long) i * 7919, buffer);
+    printf("format_long: %.1f ms\n", elapsed_ms(start));
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t i = 0; i < n; ++i) chars += snprintf(buffer, sizeof(buffer), "%.17g", i / 100.0);
+    printf("snprintf %%.17g: %.1f ms\n", elapsed_ms(start));
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t i = 0; i < n; ++i) chars += format_double(i / 100.0, buffer);
+    printf("format_double: %.1f ms\n", elapsed_ms(start));
+
+    assert(long_sum == 0 && double_sum == double_sum2 && chars > 0, "benchmark sums");
+    for (size_t i = 0; i < n; ++i) {
+        free(ints[i]);
+        free(doubles[i]);
+    }
+    free(ints);
+    free(doubles);
+}
+
+void arena_test() {
+
+    Arena* arena = new_arena();
+    char* a = arena_alloc(arena, 3);
+    char* b = arena_alloc(arena, 40);
+    assert(((size_t) a % ARENA_ALIGNMENT) == 0 && ((size_t) b % ARENA_ALIGNMENT) == 0, "arena alignment");
+    assert(arena_realloc(arena, b, 40, 200) == b, "arena grows last allocation in place");
+    char* big = arena_alloc(arena, ARENA_BLOCK_SIZE);
+    memset(big, 1, ARENA_BLOCK_SIZE);
+    assert(arena_alloc(arena, 16) == b + 208, "big allocations don't use up the current block");
+
+    // containers built in the arena
+    List* list = new_list_in(arena);
+    Map* map = new_map_in(arena);
+    Set* set = new_set_in(arena);
+    String* ss = new_string_in(arena);
+    int values[1000];
+    char key[16];
+    for (int i = 0; i < 1000; ++i) {
+        values[i] = i;
+        snprintf(key, sizeof(key), "key_%d", i);
+        l_push(list, &values[i]);
+        m_put(map, key, &values[i], sizeof(int));
+        s_any_add(set, &values[i], sizeof(int));
+        append(ss, key);
+    }
+    m_erase(map, "key_10");
+    assert(list->len == 1000 && *(int*) l_get(list, 999) == 999, "arena list");
+    assert(map->len == 999 && *(int*) m_get(map, "key_999") == 999 && m_get(map, "key_10") == NULL, "arena map");
+    assert(set->len == 1000 && s_any_contains(set, &values[500], sizeof(int)), "arena set");
+    assert(starts_with(ss, "key_0key_1") && ends_with(ss, "key_999"), "arena string");
+    free_list(list, 0); // allowed, but only the arena gives memory back
+    free_arena(arena);
+
+    // running out of memory returns errors instead of exiting
+    Arena* small = new_arena_s(1024, 8 * 1024);
+    List* small_list = new_list_in(small);
+    int failed = 0;
+    size_t pushed = 0;
+    while (!failed) {
+        failed = l_push(small_list, &values[0]);
+        pushed += !failed;
+    }
+    assert(pushed > 0 && small_list->len == pushed, "arena list push fails when full");
+
+    arena_reset(small);
+    String* small_ss = new_string_in(small);
+    assert(append(small_ss, "short") == 0, "arena reset reuses memory");
+    char* long_str = malloc(16 * 1024);
+    memset(long_str, 'a', 16 * 1024 - 1);
+    long_str[16 * 1024 - 1] = '\0';
+    assert(append(small_ss, long_str) == 1 && equals(small_ss, "short"), "arena string append fails and keeps string");
+
+    Map* small_map = new_map_in(small);
+    failed = 0;
+    for (int i = 0; i < 1000 && !failed; ++i) {
+        failed = m_int_put(small_map, i, &values[0], -1);
+    }
+    assert(failed && m_int_get(small_map, 0) != NULL, "arena map put fails and keeps map");
+
+    free(long_str);
+    free_arena(small);
+}
+
+static void* pool_release_worker(void* arg) {
+    (void) arg;
+    char* kept = pool_alloc(24);
+    pool_free(pool_alloc(100), 100);
+    pool_thread_release();
+    return kept;
+}
+
+static void* pool_adopt_worker(void* arg) {
+    PoolStats* stats = arg;
+    pool_free(pool_alloc(100), 100);
+    pool_alloc(24);
+    *stats = pool_stats();
+    pool_thread_release();
+    return NULL;
+}
+
+void pool_test() {
+
+    char* a = pool_alloc(24);
+    pool_free(a, 24);
+    PoolStats before = pool_stats();
+    char* b = pool_alloc(32); // same size class as 24
+    pool_free(b, 32);
+    char* large = pool_alloc(POOL_MAX_SIZE + 1);
+    pool_free(large, POOL_MAX_SIZE + 1);
+    PoolStats after = pool_stats();
+#ifndef POOL_USE_MALLOC
+    assert(a == b, "pool reuses freed objects");
+    assert(after.reused == before.reused + 1 && after.large == before.large + 1, "pool stats");
+#endif
+
+    // insert and erase churn on a map and set only reuses pooled memory
+    // once warmed up, and erasing keeps every other element reachable
+    Map* map = new_map();
+    Set* set = new_set();
+    int values[20000];
+    char key[32];
+    size_t warm_slabs = 0;
+    int all_found = 1;
+    for (int round = 0; round < 5; ++round) {
+        for (int i = 0; i < 20000; ++i) {
+            values[i] = i;
+            snprintf(key, sizeof(key), "user_%d", i);
+            m_put(map, key, &values[i], -1);
+            s_any_add(set, &values[i], sizeof(int));
+        }
+        for (int i = 0; i < 20000; i += 2) {
+            snprintf(key, sizeof(key), "user_%d", i);
+            m_erase(map, key);
+            all_found &= s_any_erase(set, &values[i], sizeof(int)) == 0;
+        }
+        for (int i = 1; i < 20000; i += 2) {
+            snprintf(key, sizeof(key), "user_%d", i);
+            all_found &= m_get(map, key) == &values[i] && s_any_contains(set, &values[i], sizeof(int));
+        }
+        for (int i = 1; i < 20000; i += 2) {
+            snprintf(key, sizeof(key), "user_%d", i);
+            m_erase(map, key);
+            s_any_erase(set, &values[i], sizeof(int));
+        }
+        if (round == 0) {
+            warm_slabs = pool_stats().slabs;
+        }
+    }
+    assert(all_found && map->len == 0 && set->len == 0, "map and set correct after churn");
+    int missing = -1;
+    assert(s_any_erase(set, &missing, sizeof(int)) == 1, "erase missing item");
+#ifndef POOL_USE_MALLOC
+    assert(pool_stats().slabs == warm_slabs, "churn doesn't take new slabs");
+#endif
+    free_map(map, 0);
+    free_set(set);
+
+    // a thread's objects outlive it, and what's left of its slabs is taken
+    // up by the next thread instead of a new slab
+    pthread_t thread;
+    char* kept = NULL;
+    pthread_create(&thread, NULL, pool_release_worker, NULL);
+    pthread_join(thread, (void**) &kept);
+    PoolStats adopted;
+    pthread_create(&thread, NULL, pool_adopt_worker, &adopted);
+    pthread_join(thread, NULL);
+    memset(kept, 'x', 24);
+    pool_free(kept, 24);
+#ifndef POOL_USE_MALLOC
+    assert(adopted.slabs == 0 && adopted.reused == 1, "released thread pools are taken up");
+#endif
+}
+
+void utf8_test() {
 
+    String* ss = new_string();
+    append(ss, TABLE_FLIP);
+    assert(utf8_valid(ss), "table flip is valid");
+    assert(ss->len == 30 && utf8_len(ss) == 12, "table flip length");
+    assert(display_width(ss) == 14, "table flip width has two double width characters");
     free_string(ss);
 
+    assert(sv_display_width(sv(SHRUG)) == 10, "shrug width, katakana is double width");
+    assert(sv_display_width(sv(GREEN "ok" ANSI_RESET)) == 2, "ansi colors have no width");
+    assert(sv_display_width(sv("e\xcc\x81")) == 1, "combining mark has no width");
+    assert(sv_display_width(sv("\xe4\xbd\xa0\xe5\xa5\xbd")) == 4, "cjk is double width");
+    assert(sv_display_width(sv("\xf0\x9f\x98\x80")) == 2, "emoji is double width");
+
+    assert(!sv_utf8_valid(sv("\xc0\xaf")), "overlong is invalid");
+    assert(!sv_utf8_valid(sv("\xed\xa0\x80")), "surrogate is invalid");
+    assert(!sv_utf8_valid(sv("\xf4\x90\x80\x80")), "past U+10FFFF is invalid");
+    assert(!sv_utf8_valid(sv("abc\xe2\x94")), "cut short is invalid");
+    assert(sv_utf8_valid(sv("\xf4\x8f\xbf\xbf")), "U+10FFFF is valid");
+
+    // long enough to go through the SIMD blocks, with multibyte characters
+    // on either side of block boundaries
+    String* line = new_string();
+    for (int i = 0; i < 100; ++i) {
+        append(line, "col_value,");
+        if (i % 7 == 0) append(line, "\xe2\x94\x81"); // ━
+    }
+    assert(utf8_valid(line) && utf8_len(line) == 1015 && display_width(line) == 1015, "long line");
+    append_c(line, (char) 0xff);
+    assert(!utf8_valid(line), "invalid byte at the end");
+    free_string(line);
+
+    StringView rest = sv("a\xe2\x86\x92\xff");
+    unsigned int code_points[4];
+    int n = 0;
+    while (sv_utf8_next(&rest, &code_points[n])) ++n;
+    assert(n == 3 && code_points[0] == 'a' && code_points[1] == 0x2192 && code_points[2] == 0xFFFD, "decode");
+
+    String* table = new_string();
+    append_padded(table, sv(RED "\xe2\x9c\x98" ANSI_RESET " fail"), 10);
+    append_c(table, '|');
+    assert(display_width(table) == 11 && ends_with(table, "fail    |"), "append padded");
+    free_string(table);
+}
+
+void csv_test() {
+
+    String scratch;
+    init_string(&scratch);
+    char* data = "id,name,quote\r\n"
+        "u1,\"Smith, Bob\",\"says \"\"hi\"\"\"\r\n"
+        "u2,,\"two\nlines\"\n"
+        "\n"
+        "u3,last";
+    char* expected[] = {"id", "name", "quote", "u1", "Smith, Bob", "says \"hi\"", "u2", "", "two\nlines", "", "u3", "last"};
+    int expected_last[] = {0, 0, 1, 0, 0, 1, 0, 0, 1, 1, 0, 1};
+    CsvScanner scanner = csv_scan(sv(data));
+    StringView field;
+    int last;
+    int n = 0;
+    int fields_ok = 1;
+    while (csv_next_field(&scanner, &field, &last)) {
+        fields_ok &= n < 12 && sv_equals_str(csv_field_value(field, &scratch), expected[n]) && last == expected_last[n];
+        ++n;
+    }
+    assert(fields_ok && n == 12, "csv fields");
+
+    scanner = csv_scan(sv(data));
+    StringView record;
+    n = 0;
+    while (csv_next_record(&scanner, &record)) ++n;
+    assert(n == 5, "csv records");
+    scanner = csv_scan(sv("a,b\n"));
+    n = 0;
+    while (csv_next_field(&scanner, &field, &last)) ++n;
+    assert(n == 2, "no record after the last line ending");
+
+    // quoted fields that cross 64 byte blocks
+    String* long_ss = new_string();
+    for (int i = 0; i < 50; ++i) {
+        append(long_ss, "k,\"");
+        for (int j = 0; j < i * 3; ++j) append(long_ss, j % 7 == 0 ? "\"\"" : j % 5 == 0 ? ",\n" : "x");
+        append(long_ss, "\",end\n");
+    }
+    scanner = csv_scan(string_view(long_ss, 0, long_ss->len));
+    n = 0;
+    int ends_ok = 1;
+    while (csv_next_record(&scanner, &record)) {
+        ends_ok &= sv_starts_with(record, "k,\"") && record.ptr[record.len - 1] == 'd';
+        ++n;
+    }
+    assert(n == 50 && ends_ok, "csv records across blocks");
+    assert(csv_count_quotes(string_view(long_ss, 0, long_ss->len)) % 2 == 0, "csv count quotes");
+    free_string(long_ss);
+
+    // writing quotes what needs it, and reads back the same
+    char* cells[] = {"u1", "Smith, Bob", "says \"hi\"", "two\nlines", "plain"};
+    String* row_ss = new_string();
+    append_csv_row(row_ss, cells, 5);
+    assert(equals(row_ss, "u1,\"Smith, Bob\",\"says \"\"hi\"\"\",\"two\nlines\",plain"), "csv write row");
+    Row* row = parse_row(row_ss);
+    int row_ok = row->cells->len == 5;
+    for (int c = 0; c < 5 && row_ok; ++c) {
+        row_ok &= strcmp(l_get(row->cells, c), cells[c]) == 0;
+    }
+    assert(row_ok, "csv parse row round trip");
+    free_row(row);
+    free_string(row_ss);
+    free_string_buffer(&scratch);
+
+    // loading a table with quoted line breaks, serially and in parallel
+    char* path = "csv_test.csv";
+    FILE* file = fopen(path, "w");
+    fprintf(file, "id,bio,city\r\n");
+    for (int i = 0; i < 100000; ++i) {
+        if (i % 3 == 0) fprintf(file, "user_%d,\"likes \"\"csv\"\",\nand, commas %d\",paris\r\n", i, i % 10);
+        else fprintf(file, "user_%d,plain %d,tokyo\r\n", i, i % 10);
+    }
+    fclose(file);
+    CsvDb* serial_db = new_database();
+    load_csv(serial_db, path);
+    CsvDb* parallel_db = new_database();
+    load_csv_parallel(parallel_db, path, 3);
+    Table* serial = m_get(serial_db->table_name_to_table, "csv_test");
+    Table* parallel = m_get(parallel_db->table_name_to_table, "csv_test");
+    Row* a = m_get(serial->keys_to_rows, "user_99");
+    Row* b = m_get(parallel->keys_to_rows, "user_99");
+    assert(serial->keys_to_rows->len == 100000 && parallel->keys_to_rows->len == 100000, "load quoted csv rows");
+    assert(strcmp(l_get(serial->columns, 2), "city") == 0, "load csv crlf header");
+    assert(strcmp(l_get(a->cells, 1), "likes \"csv\",\nand, commas 9") == 0 && strcmp(l_get(a->cells, 2), "paris") == 0, "load quoted csv cells");
+    assert(strcmp(l_get(b->cells, 1), l_get(a->cells, 1)) == 0 && strcmp(l_get(b->cells, 2), "paris") == 0, "parallel load quoted csv cells");
+    free_database(serial_db);
+    free_database(parallel_db);
+    remove(path);
+}
+
+void csv_reader_test() {
+
+    // records longer than the buffer, quoted line breaks, escaped quotes,
+    // blank lines and crlf, read through the smallest buffer
+    char* path = "reader_test.csv";
+    String* content = new_string();
+    for (int i = 0; i < 300; ++i) {
+        append_f(content, "key_%d,\"", i);
+        for (int j = 0; j < i; ++j) append(content, j % 9 == 0 ? "\"\"" : j % 4 == 0 ? ",\r\n" : "ab");
+        append(content, i % 2 ? "\",x\r\n" : "\",x\n\n");
+    }
+    write_to_file(path, str(content));
+
+    CsvReader* reader = new_csv_reader_s(path, 64);
+    CsvScanner scanner = csv_scan(string_view(content, 0, content->len));
+    String scratch;
+    init_string(&scratch);
+    int rows = 0;
+    int same = 1;
+    while (csv_read_row(reader)) {
+        StringView record;
+        csv_next_record(&scanner, &record);
+        if (record.len == 0) csv_next_record(&scanner, &record); // blank line
+        same &= sv_equals(reader->record, record) && reader->num_fields == 3;
+
+        CsvScanner fields = csv_scan(record);
+        StringView field;
+        int last;
+        for (size_t f = 0; csv_next_field(&fields, &field, &last); ++f) {
+            same &= sv_equals(reader->fields[f], csv_field_value(field, &scratch));
+        }
+        ++rows;
+    }
+    assert(rows == 300 && same && !reader->error, "csv reader rows match the scanner");
+    assert(reader->buffer_size < content->len, "csv reader buffer stays small");
+    free_csv_reader(reader);
+    free_string_buffer(&scratch);
+    free_string(content);
+
+    FILE* file = fopen(path, "w");
+    fprintf(file, "first line\nsecond");
+    fclose(file);
+    file = fopen(path, "r");
+    String* line = read_line(file);
+    assert(equals(line, "first line"), "read line");
+    free_string(line);
+    line = read_line(file);
+    assert(equals(line, "second") && read_line(file) == NULL, "read last line");
+    free_string(line);
+    fclose(file);
+
+    assert(new_csv_reader("missing.csv") == NULL, "csv reader missing file");
+    remove(path);
+}
+
+void load_csv_test() {
+
+    // no header on the first line, blank lines and no trailing newline
+    char* path = "load_test.csv";
+    write_to_file(path, "\nid,name,city\nu1,bob,paris\n\nu2,sarah,paris\nu3,,tokyo");
+
+    CsvDb* db = new_database();
+    load_csv(db, path);
+    Table* table = m_get(db->table_name_to_table, "load_test");
+    assert(table != NULL && table->columns->len == 3, "load csv header");
+    assert(table->keys_to_rows->len == 3, "load csv rows");
+    Row* u2 = m_get(table->keys_to_rows, "u2");
+    Row* u3 = m_get(table->keys_to_rows, "u3");
+    assert(strcmp(l_get(u2->cells, 1), "sarah") == 0, "load csv cells");
+    assert(strcmp(l_get(u3->cells, 1), "") == 0 && strcmp(l_get(u3->cells, 2), "tokyo") == 0, "load csv last line");
+    assert(l_get(u2->cells, 2) == l_get(((Row*) m_get(table->keys_to_rows, "u1"))->cells, 2), "load csv interns");
+    free_database(db);
+
+    write_to_file(path, "");
+    db = new_database();
+    load_csv(db, path);
+    table = m_get(db->table_name_to_table, "load_test");
+    assert(table->columns->len == 0 && table->keys_to_rows->len == 0, "load empty csv");
+    free_database(db);
+
+    // a file without an extension is named after the whole file name, and
+    // a key's later record replaces the earlier one
+    write_to_file("load_test_plain", "id,name\nu1,bob\nu1,ann\n");
+    db = new_database();
+    load_csv(db, "load_test_plain");
+    table = m_get(db->table_name_to_table, "load_test_plain");
+    assert(table != NULL, "table name without extension");
+    Row* u1 = m_get(table->keys_to_rows, "u1");
+    assert(table->keys_to_rows->len == 1 && strcmp(l_get(u1->cells, 1), "ann") == 0, "load csv duplicate key");
+    free_database(db);
+    remove("load_test_plain");
+    remove("load_test_plain.offsets");
+
+    // parallel loading gives the same table, with a row longer than the
+    // header and a duplicate key to check the file order is kept
+    FILE* file = fopen(path, "w");
+    fprintf(file, "id,email,likes\n");
+    for (int i = 0; i < 200000; ++i) {
+        fprintf(file, "user_%d,user_%d@gmail.com,%d\n", i, i % 5000, i % 100);
+    }
+    fprintf(file, "user_7,dup@gmail.com,1,extra\n");
+    fclose(file);
+    CsvDb* serial_db = new_database();
+    load_csv(serial_db, path);
+    CsvDb* parallel_db = new_database();
+    load_csv_parallel(parallel_db, path, 4);
+    Table* serial = m_get(serial_db->table_name_to_table, "load_test");
+    Table* parallel = m_get(parallel_db->table_name_to_table, "load_test");
+    int same = serial->keys_to_rows->len == 200000 && parallel->keys_to_rows->len == 200000;
+    char key[32];
+    for (int i = 0; i < 200000 && same; ++i) {
+        snprintf(key, sizeof(key), "user_%d", i);
+        Row* a = m_get(serial->keys_to_rows, key);
+        Row* b = m_get(parallel->keys_to_rows, key);
+        same &= a->cells->len == b->cells->len;
+        for (int c = 0; c < a->cells->len && same; ++c) {
+            same &= strcmp(l_get(a->cells, c), l_get(b->cells, c)) == 0;
+        }
+    }
+    assert(same, "parallel load matches serial load");
+    Row* dup = m_get(parallel->keys_to_rows, "user_7");
+    assert(dup->cells->len == 4 && strcmp(l_get(dup->cells, 3), "extra") == 0, "parallel load keeps file order");
+    Row* u5002 = m_get(parallel->keys_to_rows, "user_5002");
+    assert(l_get(u5002->cells, 1) == l_get(((Row*) m_get(parallel->keys_to_rows, "user_2"))->cells, 1), "parallel load interns");
+    free_database(serial_db);
+    free_database(parallel_db);
+    remove(path);
+}
+
+void columnar_test() {
+
+    // the store on its own, with short and long rows
+    ColumnStore* store = new_column_store(3);
+    for (int i = 0; i < 1000; ++i) {
+        char value[32];
+        snprintf(value, sizeof(value), "key_%d", i);
+        cs_push_value(store, sv(value));
+        if (i % 3 != 0) {
+            cs_push_value(store, sv("a value long enough to grow the column buffers a few times"));
+        }
+        if (i % 7 == 0) {
+            cs_push_value(store, sv("x"));
+            cs_push_value(store, sv("past the last column"));
+        }
+        assert(cs_end_row(store) == i, "column store row ids");
+    }
+    assert(store->num_rows == 1000 && strcmp(cs_get(store, 500, 0), "key_500") == 0, "column store get");
+    assert(cs_get_view(store, 3, 1).len == 0 && cs_get_view(store, 4, 1).len == 58, "column store missing values");
+    assert(cs_get_view(store, 7, 2).len == 1 && cs_get_view(store, 999, 2).len == 0, "column store extra values");
+    free_column_store(store);
+
+    // a columnar table holds the same cells as a row table
+    char* path = "columnar_test.csv";
+    FILE* file = fopen(path, "w");
+    fprintf(file, "id,email,likes\n\n");
+    for (int i = 0; i < 20000; ++i) {
+        fprintf(file, "user_%d,\"user_%d@gmail.com, \"\"quoted\"\"\",%d\n", i, i, i % 100);
+    }
+    fprintf(file, "user_7,dup@gmail.com\n");
+    fclose(file);
+
+    CsvDb* row_db = new_database();
+    load_csv(row_db, path);
+    CsvDb* column_db = new_database();
+    load_csv_columnar(column_db, path);
+    Table* rows = m_get(row_db->table_name_to_table, "columnar_test");
+    Table* columns = m_get(column_db->table_name_to_table, "columnar_test");
+    assert(columns->column_store != NULL && columns->keys_to_rows->len == 20000, "columnar load rows");
+    int same = 1;
+    char key[32];
+    for (int i = 0; i < 20000 && same; ++i) {
+        snprintf(key, sizeof(key), "user_%d", i);
+        for (int c = 0; c < 3 && same; ++c) {
+            char* a = table_get(rows, key, c);
+            char* b = table_get(columns, key, c);
+            same &= (i == 7 && c == 2) ? a == NULL && strcmp(b, "") == 0 : strcmp(a, b) == 0;
+        }
+    }
+    assert(same, "columnar load matches row load");
+    assert(strcmp(table_get(columns, "user_3", 1), "user_3@gmail.com, \"quoted\"") == 0, "columnar load unquotes");
+    assert(table_row_id(columns, "user_7") == 20000 && table_row_id(columns, "nobody") == -1, "columnar row ids");
+    assert(table_get(columns, "nobody", 0) == NULL && table_get(columns, "user_1", 3) == NULL, "columnar missing cells");
+    free_database(row_db);
+
+    // transactions add changed rows to the columns
+    List* row = new_list();
+    l_push(row, "user_5");
+    l_push(row, "new@gmail.com");
+    List* new_rows = new_list();
+    l_push(new_rows, row);
+    Map* table_name_to_rows = new_map();
+    m_put(table_name_to_rows, "columnar_test", new_rows, sizeof(new_rows));
+    Map* table_name_to_keys_to_delete = new_map();
+    m_put(table_name_to_keys_to_delete, "columnar_test", "user_9", sizeof(char*));
+    transaction(column_db, table_name_to_rows, table_name_to_keys_to_delete);
+    assert(strcmp(table_get(columns, "user_5", 1), "new@gmail.com") == 0 && strcmp(table_get(columns, "user_5", 2), "") == 0, "columnar transaction update");
+    assert(table_get(columns, "user_9", 0) == NULL && columns->keys_to_rows->len == 19999, "columnar transaction delete");
+    free_map(table_name_to_rows, 0);
+    free_map(table_name_to_keys_to_delete, 0);
+    free_list(new_rows, 0);
+    free_list(row, 0);
+    free_database(column_db);
+    remove(path);
+    remove("columnar_test.csv.snapshot");
+}
+
+void snapshot_test() {
+
+    char* path = "snapshot_test.csv";
+    char* snapshot = "snapshot_test.csv.snapshot";
+    FILE* file = fopen(path, "w");
+    fprintf(file, "id,email,likes,city\n");
+    for (int i = 0; i < 20000; ++i) {
+        fprintf(file, "user_%d,\"user_%d@gmail.com, \"\"quoted\"\"\",%d,city_%d\n", i, i, i % 100, i % 7);
+    }
+    fprintf(file, "user_7,dup@gmail.com,1,city_1\n");
+    fclose(file);
+    remove(snapshot);
+
+    // loading the csv writes a snapshot, and loading again uses it
+    CsvDb* row_db = new_database();
+    load_csv(row_db, path);
+    CsvDb* db = new_database();
+    load_csv_columnar(db, path);
+    struct stat st;
+    assert(stat(snapshot, &st) == 0, "snapshot written");
+    assert(((Table*) m_get(db->table_name_to_table, "snapshot_test"))->snapshot.data == NULL, "first load parses the csv");
+    free_database(db);
+
+    db = new_database();
+    load_csv_columnar(db, path);
+    Table* rows = m_get(row_db->table_name_to_table, "snapshot_test");
+    Table* table = m_get(db->table_name_to_table, "snapshot_test");
+    assert(table->snapshot.data != NULL && table->keys_to_rows->len == 0, "second load maps the snapshot");
+    assert(table_len(table) == 20000 && table->columns->len == 4 && strcmp(l_get(table->columns, 3), "city") == 0, "snapshot table");
+    int same = 1;
+    char key[32];
+    for (int i = 0; i < 20000 && same; ++i) {
+        snprintf(key, sizeof(key), "user_%d", i);
+        for (int c = 0; c < 4; ++c) {
+            same &= strcmp(table_get(rows, key, c), table_get(table, key, c)) == 0;
+        }
+    }
+    assert(same, "snapshot matches csv");
+    assert(table_row_id(table, "user_7") == 20000 && table_row_id(table, "nobody") == -1, "snapshot key index");
+    uint64_t* matches = malloc(cs_bitmap_words(table->column_store) * sizeof(uint64_t));
+    assert(cs_filter_equals(table->column_store, 3, sv("city_1"), matches) == 2858, "filter snapshot");
+    free(matches);
+    free_database(row_db);
+
+    // changes go to the heap, and the csv and snapshot are rewritten
+    List* row = new_list();
+    l_push(row, "user_5");
+    l_push(row, "new@gmail.com");
+    l_push(row, "5");
+    l_push(row, "city_new");
+    List* new_row = new_list();
+    l_push(new_row, "user_new");
+    l_push(new_row, "new_user@gmail.com");
+    List* new_rows = new_list();
+    l_push(new_rows, row);
+    l_push(new_rows, new_row);
+    Map* table_name_to_rows = new_map();
+    m_put(table_name_to_rows, "snapshot_test", new_rows, sizeof(new_rows));
+    Map* table_name_to_keys_to_delete = new_map();
+    m_put(table_name_to_keys_to_delete, "snapshot_test", "user_9", sizeof(char*));
+    db->last_write_ms = 0;
+    transaction(db, table_name_to_rows, table_name_to_keys_to_delete);
+    assert(strcmp(table_get(table, "user_5", 3), "city_new") == 0 && strcmp(table_get(table, "user_6", 3), "city_6") == 0, "snapshot table update");
+    assert(table_get(table, "user_9", 0) == NULL && table_len(table) == 20000, "snapshot table delete");
+    free_database(db);
+
+    db = new_database();
+    load_csv_columnar(db, path);
+    table = m_get(db->table_name_to_table, "snapshot_test");
+    assert(table->snapshot.data != NULL && table_len(table) == 20000, "rewritten snapshot");
+    assert(strcmp(table_get(table, "user_5", 1), "new@gmail.com") == 0 && strcmp(table_get(table, "user_new", 3), "") == 0, "rewritten snapshot rows");
+    assert(table_get(table, "user_9", 0) == NULL, "rewritten snapshot delete");
+    free_database(db);
+
+    // a snapshot claiming more key slots than it could hold isn't used
+    // (2^61 slots would wrap to 0 bytes, so the slots are cut out to leave
+    // the column store where it'd be read from)
+    size_t slots_at = 8 + sizeof(CsvStamp) + 8;
+    char* columns[4] = {"id", "email", "likes", "city"};
+    for (int c = 0; c < 4; ++c) {
+        slots_at += 8 + (strlen(columns[c]) + 7) / 8 * 8;
+    }
+    MappedFile saved;
+    map_file(snapshot, &saved);
+    char* saved_data = malloc(saved.size); // copied out, as the file is truncated
+    memcpy(saved_data, saved.data, saved.size);
+    size_t saved_size = saved.size;
+    unmap_file(&saved);
+    uint64_t num_slots;
+    memcpy(&num_slots, saved_data + slots_at, sizeof(num_slots));
+    uint64_t bad_slots = (uint64_t) 1 << 61;
+    size_t store_at = slots_at + 8 + num_slots * sizeof(uint64_t);
+    file = fopen(snapshot, "wb");
+    fwrite(saved_data, 1, slots_at, file);
+    fwrite(&bad_slots, sizeof(bad_slots), 1, file);
+    fwrite(saved_data + store_at, 1, saved_size - store_at, file);
+    fclose(file);
+    free(saved_data);
+    db = new_database();
+    load_csv_columnar(db, path);
+    table = m_get(db->table_name_to_table, "snapshot_test");
+    assert(table->snapshot.data == NULL && strcmp(table_get(table, "user_5", 1), "new@gmail.com") == 0, "snapshot with too many slots");
+    free_database(db);
+
+    // a csv changed without the database (to the same size) isn't read from
+    // its snapshot
+    file = fopen(path, "r+");
+    fprintf(file, "ID");
+    fclose(file);
+    db = new_database();
+    load_csv_columnar(db, path);
+    table = m_get(db->table_name_to_table, "snapshot_test");
+    assert(table->snapshot.data == NULL && strcmp(l_get(table->columns, 0), "ID") == 0, "stale snapshot");
+    free_database(db);
+
+    free_map(table_name_to_rows, 0);
+    free_map(table_name_to_keys_to_delete, 0);
+    free_list(new_rows, 0);
+    free_list(row, 0);
+    free_list(new_row, 0);
+    remove(path);
+    remove(snapshot);
+}
+
+/*
+    checks table_select_keys() finds 'count' rows, including 'key' if it
+    isn't NULL
+*/
+static int selects(Table* table, char* column, char* value, int count, char* key) {
+    List* keys = table_select_keys(table, column, value);
+    int found = key == NULL;
+    for (int i = 0; i < keys->len; ++i) {
+        found |= key != NULL && strcmp(l_get(keys, i), key) == 0;
+    }
+    int ok = keys->len == count && found;
+    free_list(keys, 1);
+    return ok;
+}
+
+void index_test() {
+
+    char* path = "index_test.csv";
+    char* table_name = "index_test";
+    for (int columnar = 0; columnar < 2; ++columnar) {
+        FILE* file = fopen(path, "w");
+        fprintf(file, "id,email,likes\n");
+        for (int i = 0; i < 5000; ++i) {
+            fprintf(file, "user_%d,user_%d@gmail.com,%d\n", i, i % 500, i % 7);
+        }
+        fprintf(file, "user_short\n");
+        fclose(file);
+
+        CsvDb* db = new_database();
+        if (columnar) {
+            load_csv_columnar(db, path);
+        }
+        else {
+            load_csv(db, path);
+        }
+        Table* table = m_get(db->table_name_to_table, table_name);
+
+        // scans and index lookups agree
+        assert(selects(table, "email", "user_3@gmail.com", 10, "user_503"), "select by scan");
+        assert(table_select_keys(table, "nope", "x") == NULL, "select missing column");
+        assert(index_column(db, table_name, "email") == 0 && index_column(db, table_name, "likes") == 0, "index columns");
+        assert(index_column(db, table_name, "nope") == 1 && index_column(db, "nope", "email") == 1, "index missing column");
+        assert(*(int*) m_get(table->columns_to_is_indexed, "email") && !*(int*) m_get(table->columns_to_is_indexed, "id"), "indexed flags");
+        assert(selects(table, "email", "user_3@gmail.com", 10, "user_4503"), "select by index");
+        assert(selects(table, "email", "nobody@gmail.com", 0, NULL), "select missing value");
+        assert(selects(table, "likes", "3", 714, "user_3"), "select by number index");
+        assert(selects(table, "likes", "", columnar, NULL), "select missing cells");
+
+        // transactions keep indices up to date
+        List* row = new_list();
+        l_push(row, "user_3");
+        l_push(row, "new@gmail.com");
+        l_push(row, "3");
+        List* new_row = new_list();
+        l_push(new_row, "user_new");
+        l_push(new_row, "user_3@gmail.com");
+        l_push(new_row, "100");
+        List* rows = new_list();
+        l_push(rows, row);
+        l_push(rows, new_row);
+        Map* table_name_to_rows = new_map();
+        m_put(table_name_to_rows, table_name, rows, sizeof(rows));
+        Map* table_name_to_keys_to_delete = new_map();
+        m_put(table_name_to_keys_to_delete, table_name, "user_503", sizeof(char*));
+        db->last_write_ms = 0;
+        transaction(db, table_name_to_rows, table_name_to_keys_to_delete);
+
+        assert(selects(table, "email", "user_3@gmail.com", 9, "user_new"), "index after update");
+        assert(!selects(table, "email", "user_3@gmail.com", 9, "user_3") && !selects(table, "email", "user_3@gmail.com", 9, "user_503"), "index after delete");
+        assert(selects(table, "email", "new@gmail.com", 1, "user_3") && selects(table, "likes", "3", 714, "user_3"), "index after unchanged value");
+        assert(selects(table, "likes", "100", 1, "user_new") && selects(table, "likes", "0", 715, "user_0"), "index after insert");
+
+        free_map(table_name_to_rows, 0);
+        free_map(table_name_to_keys_to_delete, 0);
+        free_list(rows, 0);
+        free_list(row, 0);
+        free_list(new_row, 0);
+        free_database(db);
+    }
+
+    // a columnar table without rows has no bitmap words to filter
+    write_to_file(path, "id,email,likes\n");
+    remove("index_test.csv.snapshot");
+    CsvDb* db = new_database();
+    load_csv_columnar(db, path);
+    assert(selects(m_get(db->table_name_to_table, table_name), "email", "x", 0, NULL), "select empty columnar table");
+    free_database(db);
+
+    remove(path);
+    remove("index_test.csv.snapshot");
+    remove("index_test.csv.offsets");
+}
+
+void memory_threshold_test() {
+
+    char* paths[2] = {"memory_rows.csv", "memory_columns.csv"};
+    for (int t = 0; t < 2; ++t) {
+        FILE* file = fopen(paths[t], "w");
+        fprintf(file, "id,email,likes\n");
+        for (int i = 0; i < 5000; ++i) {
+            fprintf(file, "user_%d,user_%d@gmail.com,%d\n", i, i % 500, i % 7);
+        }
+        fclose(file);
+    }
+    remove("memory_columns.csv.snapshot");
+
+    CsvDb* db = new_database();
+    load_csv(db, paths[0]);
+    load_csv_columnar(db, paths[1]);
+    Table* rows = m_get(db->table_name_to_table, "memory_rows");
+    Table* columns = m_get(db->table_name_to_table, "memory_columns");
+    index_column(db, "memory_rows", "email");
+    index_column(db, "memory_columns", "email");
+    Index* row_index = m_get(rows->column_values_to_indices, "email");
+    Index* column_index = m_get(columns->column_values_to_indices, "email");
+    size_t unlimited = db_memory(db);
+    assert(table_memory(rows) > 5000 * sizeof(Row) && table_memory(columns) > 5000 * 8, "table memory");
+    assert(unlimited == table_memory(rows) + table_memory(columns), "db memory");
+    assert(row_index->values_to_keys != NULL && columns->snapshot.data == NULL, "unlimited by default");
+
+    // the least recently used cache goes first
+    row_index->last_accessed_ms = 1;
+    db->memory_threshold = unlimited - 1;
+    enforce_memory_threshold(db);
+    assert(row_index->values_to_keys == NULL && row_index->bytes == 0, "oldest index let go");
+    assert(column_index->values_to_keys != NULL && columns->snapshot.data == NULL, "newer caches kept");
+    assert(db_memory(db) <= db->memory_threshold, "under threshold");
+
+    // with no room for caches, columnar tables are read from their snapshots
+    db->memory_threshold = 0;
+    enforce_memory_threshold(db);
+    assert(column_index->values_to_keys == NULL, "every index let go");
+    assert(columns->snapshot.data != NULL && columns->keys_to_rows->len == 0 && table_len(columns) == 5000, "table mapped");
+    assert(rows->row_offset_slots != NULL && rows->keys_to_rows->len == 0 && table_len(rows) == 5000, "rows read from csv");
+    assert(strcmp(table_get(columns, "user_4503", 1), "user_3@gmail.com") == 0, "get from mapped table");
+    size_t mapped = table_memory(columns);
+
+    // evicted indexes answer by scanning, until they're selected enough
+    for (size_t i = 1; i < INDEX_REBUILD_SCANS; ++i) {
+        assert(selects(columns, "email", "user_3@gmail.com", 10, "user_4503"), "select evicted index");
+    }
+    assert(column_index->values_to_keys == NULL, "evicted index not rebuilt yet");
+    assert(selects(columns, "email", "user_3@gmail.com", 10, "user_4503"), "select rebuilt index");
+    assert(column_index->values_to_keys != NULL && table_memory(columns) > mapped, "index rebuilt");
+
+    // scans and index rebuilds read a let go row table from its csv
+    // without bringing its rows back
+    db->memory_threshold = db_memory(db);
+    assert(selects(rows, "likes", "3", 714, "user_3"), "select let go rows");
+    assert(db_memory(db) <= db->memory_threshold && rows->row_offset_slots != NULL, "select keeps rows let go");
+    for (size_t i = 0; i < INDEX_REBUILD_SCANS; ++i) {
+        assert(selects(rows, "email", "user_3@gmail.com", 10, "user_4503"), "select let go rows by index");
+    }
+    assert(row_index->values_to_keys != NULL && rows->row_offset_slots != NULL && rows->keys_to_rows->len == 0, "index rebuilt from csv");
+    db->memory_threshold = 0;
+
+    // changed tables stay in memory until they're written
+    List* row = new_list();
+    l_push(row, "user_3");
+    l_push(row, "new@gmail.com");
+    l_push(row, "3");
+    List* new_rows = new_list();
+    l_push(new_rows, row);
+    Map* table_name_to_rows = new_map();
+    m_put(table_name_to_rows, "memory_columns", new_rows, sizeof(new_rows));
+    Map* table_name_to_keys_to_delete = new_map();
+    db->last_write_ms = current_time_ms();
+    transaction(db, table_name_to_rows, table_name_to_keys_to_delete);
+    assert(!columns->saved && columns->keys_to_rows->len == 1, "changed table kept");
+    assert(column_index->values_to_keys == NULL, "index let go after transaction");
+
+    // a table without rows to measure when it was loaded counts the rows
+    // transactions add to it
+    write_to_file("memory_new.csv", "id,email,likes\n");
+    load_csv(db, "memory_new.csv");
+    Table* made = m_get(db->table_name_to_table, "memory_new");
+    Map* table_name_to_new_rows = new_map();
+    m_put(table_name_to_new_rows, "memory_new", new_rows, sizeof(new_rows));
+    db->last_write_ms = current_time_ms();
+    transaction(db, table_name_to_new_rows, table_name_to_keys_to_delete);
+    assert(made->row_bytes > sizeof(Row) && table_memory(made) > sizeof(Table) + sizeof(Row), "empty table memory after insert");
+    free_map(table_name_to_new_rows, 0);
+
+    db->last_write_ms = 0;
+    transaction(db, table_name_to_rows, table_name_to_keys_to_delete);
+    assert(columns->saved && columns->keys_to_rows->len == 0, "written table mapped");
+    assert(strcmp(table_get(columns, "user_3", 1), "new@gmail.com") == 0 && table_len(columns) == 5000, "written table rows");
+
+    free_map(table_name_to_rows, 0);
+    free_map(table_name_to_keys_to_delete, 0);
+    free_list(new_rows, 0);
+    free_list(row, 0);
+    free_database(db);
+    remove(paths[0]);
+    remove(paths[1]);
+    remove("memory_rows.csv.offsets");
+    remove("memory_columns.csv.snapshot");
+    remove("memory_new.csv");
+    remove("memory_new.csv.offsets");
+}
+
+void row_offsets_test() {
+
+    char* path = "row_offsets_test.csv";
+    char* offsets = "row_offsets_test.csv.offsets";
+    FILE* file = fopen(path, "w");
+    fprintf(file, "id,email,likes\n");
+    for (int i = 0; i < 5000; ++i) {
+        fprintf(file, "user_%d,\"user_%d@gmail.com, \"\"quoted\"\"\",%d\n", i, i, i % 7);
+    }
+    fprintf(file, "\n\"user,quoted\",quoted@gmail.com,1\r\n");
+    fprintf(file, "user_7,dup@gmail.com,1\n");
+    fprintf(file, "\"\"\"q\"\"\",q@gmail.com,4\n");
+    fclose(file);
+    remove(offsets);
+
+    CsvDb* row_db = new_database();
+    load_csv(row_db, path);
+    CsvDb* db = new_database();
+    load_csv(db, path);
+    Table* rows = m_get(row_db->table_name_to_table, "row_offsets_test");
+    Table* table = m_get(db->table_name_to_table, "row_offsets_test");
+    assert(table->saved && table->row_offset_slots == NULL, "loaded table in memory");
+
+    // letting go of the rows writes the sidecar, and rows are read from the
+    // csv with it
+    db->memory_threshold = 0;
+    enforce_memory_threshold(db);
+    struct stat st;
+    assert(stat(offsets, &st) == 0, "row offsets written");
+    assert(table->row_offset_slots != NULL && table->keys_to_rows->len == 0 && table_memory(table) < 10000, "rows let go of");
+    assert(table_len(table) == 5002, "cold table len");
+    int same = 1;
+    char key[32];
+    for (int i = 0; i < 5000 && same; ++i) {
+        snprintf(key, sizeof(key), "user_%d", i);
+        for (int c = 0; c < 3; ++c) {
+            same &= strcmp(table_get(rows, key, c), table_get(table, key, c)) == 0;
+        }
+    }
+    assert(same, "cold rows match csv");
+    assert(strcmp(table_get(table, "user_7", 1), "dup@gmail.com") == 0, "cold row of repeated key");
+    assert(strcmp(table_get(table, "user,quoted", 2), "1") == 0, "cold row with quoted key");
+    assert(strcmp(table_get(table, "\"q\"", 2), "4") == 0, "cold row with quotes in its key");
+    assert(table_get(table, "nobody", 0) == NULL && table_get(table, "user_1", 3) == NULL, "cold row missing");
+    assert(selects(table, "likes", "1", 717, "user_7") && selects(table, "likes", "0", 714, "user_0"), "scan cold rows of repeated key");
+    assert(table->row_offset_slots != NULL && table->keys_to_rows->len == 0, "scan keeps rows let go");
+    free_database(row_db);
+
+    // changes are kept over the csv's rows, and the rewritten csv gets new
+    // offsets
+    List* row = new_list();
+    l_push(row, "user_5");
+    l_push(row, "new@gmail.com");
+    l_push(row, "5");
+    List* new_row = new_list();
+    l_push(new_row, "user_new");
+    l_push(new_row, "new_user@gmail.com");
+    List* new_rows = new_list();
+    l_push(new_rows, row);
+    l_push(new_rows, new_row);
+    Map* table_name_to_rows = new_map();
+    m_put(table_name_to_rows, "row_offsets_test", new_rows, sizeof(new_rows));
+    Map* table_name_to_keys_to_delete = new_map();
+    m_put(table_name_to_keys_to_delete, "row_offsets_test", "user_9", sizeof(char*));
+    db->memory_threshold = SIZE_MAX;
+    db->last_write_ms = current_time_ms();
+    transaction(db, table_name_to_rows, table_name_to_keys_to_delete);
+    assert(!table->saved && table->row_offset_slots != NULL && table->keys_to_rows->len == 2 && table_len(table) == 5002, "changes kept over cold table");
+    assert(strcmp(table_get(table, "user_5", 1), "new@gmail.com") == 0 && table_get(table, "user_9", 0) == NULL, "cold table changed");
+    assert(strcmp(table_get(table, "user_new", 1), "new_user@gmail.com") == 0 && strcmp(table_get(table, "user_10", 2), "3") == 0, "cold table inserted");
+    assert(selects(table, "email", "new@gmail.com", 1, "user_5") && selects(table, "likes", "2", 713, "user_2"), "scan changed cold table");
+
+    db->last_write_ms = 0;
+    transaction(db, table_name_to_rows, table_name_to_keys_to_delete);
+    assert(table->saved && table->row_offset_slots != NULL && table->keys_to_rows->len == 0, "written table saved");
+    db->memory_threshold = 0;
+    enforce_memory_threshold(db);
+    assert(table->row_offset_slots != NULL && table_len(table) == 5002, "written table let go of");
+    assert(strcmp(table_get(table, "user_5", 1), "new@gmail.com") == 0 && strcmp(table_get(table, "user_new", 1), "new_user@gmail.com") == 0, "cold rows after write");
+    assert(table_get(table, "user_9", 0) == NULL && strcmp(table_get(table, "user_10", 2), "3") == 0, "cold rows after delete");
+    assert(table_get(table, "\"q\"", 2) != NULL && strcmp(table_get(table, "\"q\"", 2), "4") == 0, "cold row with quotes in its key after write");
+
+    // scans read the rewritten csv
+    assert(selects(table, "likes", "1", 717, "user,quoted") && table->row_offset_slots != NULL, "scan cold table");
+
+    free_map(table_name_to_rows, 0);
+    free_map(table_name_to_keys_to_delete, 0);
+    free_list(new_rows, 0);
+    free_list(row, 0);
+    free_list(new_row, 0);
+    free_database(db);
+    remove(path);
+    remove(offsets);
+}
+
+/*
+    the value a row of column_encoding_test() is given in each column
+*/
+static void encoding_test_row(int i, char values[4][32]) {
+    snprintf(values[0], 32, "%d", 1000000 + i);
+    snprintf(values[1], 32, "city_%d", i % 50);
+    snprintf(values[2], 32, "group_%d", i / 1000);
+    snprintf(values[3], 32, "user_%d@gmail.com", i);
+}
+
+void column_encoding_test() {
+
+    // numbers, few distinct values, runs and unique values
+    ColumnStore* store = new_column_store(4);
+    char values[4][32];
+    int num_rows = 5000;
+    for (int i = 0; i < num_rows; ++i) {
+        encoding_test_row(i, values);
+        for (int c = 0; c < 4; ++c) {
+            cs_push_value(store, sv(values[c]));
+        }
+        cs_end_row(store);
+    }
+    size_t plain_bytes = cs_memory(store);
+    cs_compress(store);
+    assert(store->columns[0].encoding == COLUMN_FRAME_OF_REFERENCE && store->columns[0].width == 13, "compress numbers");
+    assert(store->columns[1].encoding == COLUMN_DICTIONARY && store->columns[1].width == 6, "compress dictionary");
+    assert(store->columns[2].encoding == COLUMN_RUN_LENGTH && store->columns[2].num_values == 5, "compress runs");
+    assert(store->columns[3].encoding == COLUMN_PLAIN, "compress leaves unique values plain");
+    assert(cs_memory(store) < plain_bytes * 2 / 3, "compress saves memory");
+
+    // adding rows that don't fit the encodings as they are
+    for (int i = num_rows; i < num_rows + 200; ++i) {
+        encoding_test_row(i % 2 ? i : -i, values);
+        for (int c = 0; c < 4; ++c) {
+            cs_push_value(store, sv(values[c]));
+        }
+        cs_end_row(store);
+    }
+    assert(store->columns[0].encoding == COLUMN_FRAME_OF_REFERENCE && store->columns[0].min == 1000000 - num_rows - 198, "numbers widen");
+    assert(store->columns[1].encoding == COLUMN_DICTIONARY && store->columns[1].num_values == 74 && store->columns[1].width == 7, "dictionary grows");
+    int same = store->num_rows == num_rows + 200;
+    for (int i = 0; i < num_rows + 200 && same; ++i) {
+        encoding_test_row(i < num_rows || i % 2 ? i : -i, values);
+        for (int c = 0; c < 4; ++c) {
+            same &= strcmp(cs_get(store, i, c), values[c]) == 0;
+        }
+    }
+    assert(same, "encoded values read back");
+
+    cs_push_value(store, sv("not a number"));
+    cs_end_row(store);
+    assert(store->columns[0].encoding == COLUMN_PLAIN && strcmp(cs_get(store, 7, 0), "1000007") == 0, "numbers go back to plain");
+    assert(strcmp(cs_get(store, num_rows + 200, 0), "not a number") == 0 && strcmp(cs_get(store, num_rows + 200, 1), "") == 0, "short row on encoded columns");
+
+    // filters on encoded columns match checking every value
+    uint64_t* matches = malloc(cs_bitmap_words(store) * sizeof(uint64_t));
+    cs_delete_row(store, 3);
+    cs_delete_row(store, 4003);
+    size_t count = cs_filter_equals(store, 1, sv("city_3"), matches);
+    size_t expected_count = 0;
+    same = 1;
+    for (int i = 0; i < store->num_rows; ++i) {
+        int expected = strcmp(cs_get(store, i, 1), "city_3") == 0 && i != 3 && i != 4003;
+        same &= ((matches[i / 64] >> (i % 64)) & 1) == expected;
+        expected_count += expected;
+    }
+    assert(same && count == expected_count && count == 102, "filter dictionary column");
+    assert(cs_filter_equals(store, 1, sv(""), matches) == 1 && cs_filter_equals(store, 1, sv("paris"), matches) == 0, "filter dictionary missing values");
+    count = cs_filter_equals(store, 2, sv("group_4"), matches);
+    assert(count == 999 && (matches[4000 / 64] >> (4000 % 64) & 1) && !(matches[3999 / 64] >> (3999 % 64) & 1), "filter runs");
+    assert(cs_filter_range(store, 1, 0, 100, matches) == 0, "filter range on text");
+    free(matches);
+    free_column_store(store);
+
+    // a number column using all 64 bits
+    store = new_column_store(1);
+    char number[NUMERIC_BUFFER_SIZE];
+    for (long i = 0; i < 200; ++i) {
+        format_long(i % 2 ? LONG_MAX - i : LONG_MIN + i, number);
+        cs_push_value(store, sv(number));
+        cs_end_row(store);
+    }
+    cs_compress(store);
+    matches = malloc(cs_bitmap_words(store) * sizeof(uint64_t));
+    assert(store->columns[0].encoding == COLUMN_FRAME_OF_REFERENCE && store->columns[0].width == 64, "64 bit numbers");
+    assert(strcmp(cs_get(store, 101, 0), "9223372036854775706") == 0 && strcmp(cs_get(store, 0, 0), "-9223372036854775808") == 0, "64 bit numbers read back");
+    assert(cs_filter_range(store, 0, LONG_MIN, LONG_MIN + 99, matches) == 50 && cs_filter_equals(store, 0, sv("9223372036854775806"), matches) == 1, "64 bit number filters");
+    assert(cs_filter_range(store, 0, LONG_MIN, LONG_MAX, matches) == 200, "64 bit number full range");
+    free(matches);
+    free_column_store(store);
+}
+
+/*
+    Loads a big csv the way load_csv() used to (read_lines() into a String
+    per line, then parsing each), with load_csv() and with
+    load_csv_parallel() on every core and with load_csv_columnar(), each in
+    its own process so the peak memory use of each can be measured.
+*/
+void load_csv_benchmark() {
+
+    size_t num_lines = 12000000;
+    char* path = "bench_load.csv";
+    FILE* file = fopen(path, "w");
+    fprintf(file, "user_id,email,likes,city\n");
+    for (size_t i = 0; i < num_lines; ++i) {
+        fprintf(file, "user_%zu,user_%zu@gmail.com,%zu,city_%zu\n", i, i, i % 1000, i % 50);
+    }
+    fclose(file);
+
+    long num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    char* names[4] = {"read_lines + parse_row", "load_csv (mmap)", "load_csv_parallel", "load_csv_columnar"};
+    for (int mode = 0; mode < 4; ++mode) {
+        fflush(stdout);
+        pid_t pid = fork();
+        if (pid == 0) {
+            struct timespec start;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            size_t num_rows = 0;
+            if (mode == 0) {
+                Table* table = new_table(path);
+                l_push(table->column_pools, NULL);
+                for (int c = 0; c < 3; ++c) l_push(table->column_pools, new_string_pool());
+                size_t num_read;
+                String** lines = read_lines(path, &num_read);
+                for (size_t y = 1; y < num_read; ++y) {
+                    if (lines[y]->len > 0) {
+                        Row* row = parse_row_view(string_view(lines[y], 0, lines[y]->len), table->column_pools);
+                        m_put(table->keys_to_rows, row->key, row, sizeof(Row));
+                    }
+                    free_string(lines[y]);
+                }
+                free_string(lines[0]);
+                free(lines);
+                num_rows = table->keys_to_rows->len;
+            }
+            else {
+                CsvDb* db = new_database();
+                if (mode == 1) load_csv(db, path);
+                else if (mode == 2) load_csv_parallel(db, path, num_threads);
+                else load_csv_columnar(db, path);
+                num_rows = ((Table*) m_get(db->table_name_to_table, "bench_load"))->keys_to_rows->len;
+            }
+            double ms = elapsed_ms(start);
+            struct rusage usage;
+            getrusage(RUSAGE_SELF, &usage);
+            printf("%s: %zu rows in %.0f ms, peak rss %ld MB (%ld cores)\n", names[mode], num_rows, ms, usage.ru_maxrss / 1024, num_threads);
+            fflush(stdout);
+            _exit(num_rows == num_lines ? 0 : 1);
+        }
+        int status;
+        waitpid(pid, &status, 0);
+        assert(WIFEXITED(status) && WEXITSTATUS(status) == 0, "benchmark loaded every row");
+    }
+    remove(path);
 }
 
 void set_test() {
@@ -415,6 +2054,28 @@ int main() {
     // map_resizing_all_methods();
     // stringstream_test();
     // set_test();
+    // string_view_test();
+    // string_pool_test();
+    // rope_test();
+    // numeric_test();
+    // arena_test();
+    // pool_test();
+    // utf8_test();
+    // load_csv_test();
+    // columnar_test();
+    // column_encoding_test();
+    // snapshot_test();
+    // index_test();
+    // memory_threshold_test();
+    // row_offsets_test();
+    // csv_test();
+    // csv_reader_test();
+    // list_sort_test();
+    // deque_test();
+    // list_benchmark();
+    // string_benchmark();
+    // numeric_benchmark();
+    // load_csv_benchmark();
     // return 0;
 
 